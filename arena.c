@@ -0,0 +1,124 @@
+/**
+ * @file arena.c
+ * @author sdcroche
+ *
+ * Arena is a bump allocator.  It keeps a list of blocks, each one
+ * twice as big as the last, and carves allocations off the front of
+ * the newest one.  It also has the checked versions of malloc() and
+ * friends that compiling and matching patterns use, since a pattern
+ * can ask for more memory than there is.
+ */
+#include "arena.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/** Alignment for every allocation, enough for any type we store. */
+#define ALIGN 16
+
+/** Size of the first block. */
+#define FIRST_BLOCK 4096
+
+/** Header at the start of each block; allocations come after it. */
+typedef struct ArenaBlockStruct {
+  /** Block that was allocated before this one. */
+  struct ArenaBlockStruct *next;
+} ArenaBlock;
+
+/** Room for the block header, rounded up so allocations are aligned. */
+#define HEADER ( ( sizeof( ArenaBlock ) + ALIGN - 1 ) & ~(size_t) ( ALIGN - 1 ) )
+
+/** State for an arena. */
+struct ArenaStruct {
+  /** The newest block, at the front of the list of all of them. */
+  ArenaBlock *blocks;
+
+  /** Next free byte in the newest block. */
+  char *next;
+
+  /** End of the newest block. */
+  char *end;
+
+  /** Size of the next block to allocate. */
+  size_t blockSize;
+};
+
+// Documented in the header.
+Arena *makeArena( void )
+{
+  Arena *arena = (Arena *) checkedMalloc( sizeof( Arena ) );
+  arena->blocks = NULL;
+  arena->next = NULL;
+  arena->end = NULL;
+  arena->blockSize = FIRST_BLOCK;
+  return arena;
+}
+
+// Documented in the header.
+void *allocArena( Arena *arena, size_t size )
+{
+  size = ( size + ALIGN - 1 ) & ~(size_t) ( ALIGN - 1 );
+
+  if ( (size_t) ( arena->end - arena->next ) < size ) {
+    // Start a new block, big enough for this even if it's huge.
+    while ( arena->blockSize < size )
+      arena->blockSize *= 2;
+    ArenaBlock *block =
+      (ArenaBlock *) checkedMalloc( HEADER + arena->blockSize );
+    block->next = arena->blocks;
+    arena->blocks = block;
+    arena->next = (char *) block + HEADER;
+    arena->end = arena->next + arena->blockSize;
+    arena->blockSize *= 2;
+  }
+
+  void *p = arena->next;
+  arena->next += size;
+  return p;
+}
+
+// Documented in the header.
+void freeArena( Arena *arena )
+{
+  while ( arena->blocks ) {
+    ArenaBlock *next = arena->blocks->next;
+    free( arena->blocks );
+    arena->blocks = next;
+  }
+  free( arena );
+}
+
+/**
+  Print a message and exit, when there isn't enough memory.
+*/
+static void outOfMemory( void )
+{
+  fprintf( stderr, "Out of memory\n" );
+  exit( EXIT_FAILURE );
+}
+
+// Documented in the header.
+void *checkedMalloc( size_t size )
+{
+  void *p = malloc( size );
+  if ( !p && size )
+    outOfMemory();
+  return p;
+}
+
+// Documented in the header.
+void *checkedCalloc( size_t count, size_t size )
+{
+  void *p = calloc( count, size );
+  if ( !p && count && size )
+    outOfMemory();
+  return p;
+}
+
+// Documented in the header.
+void *checkedRealloc( void *ptr, size_t size )
+{
+  void *p = realloc( ptr, size );
+  if ( !p && size )
+    outOfMemory();
+  return p;
+}
@@ -0,0 +1,64 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/** A short name to use for the arena. */
+typedef struct ArenaStruct Arena;
+
+/**
+  Make an empty arena.  Memory is handed out from big blocks by just
+  bumping a pointer, and it's all given back at once when the arena is
+  freed, so there's no freeing individual allocations.
+
+  @return a dynamically allocated arena.
+*/
+Arena *makeArena( void );
+
+/**
+  Allocate memory from an arena.  It's suitably aligned for any type,
+  and it stays valid until the arena is freed.
+
+  @param arena arena to allocate from.
+  @param size number of bytes needed.
+  @return pointer to the new memory.
+*/
+void *allocArena( Arena *arena, size_t size );
+
+/**
+  Free an arena along with everything that was allocated from it.
+
+  @param arena arena to free.
+*/
+void freeArena( Arena *arena );
+
+/**
+  Allocate memory with malloc(), or print a message and exit if there
+  isn't enough.
+
+  @param size number of bytes needed.
+  @return pointer to the new memory.
+*/
+void *checkedMalloc( size_t size );
+
+/**
+  Allocate zeroed memory with calloc(), or print a message and exit if
+  there isn't enough.
+
+  @param count number of elements needed.
+  @param size number of bytes in each element.
+  @return pointer to the new memory.
+*/
+void *checkedCalloc( size_t count, size_t size );
+
+/**
+  Resize memory with realloc(), or print a message and exit if there
+  isn't enough.
+
+  @param ptr memory to resize, or NULL.
+  @param size number of bytes needed.
+  @return pointer to the resized memory.
+*/
+void *checkedRealloc( void *ptr, size_t size );
+
+#endif
@@ -0,0 +1,1657 @@
+/**
+ * @file automaton.c
+ * @author sdcroche
+ *
+ * Automaton compiles a program into a nondeterministic automaton and
+ * runs it over whole buffers of input lines, building the states of
+ * an equivalent DFA as they're needed.  A thread of the automaton is
+ * an entry: an instruction index followed by the value of each
+ * counter, so big counted repetitions don't need copies of their
+ * sub-pattern.  Loops nested the same depth share a counter, and it's
+ * zero outside them, so threads that only differ in a loop they've
+ * left look the same.
+ */
+#include "automaton.h"
+#include "scan.h"
+#include <stdlib.h>
+#include <string.h>
+
+/** Initial capacity for the instruction, byte set and entry arrays. */
+#define INITIAL_CAP 16
+
+/** Fewest DFA states we'll keep before we throw them away and start
+    over.  Bigger automata get more, as many as they have instructions. */
+#define MAX_STATES 4096
+
+/** Most bytes of entries and transitions to keep in DFA states before
+    we throw them away and start over, since a state can have lots of
+    entries when there are counters. */
+#define MAX_CACHE_BYTES ( (size_t) 32 << 20 )
+
+/** Largest count a repetition can have and still be compiled as
+    copies of its sub-pattern, without a counter. */
+#define MAX_COPIES 16
+
+/** Most instructions the copies of a counted repetition can take. */
+#define MAX_COPIED_SIZE 1024
+
+/** Marks a DFA transition that hasn't been worked out yet. */
+#define UNKNOWN -1
+
+/** Index of the DFA state at the start of a line. */
+#define START_STATE 0
+
+/**
+  Add an instruction to the end of an automaton.
+
+  @param a automaton to add to.
+  @param op operation for the instruction.
+  @param arg first argument.
+  @param alt second argument.
+  @return index of the new instruction.
+*/
+static int emit( Automaton *a, OpCode op, int arg, int alt )
+{
+  if ( a->count >= a->cap ) {
+    a->cap *= 2;
+    a->code = (Instruction *) checkedRealloc( a->code,
+                                              a->cap * sizeof( Instruction ) );
+  }
+  a->code[ a->count ].op = op;
+  a->code[ a->count ].arg = arg;
+  a->code[ a->count ].alt = alt;
+  a->code[ a->count ].min = 0;
+  a->code[ a->count ].max = 0;
+  return a->count++;
+}
+
+/**
+  Add an empty byte set to an automaton.
+
+  @param a automaton to add to.
+  @return index of the new set.
+*/
+static int addSet( Automaton *a )
+{
+  if ( a->setCount >= a->setCap ) {
+    a->setCap *= 2;
+    a->sets = (bool (*)[ 256 ])
+      checkedRealloc( a->sets, a->setCap * sizeof( *a->sets ) );
+  }
+  memset( a->sets[ a->setCount ], 0, sizeof( *a->sets ) );
+  return a->setCount++;
+}
+
+/**
+  Return the byte set that holds just one byte, adding it to an
+  automaton if it isn't there yet.  Every instruction for that byte
+  shares the set, so a long literal doesn't need a set for each of
+  its bytes.  If the automaton folds case, a letter's set holds it in
+  both cases.  Letters only come here in lower case then, since that's
+  how the program stores its text, and its byte sets are already
+  folded.
+
+  @param a automaton to add to.
+  @param c the byte.
+  @return index of the set.
+*/
+static int singleSet( Automaton *a, unsigned char c )
+{
+  if ( a->single[ c ] < 0 ) {
+    a->single[ c ] = addSet( a );
+    a->sets[ a->single[ c ] ][ c ] = true;
+    if ( a->fold && c >= 'a' && c <= 'z' )
+      a->sets[ a->single[ c ] ][ c - 'a' + 'A' ] = true;
+  }
+  return a->single[ c ];
+}
+
+/**
+  Collect the operands of a chain of CONCAT_STEP or ALTERNATE_STEP
+  steps.  Chains nest to the left, so the first operand of each step
+  in the chain is another step just like it, except at the bottom.
+
+  @param prog program holding the chain.
+  @param i index of the step at the top of the chain.
+  @param count pointer to where to store the number of operands.
+  @return index of the last step of each operand, in order, in a
+          new array the caller frees.
+*/
+static int *chainOperands( Program const *prog, int i, int *count )
+{
+  StepOp op = prog->steps[ i ].op;
+  int n = 2;
+  for ( int j = firstOperand( prog, i ); prog->steps[ j ].op == op;
+        j = firstOperand( prog, j ) )
+    n++;
+
+  // Fill in from the back, since the last operand is found first.
+  int *ends = (int *) checkedMalloc( n * sizeof( int ) );
+  *count = n;
+  int j = i;
+  while ( prog->steps[ j ].op == op && n > 1 ) {
+    ends[ --n ] = j - 1;
+    j = firstOperand( prog, j );
+  }
+  ends[ 0 ] = j;
+  return ends;
+}
+
+/**
+  Decide which counted repetitions in a program get compiled as copies
+  of their sub-pattern.  That's the ones with a small limit, as long as
+  the copies don't get too big, so a program sized for a count of
+  three doesn't need a counter, but nesting them can't blow up.  This
+  works out how many instructions each step compiles to, going through
+  the program in order, since operands come before the steps that use
+  them.
+
+  @param prog program to look at.
+  @return a flag for each step, true for the counted repetitions that
+          are copied, in a new array the caller frees.
+*/
+static bool *planCopies( Program const *prog )
+{
+  int *size = (int *) checkedMalloc( prog->count * sizeof( int ) );
+  bool *copy = (bool *) checkedCalloc( prog->count, sizeof( bool ) );
+  for ( int i = 0; i < prog->count; i++ ) {
+    Step const *s = prog->steps + i;
+    int last = i > 0 ? size[ i - 1 ] : 0;
+    switch ( s->op ) {
+    case LITERAL_STEP:
+      size[ i ] = s->len;
+      break;
+    case CONCAT_STEP:
+      size[ i ] = size[ firstOperand( prog, i ) ] + last;
+      break;
+    case ALTERNATE_STEP:
+      size[ i ] = size[ firstOperand( prog, i ) ] + last + 2;
+      break;
+    case OPTIONAL_STEP:
+    case PLUS_STEP:
+      size[ i ] = last + 1;
+      break;
+    case STAR_STEP:
+      size[ i ] = last + 2;
+      break;
+    case COUNT_STEP: {
+      // Max copies, with a split in front of each optional one.
+      long long copied = (long long) s->max * last + s->max - s->min;
+      copy[ i ] = s->max >= 0 && s->max <= MAX_COPIES &&
+        copied <= MAX_COPIED_SIZE;
+      size[ i ] = copy[ i ] ? (int) copied : last + 3;
+      break;
+    }
+    default:
+      size[ i ] = 1;
+      break;
+    }
+  }
+
+  free( size );
+  return copy;
+}
+
+/**
+  Add instructions for a sub-program to the end of an automaton.  When
+  they're done, control falls through to whatever comes next.
+
+  @param a automaton to add to.
+  @param prog program being compiled.
+  @param copy which counted repetitions to copy out, from planCopies().
+  @param i index of the last step of the sub-program.
+  @param depth number of counters in use by loops around the
+               sub-program, which is also the next free counter.
+*/
+static void compile( Automaton *a, Program const *prog, bool const *copy,
+                     int i, int depth )
+{
+  Step const *s = prog->steps + i;
+  switch ( s->op ) {
+  case BYTE_STEP: {
+    int count = 0, last = 0;
+    for ( int b = 0; b < 256; b++ )
+      if ( inByteSet( prog->sets + s->arg, b ) ) {
+        count++;
+        last = b;
+      }
+    if ( count == 1 ) {
+      emit( a, BYTES_OP, singleSet( a, last ), 0 );
+      break;
+    }
+
+    int set = addSet( a );
+    for ( int b = 0; b < 256; b++ )
+      a->sets[ set ][ b ] = inByteSet( prog->sets + s->arg, b );
+    emit( a, BYTES_OP, set, 0 );
+    break;
+  }
+  case LITERAL_STEP:
+    for ( int k = 0; k < s->len; k++ )
+      emit( a, BYTES_OP, singleSet( a, prog->text[ s->arg + k ] ), 0 );
+    break;
+  case START_STEP:
+    emit( a, BOL_OP, 0, 0 );
+    break;
+  case END_STEP:
+    emit( a, EOL_OP, 0, 0 );
+    break;
+  case TAG_STEP:
+    // Nothing comes after a tag, so its thread is done.
+    emit( a, MATCH_OP, s->arg, 0 );
+    if ( s->arg >= a->tags )
+      a->tags = s->arg + 1;
+    break;
+  case CONCAT_STEP: {
+    // Compile a whole chain at once, so a long one doesn't recurse
+    // once for every operand.
+    int n;
+    int *ends = chainOperands( prog, i, &n );
+    for ( int k = 0; k < n; k++ )
+      compile( a, prog, copy, ends[ k ], depth );
+    free( ends );
+    break;
+  }
+  case ALTERNATE_STEP: {
+    // split L1, L2; L1: p1; jump end; L2: split ...; Ln: pn; end:
+    int n;
+    int *ends = chainOperands( prog, i, &n );
+    int *jumps = (int *) checkedMalloc( n * sizeof( int ) );
+    for ( int k = 0; k < n - 1; k++ ) {
+      int split = emit( a, SPLIT_OP, 0, 0 );
+      a->code[ split ].arg = a->count;
+      compile( a, prog, copy, ends[ k ], depth );
+      jumps[ k ] = emit( a, JUMP_OP, 0, 0 );
+      a->code[ split ].alt = a->count;
+    }
+    compile( a, prog, copy, ends[ n - 1 ], depth );
+    for ( int k = 0; k < n - 1; k++ )
+      a->code[ jumps[ k ] ].arg = a->count;
+    free( jumps );
+    free( ends );
+    break;
+  }
+  case OPTIONAL_STEP: {
+    // split L1, end; L1: p; end:
+    int split = emit( a, SPLIT_OP, 0, 0 );
+    a->code[ split ].arg = a->count;
+    compile( a, prog, copy, i - 1, depth );
+    a->code[ split ].alt = a->count;
+    break;
+  }
+  case STAR_STEP: {
+    // L0: split L1, end; L1: p; jump L0; end:
+    int split = emit( a, SPLIT_OP, 0, 0 );
+    a->code[ split ].arg = a->count;
+    compile( a, prog, copy, i - 1, depth );
+    emit( a, JUMP_OP, split, 0 );
+    a->code[ split ].alt = a->count;
+    break;
+  }
+  case PLUS_STEP: {
+    // L1: p; split L1, end; end:
+    int start = a->count;
+    compile( a, prog, copy, i - 1, depth );
+    emit( a, SPLIT_OP, start, a->count + 1 );
+    break;
+  }
+  case COUNT_STEP: {
+    if ( copy[ i ] ) {
+      // p ... p; split L1, end; L1: p; split L2, end; L2: p ... end:
+      int splits[ MAX_COPIES ];
+      for ( int k = 0; k < s->min; k++ )
+        compile( a, prog, copy, i - 1, depth );
+      for ( int k = s->min; k < s->max; k++ ) {
+        splits[ k - s->min ] = emit( a, SPLIT_OP, a->count + 1, 0 );
+        compile( a, prog, copy, i - 1, depth );
+      }
+      for ( int k = s->min; k < s->max; k++ )
+        a->code[ splits[ k - s->min ] ].alt = a->count;
+      break;
+    }
+
+    // count_start c; L: count_test c, end; p; count_next c, L; end:
+    int counter = depth;
+    if ( counter >= a->counters )
+      a->counters = counter + 1;
+    emit( a, COUNT_START_OP, counter, 0 );
+    int test = emit( a, COUNT_TEST_OP, counter, 0 );
+    a->code[ test ].min = s->min;
+    a->code[ test ].max = s->max;
+    compile( a, prog, copy, i - 1, depth + 1 );
+
+    // With no limit, the counter only has to get as far as min.
+    int next = emit( a, COUNT_NEXT_OP, counter, test );
+    a->code[ next ].max = s->max < 0 ? s->min : s->max;
+    a->code[ test ].alt = a->count;
+    break;
+  }
+  }
+}
+
+/**
+  Work out the byte classes for an automaton.  Starting with all bytes
+  in one class, each byte set splits every class into the bytes that
+  are in the set and the ones that aren't.
+
+  @param a automaton to find byte classes for.
+*/
+static void findClasses( Automaton *a )
+{
+  memset( a->classOf, 0, sizeof( a->classOf ) );
+  a->classCount = 1;
+
+  for ( int s = -1; s < a->setCount; s++ ) {
+    // The newline gets split off first, in a set of its own.
+    int split[ 256 ][ 2 ];
+    memset( split, -1, sizeof( split ) );
+    int count = 0;
+    for ( int b = 0; b < 256; b++ ) {
+      int in = s < 0 ? b == '\n' : a->sets[ s ][ b ];
+      int *c = &split[ a->classOf[ b ] ][ in ];
+      if ( *c < 0 )
+        *c = count++;
+      a->classOf[ b ] = *c;
+    }
+    a->classCount = count;
+  }
+
+  for ( int b = 255; b >= 0; b-- )
+    a->rep[ a->classOf[ b ] ] = b;
+}
+
+/**
+  Pick a literal that every match of a program has to contain, for
+  skipping lines that can't match.  That's the whole program if it's
+  a literal, or else the longest literal in a top-level concatenation.
+
+  @param a automaton to record the literal in.
+  @param prog program it was compiled from.
+*/
+static void findLiteral( Automaton *a, Program const *prog )
+{
+  int last = prog->count - 1;
+  Step const *best = NULL;
+  a->literalOnly = prog->steps[ last ].op == LITERAL_STEP;
+
+  if ( prog->steps[ last ].op == CONCAT_STEP ) {
+    int n;
+    int *ends = chainOperands( prog, last, &n );
+    for ( int k = 0; k < n; k++ ) {
+      Step const *s = prog->steps + ends[ k ];
+      if ( s->op == LITERAL_STEP && ( !best || s->len > best->len ) )
+        best = s;
+    }
+    free( ends );
+  }
+  else if ( a->literalOnly )
+    best = prog->steps + last;
+
+  // A literal with a newline in it could be found across two lines.
+  a->literal = NULL;
+  a->literalLen = 0;
+  if ( best && !memchr( prog->text + best->arg, '\n', best->len ) ) {
+    // The program lives as long as the automaton, so share its copy.
+    a->literalLen = best->len;
+    a->literal = prog->text + best->arg;
+  }
+  else
+    a->literalOnly = false;
+}
+
+// Documented in the header.
+Automaton *compileAutomaton( Program const *prog, Arena *arena )
+{
+  Automaton *a = (Automaton *) allocArena( arena, sizeof( Automaton ) );
+  a->count = 0;
+  a->cap = INITIAL_CAP;
+  a->code = (Instruction *) checkedMalloc( a->cap * sizeof( Instruction ) );
+  a->counters = 0;
+  a->tags = 1;
+  a->fold = prog->fold;
+  a->setCount = 0;
+  a->setCap = INITIAL_CAP;
+  a->sets = (bool (*)[ 256 ]) checkedMalloc( a->setCap * sizeof( *a->sets ) );
+  memset( a->single, -1, sizeof( a->single ) );
+
+  bool *copy = planCopies( prog );
+  compile( a, prog, copy, prog->count - 1, 0 );
+  free( copy );
+  emit( a, MATCH_OP, 0, 0 );
+  findClasses( a );
+  findLiteral( a, prog );
+
+  // Now that we know how big the program is, move it into the arena
+  // right after the automaton.
+  Instruction *code =
+    (Instruction *) allocArena( arena, a->count * sizeof( Instruction ) );
+  memcpy( code, a->code, a->count * sizeof( Instruction ) );
+  free( a->code );
+  a->code = code;
+  a->cap = a->count;
+
+  bool (*sets)[ 256 ] =
+    (bool (*)[ 256 ]) allocArena( arena, a->setCount * sizeof( *a->sets ) );
+  memcpy( sets, a->sets, a->setCount * sizeof( *a->sets ) );
+  free( a->sets );
+  a->sets = sets;
+  a->setCap = a->setCount;
+
+  return a;
+}
+
+/** Growable list of entries, all with the same number of counters. */
+typedef struct {
+  /** The entries, one after another. */
+  int *data;
+
+  /** Where each entry's match started, when finding match spans. */
+  size_t *starts;
+
+  /** Number of entries. */
+  int count;
+
+  /** Capacity, in entries. */
+  int cap;
+
+  /** Number of ints in each entry, one more than the number of counters. */
+  int stride;
+} EntryList;
+
+/**
+  Initialize an empty list of entries.
+
+  @param list list to initialize.
+  @param stride number of ints in each entry.
+*/
+static void initEntries( EntryList *list, int stride )
+{
+  list->count = 0;
+  list->cap = INITIAL_CAP;
+  list->stride = stride;
+  list->data = (int *) checkedMalloc( list->cap * stride * sizeof( int ) );
+  list->starts = (size_t *) checkedMalloc( list->cap * sizeof( size_t ) );
+}
+
+/**
+  Free the memory held by a list of entries.
+
+  @param list list to free the contents of.
+*/
+static void freeEntries( EntryList *list )
+{
+  free( list->data );
+  free( list->starts );
+}
+
+/**
+  Return an entry in a list.
+
+  @param list list holding the entry.
+  @param i index of the entry.
+  @return pointer to the entry.
+*/
+static int *entryAt( EntryList const *list, int i )
+{
+  return list->data + i * list->stride;
+}
+
+/**
+  Add a copy of an entry to the end of a list.
+
+  @param list list to add to.
+  @param entry entry to copy.
+*/
+static void appendEntry( EntryList *list, int const *entry )
+{
+  if ( list->count >= list->cap ) {
+    list->cap *= 2;
+    list->data = (int *)
+      checkedRealloc( list->data, list->cap * list->stride * sizeof( int ) );
+    list->starts = (size_t *) checkedRealloc( list->starts,
+                                              list->cap * sizeof( size_t ) );
+  }
+  memcpy( entryAt( list, list->count++ ), entry, list->stride * sizeof( int ) );
+}
+
+/**
+  Hash a run of ints.
+
+  @param data ints to hash.
+  @param n number of ints.
+  @return hash code for the ints.
+*/
+static unsigned int hashInts( int const *data, int n )
+{
+  unsigned int h = 2166136261u;
+  for ( int i = 0; i < n; i++ )
+    h = ( h ^ data[ i ] ) * 16777619u;
+  return h;
+}
+
+/**
+  Compare two entries, instruction first and then counters.
+
+  @param a first entry.
+  @param b second entry.
+  @param stride number of ints in each entry.
+  @return negative, zero or positive as a is before, the same as or
+          after b.
+*/
+static int compareEntries( int const *a, int const *b, int stride )
+{
+  for ( int i = 0; i < stride; i++ )
+    if ( a[ i ] != b[ i ] )
+      return a[ i ] < b[ i ] ? -1 : 1;
+  return 0;
+}
+
+/**
+  Sort the entries in a list, with a Shell sort, so the same set of
+  entries always looks the same.
+
+  @param list list to sort.
+*/
+static void sortEntries( EntryList *list )
+{
+  int stride = list->stride;
+  int tmp[ stride ];
+  for ( int gap = list->count / 2; gap > 0; gap /= 2 )
+    for ( int i = gap; i < list->count; i++ ) {
+      memcpy( tmp, entryAt( list, i ), stride * sizeof( int ) );
+      int j = i;
+      while ( j >= gap &&
+              compareEntries( entryAt( list, j - gap ), tmp, stride ) > 0 ) {
+        memcpy( entryAt( list, j ), entryAt( list, j - gap ),
+                stride * sizeof( int ) );
+        j -= gap;
+      }
+      memcpy( entryAt( list, j ), tmp, stride * sizeof( int ) );
+    }
+}
+
+/**
+  Set of entries seen while following instructions.  It's emptied by
+  moving on to a new generation, so clearing it doesn't take any time.
+*/
+typedef struct {
+  /** Entries seen in this generation. */
+  EntryList keys;
+
+  /** Hash table of indices into keys. */
+  int *slots;
+
+  /** Generation each slot was filled in; older slots are empty. */
+  int *stamps;
+
+  /** Number of slots, a power of two. */
+  int slotCap;
+
+  /** Current generation. */
+  int generation;
+} VisitSet;
+
+/**
+  Initialize an empty visit set.
+
+  @param v set to initialize.
+  @param stride number of ints in each entry.
+*/
+static void initVisits( VisitSet *v, int stride )
+{
+  initEntries( &v->keys, stride );
+  v->slotCap = 2 * INITIAL_CAP;
+  v->slots = (int *) checkedMalloc( v->slotCap * sizeof( int ) );
+  v->stamps = (int *) checkedCalloc( v->slotCap, sizeof( int ) );
+  v->generation = 1;
+}
+
+/**
+  Free the memory held by a visit set.
+
+  @param v set to free the contents of.
+*/
+static void freeVisits( VisitSet *v )
+{
+  freeEntries( &v->keys );
+  free( v->slots );
+  free( v->stamps );
+}
+
+/**
+  Empty a visit set.
+
+  @param v set to empty.
+*/
+static void resetVisits( VisitSet *v )
+{
+  v->generation++;
+  v->keys.count = 0;
+}
+
+/**
+  Put the entry at index i of the keys into the hash table.
+
+  @param v the visit set.
+  @param i index of the key.
+*/
+static void placeKey( VisitSet *v, int i )
+{
+  int stride = v->keys.stride;
+  unsigned int h = hashInts( entryAt( &v->keys, i ), stride );
+  int slot = h & ( v->slotCap - 1 );
+  while ( v->stamps[ slot ] == v->generation )
+    slot = ( slot + 1 ) & ( v->slotCap - 1 );
+  v->slots[ slot ] = i;
+  v->stamps[ slot ] = v->generation;
+}
+
+/**
+  Add an entry to a visit set, if it isn't there already.
+
+  @param v set to add to.
+  @param entry entry to add.
+  @return true if the entry is new.
+*/
+static bool visit( VisitSet *v, int const *entry )
+{
+  int stride = v->keys.stride;
+  unsigned int h = hashInts( entry, stride );
+  for ( int slot = h & ( v->slotCap - 1 ); v->stamps[ slot ] == v->generation;
+        slot = ( slot + 1 ) & ( v->slotCap - 1 ) )
+    if ( compareEntries( entryAt( &v->keys, v->slots[ slot ] ), entry,
+                         stride ) == 0 )
+      return false;
+
+  appendEntry( &v->keys, entry );
+
+  // Keep the table no more than half full.
+  if ( 2 * v->keys.count > v->slotCap ) {
+    v->slotCap *= 2;
+    v->slots = (int *) checkedRealloc( v->slots, v->slotCap * sizeof( int ) );
+    free( v->stamps );
+    v->stamps = (int *) checkedCalloc( v->slotCap, sizeof( int ) );
+    for ( int i = 0; i < v->keys.count; i++ )
+      placeKey( v, i );
+  }
+  else
+    placeKey( v, v->keys.count - 1 );
+
+  return true;
+}
+
+/** Room for following instructions that don't consume any input. */
+typedef struct {
+  /** Automaton we're following. */
+  Automaton const *nfa;
+
+  /** Entries we've already been to. */
+  VisitSet seen;
+
+  /** Entries we still have to go to. */
+  EntryList stack;
+} Walker;
+
+/**
+  Initialize a walker for an automaton.
+
+  @param w walker to initialize.
+  @param nfa automaton it will follow.
+*/
+static void initWalker( Walker *w, Automaton const *nfa )
+{
+  w->nfa = nfa;
+  initVisits( &w->seen, nfa->counters + 1 );
+  initEntries( &w->stack, nfa->counters + 1 );
+}
+
+/**
+  Free the memory held by a walker.
+
+  @param w walker to free the contents of.
+*/
+static void freeWalker( Walker *w )
+{
+  freeVisits( &w->seen );
+  freeEntries( &w->stack );
+}
+
+/**
+  Add all the entries reachable from a given one without consuming a
+  byte to a list.  Only entries that wait for something (bytes, the
+  end of the line or the end of the pattern) go in the list.  Entries
+  seen since the walker's visit set was last reset are skipped.
+
+  @param w walker to use.
+  @param entry entry to start from.
+  @param bol true if we're at the start of the line.
+  @param eol true if we're at the end of the line.
+  @param out list to add entries to.
+*/
+static void follow( Walker *w, int const *entry, bool bol, bool eol,
+                    EntryList *out )
+{
+  int stride = w->stack.stride;
+  int cur[ stride ];
+  int *counter = cur + 1;
+  appendEntry( &w->stack, entry );
+
+  while ( w->stack.count ) {
+    memcpy( cur, entryAt( &w->stack, --w->stack.count ), stride * sizeof( int ) );
+    if ( !visit( &w->seen, cur ) )
+      continue;
+
+    int pc = cur[ 0 ];
+    Instruction const *ins = w->nfa->code + pc;
+    switch ( ins->op ) {
+    case SPLIT_OP:
+      cur[ 0 ] = ins->alt;
+      appendEntry( &w->stack, cur );
+      cur[ 0 ] = ins->arg;
+      appendEntry( &w->stack, cur );
+      break;
+    case JUMP_OP:
+      cur[ 0 ] = ins->arg;
+      appendEntry( &w->stack, cur );
+      break;
+    case BOL_OP:
+      cur[ 0 ] = pc + 1;
+      if ( bol )
+        appendEntry( &w->stack, cur );
+      break;
+    case EOL_OP:
+      if ( eol ) {
+        cur[ 0 ] = pc + 1;
+        appendEntry( &w->stack, cur );
+      }
+      else
+        appendEntry( out, cur );
+      break;
+    case BYTES_OP:
+    case MATCH_OP:
+      appendEntry( out, cur );
+      break;
+    case COUNT_START_OP:
+      counter[ ins->arg ] = 0;
+      cur[ 0 ] = pc + 1;
+      appendEntry( &w->stack, cur );
+      break;
+    case COUNT_TEST_OP: {
+      int n = counter[ ins->arg ];
+      if ( ins->max < 0 || n < ins->max ) {
+        cur[ 0 ] = pc + 1;
+        appendEntry( &w->stack, cur );
+      }
+      // Counters go back to zero outside their loops, so threads that
+      // only differ in an old count look the same.
+      if ( n >= ins->min ) {
+        counter[ ins->arg ] = 0;
+        cur[ 0 ] = ins->alt;
+        appendEntry( &w->stack, cur );
+      }
+      break;
+    }
+    case COUNT_NEXT_OP:
+      if ( counter[ ins->arg ] < ins->max )
+        counter[ ins->arg ]++;
+      cur[ 0 ] = ins->alt;
+      appendEntry( &w->stack, cur );
+      break;
+    }
+  }
+}
+
+/** One state of the DFA, standing for a set of automaton entries. */
+typedef struct {
+  /** Sorted list of the entries at BYTES_OP, EOL_OP and MATCH_OP
+      instructions we could be at. */
+  int *entries;
+
+  /** Number of entries. */
+  int count;
+
+  /** True if the pattern has already matched somewhere on the line. */
+  bool accept;
+
+  /** True if the pattern matches if the line ends here. */
+  bool eolAccept;
+
+  /** True if nothing more on this line can lead to a match. */
+  bool dead;
+
+  /** Next state for each byte class, or UNKNOWN. */
+  int *next;
+} DfaState;
+
+/**
+  DFA states built from an automaton.  Each thread has its own, in
+  its match context.
+*/
+struct DfaCacheStruct {
+  /** Automaton these states were built from. */
+  Automaton const *nfa;
+
+  /** States built so far.  The one at START_STATE is for the start
+      of a line. */
+  DfaState *states;
+
+  /** Number of states. */
+  int count;
+
+  /** Capacity of states. */
+  int cap;
+
+  /** Hash table of state indices, with UNKNOWN for empty slots. */
+  int *table;
+
+  /** Number of slots in table, a power of two. */
+  int tableCap;
+
+  /** Most states to keep before starting over, half of tableCap.  An
+      alternation of many literals needs about one state for each of
+      its instructions, so it's at least that many. */
+  int maxStates;
+
+  /** Bytes of entries and transitions held by the states; we start
+      over if this gets past MAX_CACHE_BYTES, too. */
+  size_t bytes;
+
+  /** Index of the COUNT_TEST_OP for the innermost loop around each
+      instruction, or -1 if it isn't in one. */
+  int *loopOf;
+
+  /** Room for following instructions. */
+  Walker walk;
+
+  /** Entries for the state being built. */
+  EntryList list;
+
+  /** Entries reached at the end of a line, to see if they match. */
+  EntryList ends;
+
+  /** Which tags have been found on the line, for matchingTags(). */
+  bool *tagSeen;
+
+  /** Tags found on the line, in the order they were found. */
+  int *tagList;
+
+  /** Number of tags in tagList. */
+  int tagCount;
+};
+
+/**
+  Throw away all the DFA states in a cache.
+
+  @param cache cache to clear.
+*/
+static void clearStates( DfaCache *cache )
+{
+  for ( int i = 0; i < cache->count; i++ ) {
+    free( cache->states[ i ].entries );
+    free( cache->states[ i ].next );
+  }
+  cache->count = 0;
+  cache->bytes = 0;
+  for ( int i = 0; i < cache->tableCap; i++ )
+    cache->table[ i ] = UNKNOWN;
+}
+
+/**
+  Work out the innermost loop around each instruction of an automaton.
+  The body of a loop is everything after its COUNT_TEST_OP up to where
+  that leaves the loop, and loops nest inside each other.
+
+  @param nfa automaton to look at.
+  @return index of the COUNT_TEST_OP for each instruction, or -1, in a
+          new array the caller frees.
+*/
+static int *findLoops( Automaton const *nfa )
+{
+  int *loopOf = (int *) checkedMalloc( nfa->count * sizeof( int ) );
+  int *open = (int *) checkedMalloc( nfa->count * sizeof( int ) );
+  int height = 0;
+  for ( int pc = 0; pc < nfa->count; pc++ ) {
+    while ( height && nfa->code[ open[ height - 1 ] ].alt <= pc )
+      height--;
+    loopOf[ pc ] = height ? open[ height - 1 ] : -1;
+    if ( nfa->code[ pc ].op == COUNT_TEST_OP && nfa->code[ pc ].alt > pc )
+      open[ height++ ] = pc;
+  }
+  free( open );
+  return loopOf;
+}
+
+/**
+  Report if one entry can do everything another one can.  That's true
+  if they're at the same instruction and the first one's counters are
+  all the same or smaller, as long as each smaller one belongs to a
+  loop it's in and has done enough repetitions to leave that loop once
+  this one's over.  Then it can leave whenever the other one can, and
+  it has at least as many repetitions left.
+
+  @param nfa automaton the entries are for.
+  @param loopOf innermost loop around each instruction, from findLoops().
+  @param stride number of ints in each entry.
+  @param a entry that might cover the other one.
+  @param b entry that might be covered.
+  @return true if a covers b.
+*/
+static bool covers( Automaton const *nfa, int const *loopOf, int stride,
+                    int const *a, int const *b )
+{
+  if ( a[ 0 ] != b[ 0 ] )
+    return false;
+
+  int smaller = 0;
+  for ( int k = 1; k < stride; k++ ) {
+    if ( a[ k ] > b[ k ] )
+      return false;
+    if ( a[ k ] < b[ k ] )
+      smaller++;
+  }
+
+  for ( int t = loopOf[ a[ 0 ] ]; t >= 0 && smaller; t = loopOf[ t ] ) {
+    Instruction const *ins = nfa->code + t;
+    int n = a[ ins->arg + 1 ];
+    if ( n < b[ ins->arg + 1 ] ) {
+      if ( n + 1 < ins->min )
+        return false;
+      smaller--;
+    }
+  }
+  return smaller == 0;
+}
+
+/**
+  Report if an entry could cover some other one at all, which takes a
+  counter for a loop it's in that's far enough along to leave it.
+
+  @param nfa automaton the entry is for.
+  @param loopOf innermost loop around each instruction, from findLoops().
+  @param entry the entry.
+  @return true if there could be an entry it covers.
+*/
+static bool canCover( Automaton const *nfa, int const *loopOf,
+                      int const *entry )
+{
+  for ( int t = loopOf[ entry[ 0 ] ]; t >= 0; t = loopOf[ t ] )
+    if ( entry[ nfa->code[ t ].arg + 1 ] + 1 >= nfa->code[ t ].min )
+      return true;
+  return false;
+}
+
+/**
+  Drop the entries in the cache's sorted list that are covered by
+  another one, so states that only differ in how far along their
+  counters are turn into the same state.  An entry can only be covered
+  by one that sorts before it, with the same instruction.
+
+  @param cache cache with the list to trim.
+*/
+static void dropCovered( DfaCache *cache )
+{
+  EntryList *list = &cache->list;
+  int kept = 0;
+  int group = 0;
+  for ( int i = 0; i < list->count; i++ ) {
+    int *entry = entryAt( list, i );
+    if ( kept == 0 || entryAt( list, kept - 1 )[ 0 ] != entry[ 0 ] )
+      group = kept;
+
+    bool covered = false;
+    for ( int j = group; j < kept && !covered; j++ )
+      covered = canCover( cache->nfa, cache->loopOf, entryAt( list, j ) ) &&
+        covers( cache->nfa, cache->loopOf, list->stride, entryAt( list, j ),
+                entry );
+    if ( !covered ) {
+      if ( kept < i )
+        memcpy( entryAt( list, kept ), entry, list->stride * sizeof( int ) );
+      kept++;
+    }
+  }
+  list->count = kept;
+}
+
+/**
+  Make a DFA state for the list of entries in the cache, or find the
+  one we already have.  The start state is never looked up this way,
+  since it's the only one where we're at the start of the line.
+
+  @param cache cache to add the state to.
+  @param bol true if this is the state for the start of a line.
+  @return index of the state.
+*/
+static int addState( DfaCache *cache, bool bol )
+{
+  EntryList *list = &cache->list;
+  int stride = list->stride;
+  sortEntries( list );
+  if ( stride > 1 )
+    dropCovered( cache );
+  int size = list->count * stride;
+  unsigned int h = hashInts( list->data, size );
+
+  if ( !bol ) {
+    for ( int i = h & ( cache->tableCap - 1 ); cache->table[ i ] != UNKNOWN;
+          i = ( i + 1 ) & ( cache->tableCap - 1 ) ) {
+      DfaState const *s = cache->states + cache->table[ i ];
+      if ( s->count == list->count &&
+           memcmp( s->entries, list->data, size * sizeof( int ) ) == 0 )
+        return cache->table[ i ];
+    }
+  }
+
+  if ( cache->count >= cache->cap ) {
+    cache->cap *= 2;
+    cache->states = (DfaState *)
+      checkedRealloc( cache->states, cache->cap * sizeof( DfaState ) );
+  }
+  DfaState *s = cache->states + cache->count;
+  s->count = list->count;
+  s->entries = (int *) checkedMalloc( ( size ? size : 1 ) * sizeof( int ) );
+  memcpy( s->entries, list->data, size * sizeof( int ) );
+  s->next = (int *) checkedMalloc( cache->nfa->classCount * sizeof( int ) );
+  for ( int c = 0; c < cache->nfa->classCount; c++ )
+    s->next[ c ] = UNKNOWN;
+  s->dead = s->count == 0;
+  cache->bytes += sizeof( DfaState ) +
+    ( size + cache->nfa->classCount ) * sizeof( int );
+
+  // See if we've matched already, or would if the line ended here.
+  s->accept = false;
+  resetVisits( &cache->walk.seen );
+  cache->ends.count = 0;
+  int cur[ stride ];
+  for ( int i = 0; i < s->count; i++ ) {
+    memcpy( cur, s->entries + i * stride, stride * sizeof( int ) );
+    Instruction const *ins = cache->nfa->code + cur[ 0 ];
+    if ( ins->op == MATCH_OP )
+      s->accept = true;
+    else if ( ins->op == EOL_OP ) {
+      cur[ 0 ]++;
+      follow( &cache->walk, cur, bol, true, &cache->ends );
+    }
+  }
+  s->eolAccept = s->accept;
+  for ( int i = 0; i < cache->ends.count; i++ )
+    if ( cache->nfa->code[ entryAt( &cache->ends, i )[ 0 ] ].op == MATCH_OP )
+      s->eolAccept = true;
+
+  if ( !bol ) {
+    int i = h & ( cache->tableCap - 1 );
+    while ( cache->table[ i ] != UNKNOWN )
+      i = ( i + 1 ) & ( cache->tableCap - 1 );
+    cache->table[ i ] = cache->count;
+  }
+
+  return cache->count++;
+}
+
+/**
+  Add the entries for the start of the pattern to the cache's list.
+
+  @param cache cache with the list to add to.
+  @param bol true if we're at the start of the line.
+*/
+static void addStart( DfaCache *cache, bool bol )
+{
+  int start[ cache->list.stride ];
+  memset( start, 0, sizeof( start ) );
+  follow( &cache->walk, start, bol, false, &cache->list );
+}
+
+/**
+  Add the state for the start of a line to an empty cache.
+
+  @param cache cache to add the state to.
+*/
+static void addStartState( DfaCache *cache )
+{
+  resetVisits( &cache->walk.seen );
+  cache->list.count = 0;
+  addStart( cache, true );
+  addState( cache, true );
+}
+
+/**
+  Make an empty DFA cache for an automaton.
+
+  @param nfa automaton the states will be built from.
+  @return a dynamically allocated cache.
+*/
+static DfaCache *makeDfaCache( Automaton const *nfa )
+{
+  DfaCache *cache = (DfaCache *) checkedMalloc( sizeof( DfaCache ) );
+  cache->nfa = nfa;
+  cache->count = 0;
+  cache->bytes = 0;
+  cache->cap = INITIAL_CAP;
+  cache->states = (DfaState *) checkedMalloc( cache->cap * sizeof( DfaState ) );
+  cache->loopOf = findLoops( nfa );
+
+  // Twice as many slots as states, so the table is never too full.
+  cache->maxStates = MAX_STATES;
+  while ( cache->maxStates < nfa->count )
+    cache->maxStates *= 2;
+  cache->tableCap = 2 * cache->maxStates;
+  cache->table = (int *) checkedMalloc( cache->tableCap * sizeof( int ) );
+  for ( int i = 0; i < cache->tableCap; i++ )
+    cache->table[ i ] = UNKNOWN;
+
+  initWalker( &cache->walk, nfa );
+  initEntries( &cache->list, nfa->counters + 1 );
+  initEntries( &cache->ends, nfa->counters + 1 );
+  cache->tagSeen = (bool *) checkedCalloc( nfa->tags, sizeof( bool ) );
+  cache->tagList = (int *) checkedMalloc( nfa->tags * sizeof( int ) );
+
+  addStartState( cache );
+  return cache;
+}
+
+// Documented in the header.
+void freeDfaCache( DfaCache *cache )
+{
+  clearStates( cache );
+  free( cache->states );
+  free( cache->table );
+  free( cache->loopOf );
+  freeWalker( &cache->walk );
+  freeEntries( &cache->list );
+  freeEntries( &cache->ends );
+  free( cache->tagSeen );
+  free( cache->tagList );
+  free( cache );
+}
+
+/**
+  Work out the state the DFA goes to from a given state on a byte
+  class, building it if we don't have it yet.  Since the pattern can
+  start matching anywhere on the line, the next state always includes
+  the entries at the start of the pattern.
+
+  @param cache cache holding the states.
+  @param from index of the state we're in.
+  @param cls byte class we're consuming.
+  @return index of the next state.
+*/
+static int step( DfaCache *cache, int from, int cls )
+{
+  Automaton const *nfa = cache->nfa;
+  DfaState const *s = cache->states + from;
+  int stride = cache->list.stride;
+  unsigned char b = nfa->rep[ cls ];
+
+  resetVisits( &cache->walk.seen );
+  cache->list.count = 0;
+  int cur[ stride ];
+  for ( int i = 0; i < s->count; i++ ) {
+    memcpy( cur, s->entries + i * stride, stride * sizeof( int ) );
+    Instruction const *ins = nfa->code + cur[ 0 ];
+    if ( ins->op == BYTES_OP && nfa->sets[ ins->arg ][ b ] ) {
+      cur[ 0 ]++;
+      follow( &cache->walk, cur, false, false, &cache->list );
+    }
+  }
+  addStart( cache, false );
+
+  // If we have too many states, or they're too big, start over.  The
+  // from state goes away, so we don't remember this transition.
+  if ( cache->count >= cache->maxStates ||
+       cache->bytes >= MAX_CACHE_BYTES ) {
+    int size = cache->list.count * stride;
+    int *saved = (int *) checkedMalloc( ( size ? size : 1 ) * sizeof( int ) );
+    memcpy( saved, cache->list.data, size * sizeof( int ) );
+    int count = cache->list.count;
+    clearStates( cache );
+    addStartState( cache );
+    cache->list.count = 0;
+    for ( int i = 0; i < count; i++ )
+      appendEntry( &cache->list, saved + i * stride );
+    free( saved );
+    return addState( cache, false );
+  }
+
+  int to = addState( cache, false );
+  cache->states[ from ].next[ cls ] = to;
+  return to;
+}
+
+/**
+  Run the DFA over a region of whole lines to find the first one with
+  a match.
+
+  @param a automaton to match.
+  @param cache DFA states for the automaton.
+  @param data region of whole lines.
+  @param len number of bytes in data.
+  @param pos index of the start of the line to start searching at.
+  @return index of the start of the first matching line at or after
+          pos, or len if none of them match.
+*/
+static size_t runDfa( Automaton const *a, DfaCache *cache,
+                      char const *data, size_t len, size_t pos )
+{
+  size_t lineStart = pos;
+  int cur = START_STATE;
+  for ( size_t i = pos; i < len; i++ ) {
+    DfaState const *s = cache->states + cur;
+    if ( s->accept )
+      return lineStart;
+
+    unsigned char c = data[ i ];
+    if ( c == '\n' ) {
+      if ( s->eolAccept )
+        return lineStart;
+      cur = START_STATE;
+      lineStart = i + 1;
+      continue;
+    }
+
+    if ( s->dead ) {
+      // Nothing else on this line can match, so skip to the next one.
+      char const *nl = findByte( data + i, len - i, '\n' );
+      if ( !nl )
+        return len;
+      cur = START_STATE;
+      lineStart = nl - data + 1;
+      i = nl - data;
+      continue;
+    }
+
+    int cls = a->classOf[ c ];
+    cur = s->next[ cls ];
+    if ( cur == UNKNOWN )
+      cur = step( cache, s - cache->states, cls );
+  }
+
+  // The last line may not end with a newline.
+  if ( lineStart < len && cache->states[ cur ].eolAccept )
+    return lineStart;
+  return len;
+}
+
+/**
+  Get the DFA states for an automaton from a context, making an empty
+  cache if the context doesn't have one for it yet.
+
+  @param a automaton the states are built from.
+  @param ctx context for the calling thread.
+  @return the cache kept in ctx.
+*/
+static DfaCache *dfaCacheFor( Automaton const *a, MatchContext *ctx )
+{
+  if ( ctx->dfa && ctx->dfa->nfa != a ) {
+    freeDfaCache( ctx->dfa );
+    ctx->dfa = NULL;
+  }
+  if ( !ctx->dfa )
+    ctx->dfa = makeDfaCache( a );
+  return ctx->dfa;
+}
+
+// Documented in the header.
+size_t findMatchingLine( Automaton const *a, MatchContext *ctx,
+                         char const *data, size_t len, size_t pos )
+{
+  DfaCache *cache = dfaCacheFor( a, ctx );
+
+  if ( !a->literal )
+    return runDfa( a, cache, data, len, pos );
+
+  // Jump to the next line with the literal on it, and only run the
+  // DFA over that line.
+  while ( pos < len ) {
+    char const *hit = a->fold ?
+      findSubstringFold( data + pos, len - pos, a->literal, a->literalLen ) :
+      findSubstring( data + pos, len - pos, a->literal, a->literalLen );
+    if ( !hit )
+      return len;
+
+    char const *nl = findLastByte( data + pos, hit - data - pos, '\n' );
+    size_t lineStart = nl ? nl - data + 1 : pos;
+    if ( a->literalOnly )
+      return lineStart;
+
+    nl = findByte( hit, data + len - hit, '\n' );
+    size_t lineEnd = nl ? nl - data + 1 : len;
+    size_t found = runDfa( a, cache, data, lineEnd, lineStart );
+    if ( found < lineEnd )
+      return found;
+    pos = lineEnd;
+  }
+
+  return len;
+}
+
+// Documented in the header.
+size_t countMatchingLines( Automaton const *a, MatchContext *ctx,
+                           char const *data, size_t len )
+{
+  size_t count = 0;
+  size_t pos = findMatchingLine( a, ctx, data, len, 0 );
+  while ( pos < len ) {
+    count++;
+
+    // Once a line matches, the rest of it doesn't matter.
+    char const *nl = findByte( data + pos, len - pos, '\n' );
+    if ( !nl )
+      break;
+    pos = findMatchingLine( a, ctx, data, len, nl - data + 1 );
+  }
+
+  return count;
+}
+
+/**
+  Add the tags of the MATCH_OP entries in a list to the ones found on
+  the current line, skipping any that were already found.
+
+  @param cache cache where the tags are being collected.
+  @param entries the entries, one after another.
+  @param count number of entries.
+*/
+static void addTags( DfaCache *cache, int const *entries, int count )
+{
+  Automaton const *nfa = cache->nfa;
+  int stride = cache->list.stride;
+  for ( int i = 0; i < count; i++ ) {
+    Instruction const *ins = nfa->code + entries[ i * stride ];
+    if ( ins->op == MATCH_OP && !cache->tagSeen[ ins->arg ] ) {
+      cache->tagSeen[ ins->arg ] = true;
+      cache->tagList[ cache->tagCount++ ] = ins->arg;
+    }
+  }
+}
+
+/**
+  Compare two tags, for sorting them.
+
+  @param a pointer to the first tag.
+  @param b pointer to the second tag.
+  @return negative, zero or positive as a is less than, equal to or
+          greater than b.
+*/
+static int compareTags( void const *a, void const *b )
+{
+  return *(int const *) a - *(int const *) b;
+}
+
+// Documented in the header.
+int const *matchingTags( Automaton const *a, MatchContext *ctx,
+                         char const *str, size_t len, int *count )
+{
+  DfaCache *cache = dfaCacheFor( a, ctx );
+  cache->tagCount = 0;
+
+  // A state holds the MATCH_OP entries for the matches that end right
+  // where it is, so running the DFA over the line passes all of them.
+  int cur = START_STATE;
+  for ( size_t i = 0; i < len; i++ ) {
+    DfaState const *s = cache->states + cur;
+    if ( s->accept )
+      addTags( cache, s->entries, s->count );
+    if ( s->dead )
+      break;
+
+    int cls = a->classOf[ (unsigned char) str[ i ] ];
+    cur = s->next[ cls ];
+    if ( cur == UNKNOWN )
+      cur = step( cache, s - cache->states, cls );
+  }
+
+  // Then there are the matches the end of the line finishes off.
+  DfaState const *s = cache->states + cur;
+  addTags( cache, s->entries, s->count );
+  if ( s->eolAccept ) {
+    resetVisits( &cache->walk.seen );
+    cache->ends.count = 0;
+    int stride = cache->list.stride;
+    int entry[ stride ];
+    for ( int i = 0; i < s->count; i++ )
+      if ( a->code[ s->entries[ i * stride ] ].op == EOL_OP ) {
+        memcpy( entry, s->entries + i * stride, stride * sizeof( int ) );
+        entry[ 0 ]++;
+        follow( &cache->walk, entry, cur == START_STATE, true, &cache->ends );
+      }
+    addTags( cache, cache->ends.data, cache->ends.count );
+  }
+
+  // Clear just the flags we set, so the next line starts fresh.
+  for ( int k = 0; k < cache->tagCount; k++ )
+    cache->tagSeen[ cache->tagList[ k ] ] = false;
+  qsort( cache->tagList, cache->tagCount, sizeof( int ), compareTags );
+
+  *count = cache->tagCount;
+  return cache->tagList;
+}
+
+/**
+  Room for finding match spans with an automaton.  Each thread has its
+  own, in its match context.
+*/
+struct SpanSearchStruct {
+  /** Automaton this was sized for. */
+  Automaton const *nfa;
+
+  /** Room for following instructions. */
+  Walker walk;
+
+  /** Threads at the current position, ordered by where they started. */
+  EntryList clist;
+
+  /** Threads at the next position, as they're being built. */
+  EntryList nlist;
+
+  /** Innermost loop around each instruction, from findLoops(). */
+  int *loopOf;
+
+  /** Index in nlist of the last thread kept at each instruction, if
+      its stamp is the current one. */
+  int *lastAt;
+
+  /** When each element of lastAt was set. */
+  int *lastStamp;
+
+  /** Stamp for the nlist being built. */
+  int stamp;
+
+  /** Index in nlist of the thread kept before each one at the same
+      instruction, or -1. */
+  int *before;
+
+  /** Capacity of before. */
+  int beforeCap;
+};
+
+/**
+  Make room for finding match spans with an automaton.
+
+  @param nfa automaton the spans will be found with.
+  @return a dynamically allocated span search.
+*/
+static SpanSearch *makeSpanSearch( Automaton const *nfa )
+{
+  SpanSearch *search = (SpanSearch *) checkedMalloc( sizeof( SpanSearch ) );
+  search->nfa = nfa;
+  initWalker( &search->walk, nfa );
+  initEntries( &search->clist, nfa->counters + 1 );
+  initEntries( &search->nlist, nfa->counters + 1 );
+  search->loopOf = findLoops( nfa );
+  search->lastAt = (int *) checkedMalloc( nfa->count * sizeof( int ) );
+  search->lastStamp = (int *) checkedCalloc( nfa->count, sizeof( int ) );
+  search->stamp = 0;
+  search->beforeCap = INITIAL_CAP;
+  search->before = (int *) checkedMalloc( search->beforeCap * sizeof( int ) );
+  return search;
+}
+
+// Documented in the header.
+void freeSpanSearch( SpanSearch *search )
+{
+  freeWalker( &search->walk );
+  freeEntries( &search->clist );
+  freeEntries( &search->nlist );
+  free( search->loopOf );
+  free( search->lastAt );
+  free( search->lastStamp );
+  free( search->before );
+  free( search );
+}
+
+/**
+  Start building a new list of threads, with no threads kept at any
+  instruction yet.
+
+  @param search the span search.
+  @param list list that's about to be built.
+*/
+static void startList( SpanSearch *search, EntryList *list )
+{
+  resetVisits( &search->walk.seen );
+  list->count = 0;
+  search->stamp++;
+}
+
+/**
+  Drop the threads just added to the end of a list that are covered by
+  one already in it.  The list is in order of where the threads
+  started, so the one that covers it started at least as early, and
+  makes at least as good a match.
+
+  @param search the span search.
+  @param list list the threads were added to.
+  @param from index of the first thread that was added.
+*/
+static void dropCoveredThreads( SpanSearch *search, EntryList *list, int from )
+{
+  Automaton const *nfa = search->nfa;
+  if ( search->beforeCap < list->cap ) {
+    search->beforeCap = list->cap;
+    search->before = (int *)
+      checkedRealloc( search->before, search->beforeCap * sizeof( int ) );
+  }
+
+  int kept = from;
+  for ( int i = from; i < list->count; i++ ) {
+    int *entry = entryAt( list, i );
+    int pc = entry[ 0 ];
+    int prev = search->lastStamp[ pc ] == search->stamp ?
+      search->lastAt[ pc ] : -1;
+
+    bool covered = false;
+    for ( int j = prev; j >= 0 && !covered; j = search->before[ j ] )
+      covered = covers( nfa, search->loopOf, list->stride,
+                        entryAt( list, j ), entry );
+    if ( covered )
+      continue;
+
+    if ( kept < i ) {
+      memcpy( entryAt( list, kept ), entry, list->stride * sizeof( int ) );
+      list->starts[ kept ] = list->starts[ i ];
+    }
+
+    // Only the threads that could cover another one need checking.
+    if ( canCover( nfa, search->loopOf, entry ) ) {
+      search->before[ kept ] = prev;
+      search->lastAt[ pc ] = kept;
+      search->lastStamp[ pc ] = search->stamp;
+    }
+    kept++;
+  }
+  list->count = kept;
+}
+
+/**
+  Add a thread, and all the threads reachable from it without
+  consuming a byte, to a list.  An entry already reached at this
+  position is skipped, since the thread that got there first started
+  earlier and always makes the better match.
+
+  @param search the span search.
+  @param list list to add to.
+  @param entry entry the thread is at.
+  @param start where the thread's match started.
+  @param len length of the line.
+  @param pos position in the line the thread is at.
+*/
+static void addThread( SpanSearch *search, EntryList *list, int const *entry,
+                       size_t start, size_t len, size_t pos )
+{
+  int before = list->count;
+  follow( &search->walk, entry, pos == 0, pos == len, list );
+  for ( int i = before; i < list->count; i++ )
+    list->starts[ i ] = start;
+  if ( list->stride > 1 )
+    dropCoveredThreads( search, list, before );
+}
+
+// Documented in the header.
+bool nextSpan( Automaton const *a, MatchContext *ctx, char const *str,
+               size_t len, size_t from, size_t *begin, size_t *end )
+{
+  if ( ctx->spans && ctx->spans->nfa != a ) {
+    freeSpanSearch( ctx->spans );
+    ctx->spans = NULL;
+  }
+  if ( !ctx->spans )
+    ctx->spans = makeSpanSearch( a );
+  SpanSearch *search = ctx->spans;
+
+  int stride = a->counters + 1;
+  int cur[ stride ];
+  int start[ stride ];
+  memset( start, 0, sizeof( start ) );
+
+  bool found = false;
+  startList( search, &search->clist );
+  addThread( search, &search->clist, start, from, len, from );
+
+  for ( size_t i = from; ; i++ ) {
+    EntryList *clist = &search->clist;
+
+    // Threads are in order of where they started, so the first one
+    // that's matched something has the leftmost match ending here.
+    for ( int t = 0; t < clist->count; t++ ) {
+      size_t s = clist->starts[ t ];
+      if ( a->code[ entryAt( clist, t )[ 0 ] ].op == MATCH_OP && i > s ) {
+        if ( !found || s < *begin || ( s == *begin && i > *end ) ) {
+          *begin = s;
+          *end = i;
+        }
+        found = true;
+        break;
+      }
+    }
+
+    // Once there's a match, threads that started after it can't win.
+    if ( found )
+      while ( clist->count && clist->starts[ clist->count - 1 ] > *begin )
+        clist->count--;
+
+    if ( i == len || ( found && clist->count == 0 ) )
+      break;
+
+    // Step every thread over this byte, then start a new one after it
+    // if we're still looking.
+    EntryList *nlist = &search->nlist;
+    startList( search, nlist );
+    unsigned char c = str[ i ];
+    for ( int t = 0; t < clist->count; t++ ) {
+      memcpy( cur, entryAt( clist, t ), stride * sizeof( int ) );
+      Instruction const *ins = a->code + cur[ 0 ];
+      if ( ins->op == BYTES_OP && a->sets[ ins->arg ][ c ] ) {
+        cur[ 0 ]++;
+        addThread( search, nlist, cur, clist->starts[ t ], len, i + 1 );
+      }
+    }
+    if ( !found )
+      addThread( search, nlist, start, i + 1, len, i + 1 );
+
+    EntryList tmp = search->clist;
+    search->clist = search->nlist;
+    search->nlist = tmp;
+  }
+
+  return found;
+}
+
@@ -0,0 +1,208 @@
+#ifndef AUTOMATON_H
+#define AUTOMATON_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "program.h"
+#include "context.h"
+#include "arena.h"
+
+/** Operations an automaton instruction can perform. */
+typedef enum {
+  BYTES_OP,  ///< Consume one byte that's in the instruction's byte set.
+  SPLIT_OP,  ///< Continue at both arg and alt.
+  JUMP_OP,   ///< Continue at arg.
+  BOL_OP,    ///< Continue only at the start of a line.
+  EOL_OP,    ///< Continue only at the end of a line.
+  COUNT_START_OP, ///< Set counter arg to zero and continue.
+  COUNT_TEST_OP,  ///< Start another repetition if counter arg is below
+                  ///< max, and leave the loop at alt if it's at least min.
+  COUNT_NEXT_OP,  ///< Add one to counter arg, up to max, and continue at alt.
+  MATCH_OP   ///< The pattern, or the one tagged arg, has matched.
+} OpCode;
+
+/** One instruction in an automaton. */
+typedef struct {
+  /** What this instruction does. */
+  OpCode op;
+
+  /** Byte set for BYTES_OP, the (first) target for SPLIT_OP and
+      JUMP_OP, the counter for the COUNT ops or the tag for MATCH_OP. */
+  int arg;
+
+  /** Second target for SPLIT_OP, where COUNT_TEST_OP leaves the loop
+      or where COUNT_NEXT_OP goes back to. */
+  int alt;
+
+  /** Fewest repetitions for COUNT_TEST_OP. */
+  int min;
+
+  /** Most repetitions for COUNT_TEST_OP, or -1 for no limit; the
+      highest value the counter needs to reach for COUNT_NEXT_OP. */
+  int max;
+} Instruction;
+
+/** A short name to use for the automaton. */
+typedef struct AutomatonStruct Automaton;
+
+/**
+  Nondeterministic automaton compiled from a program, in the style of
+  Thompson's construction.  Counted repetitions with a small limit are
+  copied out; the rest have a counter instead, and a thread of the
+  automaton is an instruction along with the values of all the
+  counters.
+  Matching builds DFA states from it lazily, and those are kept in the
+  caller's MatchContext, so an automaton never changes once it's
+  compiled and threads can share it.
+*/
+struct AutomatonStruct {
+  /** Instructions, starting at index zero. */
+  Instruction *code;
+
+  /** Number of instructions. */
+  int count;
+
+  /** Capacity of code, while it's being compiled. */
+  int cap;
+
+  /** Number of counters used by counted repetitions.  There's one
+      for each level they're nested to, shared by all the loops at that
+      level, and a counter is zero outside its loop. */
+  int counters;
+
+  /** Number of different tags on MATCH_OP instructions, one more than
+      the largest TAG_STEP in the program, or just one without any. */
+  int tags;
+
+  /** Byte sets used by BYTES_OP instructions, 256 flags each. */
+  bool (*sets)[ 256 ];
+
+  /** Number of byte sets. */
+  int setCount;
+
+  /** Capacity of sets, while it's being compiled. */
+  int setCap;
+
+  /** Index of the set holding just each byte, or -1 if there isn't
+      one yet, while it's being compiled.  When folding case, a
+      letter's set holds both cases of it. */
+  int single[ 256 ];
+
+  /** Equivalence class of every byte value.  Bytes in the same class
+      are in exactly the same byte sets, so the DFA only needs one
+      transition for each class.  The newline is always in a class by
+      itself. */
+  unsigned char classOf[ 256 ];
+
+  /** Number of byte classes. */
+  int classCount;
+
+  /** A representative byte for each class. */
+  unsigned char rep[ 256 ];
+
+  /** A literal every match has to contain, or NULL if there isn't a
+      useful one.  Lines without it are skipped without running the
+      DFA over them. */
+  char const *literal;
+
+  /** Number of bytes in literal. */
+  int literalLen;
+
+  /** True if the whole pattern is just the literal, so any line that
+      has it matches. */
+  bool literalOnly;
+
+  /** True if letters match in either case, as in the program it was
+      compiled from.  The literal is in lower case then, and it's
+      searched for with findSubstringFold(). */
+  bool fold;
+};
+
+/**
+  Compile an automaton that matches the same strings as a program.
+
+  @param prog program to compile.
+  @param arena arena to allocate the automaton from; it's freed along
+               with the arena, and prog has to last at least as long.
+  @return the new automaton.
+*/
+Automaton *compileAutomaton( Program const *prog, Arena *arena );
+
+/**
+  Find the next line in a region of whole lines that has a match for
+  the automaton anywhere in it.
+
+  @param a automaton to match.
+  @param ctx context for the calling thread, where DFA states are kept.
+  @param data region of whole lines.
+  @param len number of bytes in data.
+  @param pos index of the start of the line to start searching at.
+  @return index of the start of the first matching line at or after
+          pos, or len if none of them match.
+*/
+size_t findMatchingLine( Automaton const *a, MatchContext *ctx,
+                         char const *data, size_t len, size_t pos );
+
+/**
+  Count the lines in a region of whole lines that have a match for the
+  automaton.
+
+  @param a automaton to match.
+  @param ctx context for the calling thread, where DFA states are kept.
+  @param data region of whole lines.
+  @param len number of bytes in data.
+  @return number of matching lines.
+*/
+size_t countMatchingLines( Automaton const *a, MatchContext *ctx,
+                           char const *data, size_t len );
+
+/**
+  Find the leftmost, longest non-empty match on a line, starting the
+  search at a given position.  This runs all the automaton's threads
+  side by side, so it takes time proportional to the length of the
+  line times the size of the automaton.
+
+  @param a automaton to match.
+  @param ctx context for the calling thread.
+  @param str the line, without its newline.
+  @param len number of bytes in str.
+  @param from where to start looking for a match.
+  @param begin set to the index of the start of the match.
+  @param end set to the index one past the end of the match.
+  @return true if there was a match.
+*/
+bool nextSpan( Automaton const *a, MatchContext *ctx, char const *str,
+               size_t len, size_t from, size_t *begin, size_t *end );
+
+/**
+  Find the tags of every MATCH_OP that can be reached somewhere on a
+  line, which tells which of the patterns joined by TAG_STEPs match
+  it.  This runs the same DFA as findMatchingLine(), but over the
+  whole line, so it sees every match instead of stopping at the first.
+
+  @param a automaton to match.
+  @param ctx context for the calling thread, where DFA states are kept.
+  @param str the line, without its newline.
+  @param len number of bytes in str.
+  @param count set to the number of tags found.
+  @return the tags found, in increasing order, in an array kept in ctx
+          that's reused by the next call.
+*/
+int const *matchingTags( Automaton const *a, MatchContext *ctx,
+                         char const *str, size_t len, int *count );
+
+/**
+  Free the room for finding match spans kept in a context.
+
+  @param search room to free.
+*/
+void freeSpanSearch( SpanSearch *search );
+
+/**
+  Free the DFA states cached in a context.
+
+  @param cache cache to free.
+*/
+void freeDfaCache( DfaCache *cache );
+
+#endif
@@ -0,0 +1,463 @@
+/**
+ * @file benchmark.c
+ * @author sdcroche
+ *
+ * Benchmark measures how fast each matching engine runs over synthetic
+ * input.  Every corpus comes from a generator with a fixed seed, so
+ * the same parameters always give the same bytes, and results can be
+ * compared from one build to the next.  The sweep covers the length of
+ * the lines, how many of them have a match and what bytes they're made
+ * of, for several families of patterns, and the results are written
+ * as CSV.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "arena.h"
+#include "pattern.h"
+#include "program.h"
+#include "context.h"
+#include "automaton.h"
+#include "parse.h"
+#include "simplify.h"
+#include "scan.h"
+
+/** Size of each corpus in the sweep, in megabytes, unless it's given
+    on the command line. */
+#define DEFAULT_MEGABYTES 1
+
+/** Longest line the match tables are run on.  That's the longest line
+    regular accepts, and the tables are cubic in the length. */
+#define TABLE_LINE_LIMIT 100
+
+/** Most lines of a corpus the match tables are run on, so a slow
+    pattern doesn't hold up the rest of the sweep. */
+#define TABLE_LINES 1000
+
+/** Number of words in the fan-out pattern. */
+#define FANOUT_WORDS 64
+
+/** Length of each word in the fan-out pattern. */
+#define FANOUT_LEN 6
+
+/** Seed for every random choice, mixed with the corpus parameters. */
+#define SEED 0x9e3779b97f4a7c15ULL
+
+/** Line lengths in the sweep, from 10 bytes to a megabyte. */
+static int const lineLengths[] = { 10, 100, 1000, 10000, 100000, 1000000 };
+
+/** Percentages of lines with a match planted in them. */
+static int const matchPercents[] = { 0, 1, 50 };
+
+/** What bytes the lines are made of. */
+typedef enum {
+  TEXT_BYTES,    ///< Lower-case letters and spaces, common letters more often.
+  DNA_BYTES,     ///< Just a, c, g and t.
+  BINARY_BYTES   ///< Any byte but the newline.
+} ByteMix;
+
+/** Names of the byte mixes, for the command line and the CSV. */
+static char const *const mixNames[] = { "text", "dna", "binary" };
+
+/** Letters for TEXT_BYTES, with the common ones repeated. */
+static char const textBytes[] =
+  "     eeeeeettttaaaaoooiiinnnsssshhhrrrddlllcuumwwffggyyppbvkjxqz";
+
+/** Where a pattern's match goes in a line that gets one. */
+typedef enum { ANYWHERE, AT_START, AT_END } Placement;
+
+/** A family of patterns to measure. */
+typedef struct {
+  /** Name for the CSV. */
+  char const *name;
+
+  /** The pattern. */
+  char const *pattern;
+
+  /** A string the pattern matches, planted in lines that get a match. */
+  char const *needle;
+
+  /** Where the needle goes in the line. */
+  Placement where;
+} Family;
+
+/** Room for the fan-out pattern, which is made when the program starts. */
+static char fanout[ FANOUT_WORDS * ( FANOUT_LEN + 1 ) ];
+
+/** The patterns in the sweep.  The fan-out pattern and needle are
+    filled in by makeFanout(). */
+static Family families[] = {
+  { "literal", "zqxjv", "zqxjv", ANYWHERE },
+  { "class", "[0-9][0-9]-[0-9][0-9][0-9]", "12-345", ANYWHERE },
+  { "fanout", fanout, NULL, ANYWHERE },
+  { "nested", "q(a(bc)*d)+z", "qabcbcdadz", ANYWHERE },
+  { "start", "^qstart", "qstart", AT_START },
+  { "end", "qend$", "qend", AT_END }
+};
+
+/** Number of families. */
+#define FAMILY_COUNT ( (int) ( sizeof( families ) / sizeof( families[ 0 ] ) ) )
+
+/**
+  Return the next number from a xorshift generator.  It's the same on
+  every platform, unlike rand(), so a corpus is too.
+
+  @param state state of the generator, advanced.
+  @return the next number.
+*/
+static uint64_t nextRandom( uint64_t *state )
+{
+  uint64_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  *state = x;
+  return x * 0x2545f4914f6cdd1dULL;
+}
+
+/**
+  Make the fan-out pattern, an alternation of random words, and use one
+  of them as its needle.
+*/
+static void makeFanout( void )
+{
+  uint64_t state = SEED;
+  char *p = fanout;
+  for ( int w = 0; w < FANOUT_WORDS; w++ ) {
+    if ( w )
+      *p++ = '|';
+    for ( int k = 0; k < FANOUT_LEN; k++ )
+      *p++ = 'a' + nextRandom( &state ) % 26;
+  }
+  *p = '\0';
+
+  // Any word will do; pick one from the middle.
+  static char needle[ FANOUT_LEN + 1 ];
+  memcpy( needle, fanout + ( FANOUT_WORDS / 2 ) * ( FANOUT_LEN + 1 ),
+          FANOUT_LEN );
+  for ( int f = 0; f < FAMILY_COUNT; f++ )
+    if ( families[ f ].pattern == fanout )
+      families[ f ].needle = needle;
+}
+
+/**
+  Generate a corpus of lines.  The same parameters always give the same
+  bytes.
+
+  @param lineLen length of each line, not counting its newline.
+  @param percent percentage of lines with the family's needle planted.
+  @param mix what bytes the rest of each line is made of.
+  @param fam family whose needle is planted.
+  @param total about how many bytes to generate; there's always at
+               least one line.
+  @param len set to the number of bytes generated.
+  @return the corpus, which the caller frees.
+*/
+static char *makeCorpus( int lineLen, int percent, ByteMix mix,
+                         Family const *fam, size_t total, size_t *len )
+{
+  size_t lines = total / ( lineLen + 1 );
+  if ( lines == 0 )
+    lines = 1;
+  *len = lines * ( lineLen + 1 );
+  char *data = (char *) malloc( *len );
+
+  uint64_t state = SEED ^ ( (uint64_t) lineLen << 32 ) ^
+    ( (uint64_t) percent << 16 ) ^ ( (uint64_t) mix << 8 ) ^
+    (uint64_t) ( fam - families );
+  int needleLen = strlen( fam->needle );
+  char *line = data;
+  for ( size_t i = 0; i < lines; i++ ) {
+    for ( int k = 0; k < lineLen; k++ ) {
+      uint64_t r = nextRandom( &state );
+      if ( mix == TEXT_BYTES )
+        line[ k ] = textBytes[ r % ( sizeof( textBytes ) - 1 ) ];
+      else if ( mix == DNA_BYTES )
+        line[ k ] = "acgt"[ r % 4 ];
+      else {
+        // Anything but the newline, which ends a line.
+        line[ k ] = r % 255;
+        if ( line[ k ] == '\n' )
+          line[ k ] = (char) 255;
+      }
+    }
+
+    if ( needleLen <= lineLen &&
+         (int) ( nextRandom( &state ) % 100 ) < percent ) {
+      int at = 0;
+      if ( fam->where == AT_END )
+        at = lineLen - needleLen;
+      else if ( fam->where == ANYWHERE )
+        at = nextRandom( &state ) % ( lineLen - needleLen + 1 );
+      memcpy( line + at, fam->needle, needleLen );
+    }
+
+    line[ lineLen ] = '\n';
+    line += lineLen + 1;
+  }
+
+  return data;
+}
+
+/**
+  Return the current time, in seconds.
+
+  @return seconds since some fixed point.
+*/
+static double now( void )
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+  Find every match span on every line of a corpus with the automaton,
+  the way -o does, but without skipping lines that don't match.
+
+  @param nfa automaton to run.
+  @param ctx context to run it with.
+  @param data the corpus.
+  @param len number of bytes in data.
+  @return number of lines with a span.
+*/
+static long runSpans( Automaton const *nfa, MatchContext *ctx,
+                      char const *data, size_t len )
+{
+  long count = 0;
+  for ( size_t pos = 0; pos < len; ) {
+    char const *nl = findByte( data + pos, len - pos, '\n' );
+    size_t end = nl ? (size_t) ( nl - data ) : len;
+
+    size_t from = 0, begin, stop;
+    bool found = false;
+    while ( nextSpan( nfa, ctx, data + pos, end - pos, from, &begin,
+                      &stop ) ) {
+      found = true;
+      from = stop;
+    }
+    if ( found )
+      count++;
+    pos = end + 1;
+  }
+  return count;
+}
+
+/**
+  Fill in match tables for lines of a corpus, and look through each
+  one for a match, the way highlighting does.  Only the first lines
+  are done, since the tables are slow.
+
+  @param prog program to run.
+  @param ctx context to run it with.
+  @param data the corpus.
+  @param len number of bytes in data, reduced to the bytes done.
+  @param lines set to the number of lines done.
+  @return number of lines with a match.
+*/
+static long runTables( Program const *prog, MatchContext *ctx,
+                       char const *data, size_t *len, long *lines )
+{
+  long count = 0;
+  size_t pos = 0;
+  *lines = 0;
+  while ( pos < *len && *lines < TABLE_LINES ) {
+    char const *nl = findByte( data + pos, *len - pos, '\n' );
+    size_t end = nl ? (size_t) ( nl - data ) : *len;
+    int n = end - pos;
+
+    locateMatches( prog, ctx, data + pos, n, 0 );
+    bool found = false;
+    for ( int begin = 0; begin < n && !found; begin++ )
+      for ( int stop = begin + 1; stop <= n && !found; stop++ )
+        found = matches( ctx, begin, stop );
+    if ( found )
+      count++;
+
+    ( *lines )++;
+    pos = end + 1;
+  }
+  *len = pos < *len ? pos : *len;
+  return count;
+}
+
+/**
+  Write one row of results.
+
+  @param engine name of the engine.
+  @param fam family of the pattern.
+  @param lineLen length of each line.
+  @param percent percentage of lines with a match planted.
+  @param mix what bytes the lines are made of.
+  @param lines number of lines matched.
+  @param bytes number of bytes matched, with newlines.
+  @param matches number of lines that matched.
+  @param seconds time it took.
+*/
+static void report( char const *engine, Family const *fam, int lineLen,
+                    int percent, ByteMix mix, long lines, size_t bytes,
+                    long matches, double seconds )
+{
+  // Don't divide by zero if the clock didn't move.
+  if ( seconds < 1e-9 )
+    seconds = 1e-9;
+  printf( "%s,%s,%d,%d,%s,%ld,%zu,%ld,%.6f,%.2f,%.0f,%.1f\n", engine,
+          fam->name, lineLen, percent, mixNames[ mix ], lines, bytes,
+          matches, seconds, bytes / seconds / 1e6, lines / seconds,
+          seconds * 1e9 / lines );
+  fflush( stdout );
+}
+
+/**
+  Run every engine on one corpus and report the results.
+
+  @param fam family of the pattern.
+  @param lineLen length of each line.
+  @param percent percentage of lines with a match planted.
+  @param mix what bytes the lines are made of.
+  @param total about how many bytes the corpus should have.
+*/
+static void measure( Family const *fam, int lineLen, int percent,
+                     ByteMix mix, size_t total )
+{
+  Arena *arena = makeArena();
+  Pattern *pat = simplifyPattern( parsePattern( fam->pattern, false, arena ),
+                                  arena );
+  Program *prog = compileProgram( pat, false, arena );
+  Automaton *nfa = compileAutomaton( prog, arena );
+
+  size_t len;
+  char *data = makeCorpus( lineLen, percent, mix, fam, total, &len );
+  long lines = len / ( lineLen + 1 );
+
+  // A fresh context for each engine, so none of them starts out with
+  // DFA states another one built.
+  // The automaton picks out the matching lines, with the literal
+  // search in front of it when the pattern has a literal.
+  MatchContext *ctx = makeMatchContext();
+  double start = now();
+  long count = countMatchingLines( nfa, ctx, data, len );
+  report( "automaton", fam, lineLen, percent, mix, lines, len, count,
+          now() - start );
+  freeMatchContext( ctx );
+
+  ctx = makeMatchContext();
+  start = now();
+  count = runSpans( nfa, ctx, data, len );
+  report( "spans", fam, lineLen, percent, mix, lines, len, count,
+          now() - start );
+  freeMatchContext( ctx );
+
+  if ( lineLen <= TABLE_LINE_LIMIT ) {
+    ctx = makeMatchContext();
+    size_t done = len;
+    long doneLines;
+    start = now();
+    count = runTables( prog, ctx, data, &done, &doneLines );
+    report( "tables", fam, lineLen, percent, mix, doneLines, done, count,
+            now() - start );
+    freeMatchContext( ctx );
+  }
+
+  free( data );
+  freeArena( arena );
+}
+
+/**
+  Look up a name in a list.
+
+  @param name name to find.
+  @param names list of names.
+  @param count number of names in the list.
+  @return index of the name, or -1 if it isn't there.
+*/
+static int lookup( char const *name, char const *const *names, int count )
+{
+  for ( int i = 0; i < count; i++ )
+    if ( strcmp( name, names[ i ] ) == 0 )
+      return i;
+  return -1;
+}
+
+/**
+   Print a usage message and exit unsuccessfully.
+*/
+static void usage( void )
+{
+  fprintf( stderr, "usage: benchmark [megabytes]\n" );
+  fprintf( stderr, "       benchmark --corpus <line-bytes> <match-percent> "
+           "<text|dna|binary> <family> [megabytes]\n" );
+  exit( EXIT_FAILURE );
+}
+
+/**
+  Parse a positive number from the command line, or exit with a usage
+  message if it isn't one.
+
+  @param str the argument.
+  @return its value.
+*/
+static long parseNumber( char const *str )
+{
+  char *rest;
+  long n = strtol( str, &rest, 10 );
+  if ( !*str || *rest || n < 0 )
+    usage();
+  return n;
+}
+
+/**
+  Entry point for the benchmark.  With no options, it runs the whole
+  sweep and writes a CSV row for each engine on each corpus.  With
+  --corpus, it writes just the one corpus to standard output instead,
+  so it can be fed to regular.
+
+  @param argc Number of command-line arguments.
+  @param argv List of command-line arguments.
+  @return exit status for the program.
+*/
+int main( int argc, char *argv[] )
+{
+  makeFanout();
+
+  if ( argc >= 2 && strcmp( argv[ 1 ], "--corpus" ) == 0 ) {
+    if ( argc < 6 || argc > 7 )
+      usage();
+    int lineLen = parseNumber( argv[ 2 ] );
+    int percent = parseNumber( argv[ 3 ] );
+    int mix = lookup( argv[ 4 ], mixNames, 3 );
+    int f = 0;
+    while ( f < FAMILY_COUNT && strcmp( families[ f ].name, argv[ 5 ] ) != 0 )
+      f++;
+    long mb = argc == 7 ? parseNumber( argv[ 6 ] ) : DEFAULT_MEGABYTES;
+    if ( lineLen < 1 || percent > 100 || mix < 0 || f == FAMILY_COUNT )
+      usage();
+
+    size_t len;
+    char *data = makeCorpus( lineLen, percent, (ByteMix) mix, families + f,
+                             mb * 1000000, &len );
+    fwrite( data, 1, len, stdout );
+    free( data );
+    return EXIT_SUCCESS;
+  }
+
+  if ( argc > 2 )
+    usage();
+  long mb = argc == 2 ? parseNumber( argv[ 1 ] ) : DEFAULT_MEGABYTES;
+
+  printf( "engine,pattern,line_bytes,match_percent,bytes_mix,lines,bytes,"
+          "matches,seconds,mb_per_s,lines_per_s,ns_per_line\n" );
+  for ( int f = 0; f < FAMILY_COUNT; f++ )
+    for ( int l = 0; l < (int) ( sizeof( lineLengths ) / sizeof( int ) ); l++ )
+      for ( int p = 0; p < (int) ( sizeof( matchPercents ) / sizeof( int ) );
+            p++ )
+        for ( int m = 0; m < 3; m++ )
+          measure( families + f, lineLengths[ l ], matchPercents[ p ],
+                   (ByteMix) m, mb * 1000000 );
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,392 @@
+/**
+ * @file compiled.c
+ * @author sdcroche
+ *
+ * Compiled saves a program and its automaton to a file and loads them
+ * back.  The file is a header followed by the raw arrays, each one
+ * aligned and found by its offset from the start of the file, so
+ * loading is just mapping the file and pointing at them.  The DFA
+ * states aren't saved; they depend on the input and are built as
+ * they're needed, the same as for a freshly compiled pattern.
+ */
+#include "compiled.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Identifies a compiled-pattern file. */
+#define MAGIC "regular\n"
+
+/** Written in the host's byte order, so a file from a machine with
+    the other one is rejected. */
+#define BYTE_ORDER_MARK 0x01020304
+
+/** Largest count the parser allows in a counted repetition, so a
+    damaged file can't ask for more work than a real pattern could. */
+#define MAX_COUNT 1000
+
+/** Alignment for each array in the file, enough for any of them. */
+#define ALIGN 16
+
+/** Start of a compiled-pattern file. */
+typedef struct {
+  /** MAGIC, without its null terminator. */
+  char magic[ 8 ];
+
+  /** COMPILED_VERSION. */
+  uint32_t version;
+
+  /** BYTE_ORDER_MARK. */
+  uint32_t byteOrder;
+
+  /** Size of a Step and of an Instruction, which have to match ours. */
+  uint32_t stepSize, instructionSize;
+
+  /** Fields of the program. */
+  int32_t stepCount, setCount, textLen, depth;
+
+  /** Fields of the automaton. */
+  int32_t codeCount, counters, nfaSetCount, classCount;
+
+  /** Offset of the automaton's literal in the program's text, or -1
+      if there isn't one, along with its length. */
+  int32_t literal, literalLen;
+
+  /** True if the whole pattern is the literal. */
+  int32_t literalOnly;
+
+  /** Number of patterns compiled into the automaton. */
+  int32_t tags;
+
+  /** True if letters match in either case. */
+  int32_t fold;
+
+  /** Offsets of the program's steps, byte sets and text. */
+  uint64_t steps, sets, text;
+
+  /** Offsets of the automaton's instructions and byte sets. */
+  uint64_t code, nfaSets;
+
+  /** Byte classes of the automaton. */
+  unsigned char classOf[ 256 ];
+
+  /** A representative byte for each class. */
+  unsigned char rep[ 256 ];
+} Header;
+
+/**
+  Round a file offset up to the alignment for an array.
+
+  @param off offset to round.
+  @return the aligned offset.
+*/
+static uint64_t align( uint64_t off )
+{
+  return ( off + ALIGN - 1 ) & ~(uint64_t) ( ALIGN - 1 );
+}
+
+/**
+  Write an array to a file at an aligned offset, padding up to it.
+
+  @param f file to write to.
+  @param pos pointer to how many bytes have been written so far.
+  @param data array to write.
+  @param len number of bytes in data.
+  @return false if the write failed.
+*/
+static bool writeArray( FILE *f, uint64_t *pos, void const *data, size_t len )
+{
+  static char const zeros[ ALIGN ];
+  size_t pad = align( *pos ) - *pos;
+  if ( fwrite( zeros, 1, pad, f ) != pad || fwrite( data, 1, len, f ) != len )
+    return false;
+  *pos += pad + len;
+  return true;
+}
+
+// Documented in the header.
+bool saveCompiled( char const *path, Program const *prog,
+                   Automaton const *nfa )
+{
+  Header h;
+  memset( &h, 0, sizeof( h ) );
+  memcpy( h.magic, MAGIC, sizeof( h.magic ) );
+  h.version = COMPILED_VERSION;
+  h.byteOrder = BYTE_ORDER_MARK;
+  h.stepSize = sizeof( Step );
+  h.instructionSize = sizeof( Instruction );
+
+  h.stepCount = prog->count;
+  h.setCount = prog->setCount;
+  h.textLen = prog->textLen;
+  h.depth = prog->depth;
+  h.fold = prog->fold;
+
+  h.codeCount = nfa->count;
+  h.counters = nfa->counters;
+  h.nfaSetCount = nfa->setCount;
+  h.classCount = nfa->classCount;
+  h.literal = nfa->literal ? nfa->literal - prog->text : -1;
+  h.literalLen = nfa->literalLen;
+  h.literalOnly = nfa->literalOnly;
+  h.tags = nfa->tags;
+  memcpy( h.classOf, nfa->classOf, sizeof( h.classOf ) );
+  memcpy( h.rep, nfa->rep, sizeof( h.rep ) );
+
+  // Lay out the arrays after the header, in the order they're written.
+  size_t stepBytes = prog->count * sizeof( Step );
+  size_t setBytes = prog->setCount * sizeof( ByteSet );
+  size_t codeBytes = nfa->count * sizeof( Instruction );
+  size_t nfaSetBytes = nfa->setCount * sizeof( *nfa->sets );
+  h.steps = align( sizeof( h ) );
+  h.sets = align( h.steps + stepBytes );
+  h.text = align( h.sets + setBytes );
+  h.code = align( h.text + prog->textLen );
+  h.nfaSets = align( h.code + codeBytes );
+
+  FILE *f = fopen( path, "wb" );
+  if ( !f )
+    return false;
+
+  uint64_t pos = 0;
+  bool ok = writeArray( f, &pos, &h, sizeof( h ) ) &&
+    writeArray( f, &pos, prog->steps, stepBytes ) &&
+    writeArray( f, &pos, prog->sets, setBytes ) &&
+    writeArray( f, &pos, prog->text, prog->textLen ) &&
+    writeArray( f, &pos, nfa->code, codeBytes ) &&
+    writeArray( f, &pos, nfa->sets, nfaSetBytes );
+
+  if ( fclose( f ) != 0 )
+    ok = false;
+  return ok;
+}
+
+/**
+  Report whether an array of n elements of the given size at an offset
+  fits in a file and is aligned.
+
+  @param off offset of the array.
+  @param n number of elements.
+  @param size size of each element.
+  @param len size of the file.
+  @return true if the array is in bounds.
+*/
+static bool inFile( uint64_t off, int32_t n, size_t size, size_t len )
+{
+  return n >= 0 && off % ALIGN == 0 && off <= len &&
+    (uint64_t) n * size <= len - off;
+}
+
+/**
+  Check that a loaded program is safe to run: every step's operands
+  are in bounds, and the steps use the stack the way the interpreter
+  expects, never holding more than depth tables.  The engines find
+  each operand through the first field, so it's worked out again with
+  a stack of where each operand starts, and has to agree exactly.
+
+  @param prog program to check.
+  @return true if it's valid.
+*/
+static bool validProgram( Program const *prog )
+{
+  if ( prog->depth < 1 || prog->depth > prog->count )
+    return false;
+
+  // Where each operand on the stack starts, with room for one more
+  // than depth, since a leaf is pushed before the depth is checked.
+  int *firsts = (int *) malloc( ( prog->depth + 1 ) * sizeof( int ) );
+  if ( !firsts )
+    return false;
+
+  bool ok = true;
+  int height = 0;
+  for ( int i = 0; ok && i < prog->count; i++ ) {
+    Step const *s = prog->steps + i;
+    bool leaf = false;
+
+    switch ( s->op ) {
+    case BYTE_STEP:
+      ok = s->arg >= 0 && s->arg < prog->setCount;
+      leaf = true;
+      break;
+    case LITERAL_STEP:
+      ok = s->arg >= 0 && s->len >= 0 && s->len <= prog->textLen - s->arg;
+      leaf = true;
+      break;
+    case TAG_STEP:
+      ok = s->arg >= 0;
+      leaf = true;
+      break;
+    case START_STEP:
+    case END_STEP:
+      leaf = true;
+      break;
+    case CONCAT_STEP:
+    case ALTERNATE_STEP:
+      // The operands are joined into one that starts with the first.
+      ok = height >= 2 && s->first == firsts[ height - 2 ];
+      height--;
+      break;
+    case COUNT_STEP:
+      ok = s->min >= 0 && s->min <= MAX_COUNT && s->max >= -1 &&
+        s->max <= MAX_COUNT && ( s->max < 0 || s->max >= s->min );
+      // Fall through, since it's a repetition like the others.
+    case OPTIONAL_STEP:
+    case STAR_STEP:
+    case PLUS_STEP:
+      ok = ok && height >= 1 && s->first == firsts[ height - 1 ];
+      break;
+    default:
+      ok = false;
+    }
+
+    // A leaf is an operand of its own.
+    if ( ok && leaf ) {
+      ok = s->first == i;
+      firsts[ height++ ] = i;
+    }
+
+    if ( height > prog->depth )
+      ok = false;
+  }
+
+  free( firsts );
+  return ok && height == 1;
+}
+
+/**
+  Check that a loaded automaton is safe to run: every instruction's
+  targets, byte sets, counters and tags are in bounds, every byte set holds
+  proper bools, and it ends by matching.
+
+  @param a automaton to check.
+  @return true if it's valid.
+*/
+static bool validAutomaton( Automaton const *a )
+{
+  if ( a->count < 1 || a->code[ a->count - 1 ].op != MATCH_OP ||
+       a->counters < 0 || a->counters > a->count ||
+       a->tags < 1 || a->tags > a->count ||
+       a->classCount < 1 || a->classCount > 256 )
+    return false;
+
+  for ( int i = 0; i < a->count; i++ ) {
+    Instruction const *ins = a->code + i;
+    bool target = ins->arg >= 0 && ins->arg < a->count;
+    bool alt = ins->alt >= 0 && ins->alt < a->count;
+    bool counter = ins->arg >= 0 && ins->arg < a->counters;
+    switch ( ins->op ) {
+    case BYTES_OP:
+      if ( ins->arg < 0 || ins->arg >= a->setCount )
+        return false;
+      break;
+    case SPLIT_OP:
+      if ( !target || !alt )
+        return false;
+      break;
+    case JUMP_OP:
+      if ( !target )
+        return false;
+      break;
+    case COUNT_START_OP:
+      if ( !counter )
+        return false;
+      break;
+    case COUNT_TEST_OP:
+    case COUNT_NEXT_OP:
+      if ( !counter || !alt || ins->min < 0 || ins->min > MAX_COUNT ||
+           ins->max < -1 || ins->max > MAX_COUNT )
+        return false;
+      break;
+    case MATCH_OP:
+      if ( ins->arg < 0 || ins->arg >= a->tags )
+        return false;
+      break;
+    case BOL_OP:
+    case EOL_OP:
+      break;
+    default:
+      return false;
+    }
+  }
+
+  // The sets are read as bools, so each flag has to be 0 or 1.
+  unsigned char const *flags = (unsigned char const *) a->sets;
+  for ( size_t i = 0; i < a->setCount * sizeof( *a->sets ); i++ )
+    if ( flags[ i ] > 1 )
+      return false;
+
+  for ( int b = 0; b < 256; b++ )
+    if ( a->classOf[ b ] >= a->classCount )
+      return false;
+  return true;
+}
+
+// Documented in the header.
+Compiled *loadCompiled( char const *path, Arena *arena )
+{
+  Compiled *c = (Compiled *) allocArena( arena, sizeof( Compiled ) );
+  if ( !loadFile( path, &c->file ) )
+    return NULL;
+
+  char *data = c->file.data;
+  size_t len = c->file.len;
+  Header const *h = (Header const *) data;
+  if ( len < sizeof( Header ) ||
+       memcmp( h->magic, MAGIC, sizeof( h->magic ) ) != 0 ||
+       h->version != COMPILED_VERSION || h->byteOrder != BYTE_ORDER_MARK ||
+       h->stepSize != sizeof( Step ) ||
+       h->instructionSize != sizeof( Instruction ) ||
+       !inFile( h->steps, h->stepCount, sizeof( Step ), len ) ||
+       !inFile( h->sets, h->setCount, sizeof( ByteSet ), len ) ||
+       !inFile( h->text, h->textLen, 1, len ) ||
+       !inFile( h->code, h->codeCount, sizeof( Instruction ), len ) ||
+       !inFile( h->nfaSets, h->nfaSetCount, 256 * sizeof( bool ), len ) ||
+       h->literalLen < 0 || h->literal < -1 || h->fold < 0 || h->fold > 1 ||
+       ( h->literal >= 0 && h->literalLen > h->textLen - h->literal ) ) {
+    unloadFile( &c->file );
+    return NULL;
+  }
+
+  Program *prog = (Program *) allocArena( arena, sizeof( Program ) );
+  prog->steps = (Step *) ( data + h->steps );
+  prog->count = h->stepCount;
+  prog->sets = (ByteSet *) ( data + h->sets );
+  prog->setCount = h->setCount;
+  prog->text = data + h->text;
+  prog->textLen = h->textLen;
+  prog->depth = h->depth;
+  prog->fold = h->fold;
+
+  Automaton *a = (Automaton *) allocArena( arena, sizeof( Automaton ) );
+  a->code = (Instruction *) ( data + h->code );
+  a->count = a->cap = h->codeCount;
+  a->counters = h->counters;
+  a->tags = h->tags;
+  a->sets = (bool (*)[ 256 ]) ( data + h->nfaSets );
+  a->setCount = a->setCap = h->nfaSetCount;
+  memset( a->single, -1, sizeof( a->single ) );
+  memcpy( a->classOf, h->classOf, sizeof( a->classOf ) );
+  a->classCount = h->classCount;
+  memcpy( a->rep, h->rep, sizeof( a->rep ) );
+  a->literal = h->literal >= 0 ? prog->text + h->literal : NULL;
+  a->literalLen = a->literal ? h->literalLen : 0;
+  a->literalOnly = a->literal && h->literalOnly;
+  a->fold = h->fold;
+
+  if ( !validProgram( prog ) || !validAutomaton( a ) ) {
+    unloadFile( &c->file );
+    return NULL;
+  }
+
+  c->prog = prog;
+  c->nfa = a;
+  return c;
+}
+
+// Documented in the header.
+void unloadCompiled( Compiled *c )
+{
+  unloadFile( &c->file );
+}
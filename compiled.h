@@ -0,0 +1,63 @@
+#ifndef COMPILED_H
+#define COMPILED_H
+
+#include <stdbool.h>
+#include "program.h"
+#include "automaton.h"
+#include "files.h"
+#include "arena.h"
+
+/** Version of the compiled-pattern file format.  It changes whenever
+    the layout of anything in the file does, and files with any other
+    version are rejected. */
+#define COMPILED_VERSION 3
+
+/**
+  A program and automaton loaded from a compiled-pattern file.  Their
+  arrays point right into the file's contents, which are mapped into
+  memory, so nothing has to be parsed or copied to use them.
+*/
+typedef struct {
+  /** Program for finding where the matches are on a line. */
+  Program *prog;
+
+  /** Automaton for finding the lines that have a match. */
+  Automaton *nfa;
+
+  /** Contents of the file. */
+  FileData file;
+} Compiled;
+
+/**
+  Write a compiled pattern to a file.  Everything in the file is
+  stored as offsets from its start, so it can be mapped anywhere.
+
+  @param path name of the file to write.
+  @param prog program compiled from the pattern.
+  @param nfa automaton compiled from prog.
+  @return false if the file couldn't be written.
+*/
+bool saveCompiled( char const *path, Program const *prog,
+                   Automaton const *nfa );
+
+/**
+  Load a compiled pattern written by saveCompiled().  The file is
+  checked to make sure it's the current version and that everything in
+  it is in bounds, so a damaged file can't make matching crash.
+
+  @param path name of the file to read.
+  @param arena arena to allocate the program and automaton from.
+  @return the loaded pattern, or NULL if the file can't be read or
+          isn't a valid compiled pattern.
+*/
+Compiled *loadCompiled( char const *path, Arena *arena );
+
+/**
+  Release the file behind a compiled pattern.  Its program and
+  automaton can't be used after this.
+
+  @param c compiled pattern to release.
+*/
+void unloadCompiled( Compiled *c );
+
+#endif
@@ -0,0 +1,102 @@
+/**
+ * @file context.c
+ * @author sdcroche
+ *
+ * Context manages the per-thread state used while matching: a pool
+ * of match tables and the cache of DFA states.
+ */
+#include "context.h"
+#include "automaton.h"
+#include <stdlib.h>
+#include <string.h>
+
+/** Initial capacity of the pool of free tables in a match context. */
+#define INITIAL_POOL 8
+
+// Documented in the header.
+MatchContext *makeMatchContext( void )
+{
+  MatchContext *ctx = (MatchContext *) checkedMalloc( sizeof( MatchContext ) );
+  ctx->len = 0;
+  ctx->result = NULL;
+  ctx->poolCount = 0;
+  ctx->poolCap = INITIAL_POOL;
+  ctx->pool = (bool **) checkedMalloc( ctx->poolCap * sizeof( bool * ) );
+  ctx->tableCap = 0;
+  ctx->work = 0;
+  ctx->budget = 0;
+  ctx->borrowed = 0;
+  ctx->stats = NULL;
+  ctx->stack = NULL;
+  ctx->stackCap = 0;
+  ctx->dfa = NULL;
+  ctx->spans = NULL;
+
+  return ctx;
+}
+
+// Documented in the header.
+void freeMatchContext( MatchContext *ctx )
+{
+  if ( ctx->result )
+    free( ctx->result );
+  for ( int i = 0; i < ctx->poolCount; i++ )
+    free( ctx->pool[ i ] );
+  free( ctx->pool );
+  free( ctx->stack );
+  if ( ctx->dfa )
+    freeDfaCache( ctx->dfa );
+  if ( ctx->spans )
+    freeSpanSearch( ctx->spans );
+  free( ctx );
+}
+
+// Documented in the header.
+void startTables( MatchContext *ctx, size_t len )
+{
+  // The table from the last input isn't needed anymore.
+  if ( ctx->result )
+    releaseTable( ctx, ctx->result );
+  ctx->result = NULL;
+  ctx->work = 0;
+  ctx->borrowed = 0;
+
+  // If the tables we have are too small for this input, start over
+  // with bigger ones.
+  ctx->len = len;
+  size_t cells = (size_t) ( ctx->len + 1 ) * ( ctx->len + 1 );
+  if ( cells > ctx->tableCap ) {
+    for ( int i = 0; i < ctx->poolCount; i++ )
+      free( ctx->pool[ i ] );
+    ctx->poolCount = 0;
+    ctx->tableCap = cells;
+  }
+}
+
+// Documented in the header.
+bool *acquireTable( MatchContext *ctx )
+{
+  size_t cells = (size_t) ( ctx->len + 1 ) * ( ctx->len + 1 );
+
+  bool *table;
+  if ( ctx->poolCount )
+    table = ctx->pool[ --ctx->poolCount ];
+  else
+    table = (bool *) checkedMalloc( ctx->tableCap * sizeof( bool ) );
+
+  memset( table, 0, cells * sizeof( bool ) );
+  ctx->work += cells;
+  ctx->borrowed += cells * sizeof( bool );
+  return table;
+}
+
+// Documented in the header.
+void releaseTable( MatchContext *ctx, bool *table )
+{
+  if ( ctx->poolCount >= ctx->poolCap ) {
+    ctx->poolCap *= 2;
+    ctx->pool = (bool **) checkedRealloc( ctx->pool,
+                                          ctx->poolCap * sizeof( bool * ) );
+  }
+  ctx->pool[ ctx->poolCount++ ] = table;
+}
@@ -0,0 +1,122 @@
+#ifndef CONTEXT_H
+#define CONTEXT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/** A short name to use for the match context. */
+typedef struct MatchContextStruct MatchContext;
+
+/** Lazily built DFA states for an automaton, defined in automaton.c. */
+typedef struct DfaCacheStruct DfaCache;
+
+/** Thread lists for finding match spans, defined in automaton.c. */
+typedef struct SpanSearchStruct SpanSearch;
+
+/** Counts of the work done by a program step, defined in stats.h. */
+typedef struct StepStatsStruct StepStats;
+
+/**
+  Everything that changes from one input string to the next lives in
+  a MatchContext, so a compiled program is never modified while
+  matching.  Each thread that wants to use a program needs its own
+  context, but any number of threads can share the program itself.
+
+  Match tables are (len + 1) X (len + 1) arrays of bool stored row by
+  row in a single block, so table[ begin * ( len + 1 ) + end ] is true
+  if the [ begin, end ) substring of the input is matched.  The
+  context keeps a pool of these tables that a program borrows while
+  it's working out its matches.  It also holds the DFA states an
+  automaton has built so far, since those depend on the input seen.
+*/
+struct MatchContextStruct {
+  /** Length of the current input string, as recorded by the latest call
+      to locateMatches(). */
+  int len;
+
+  /** Match table for the whole pattern from the latest call to
+      locateMatches(). */
+  bool *result;
+
+  /** Tables that aren't in use right now. */
+  bool **pool;
+
+  /** Number of tables in the pool. */
+  int poolCount;
+
+  /** Capacity of the pool array. */
+  int poolCap;
+
+  /** Number of cells each pooled table has room for. */
+  size_t tableCap;
+
+  /** Table cells cleared, filled in or checked so far for the current
+      input string. */
+  size_t work;
+
+  /** Most cells locateMatches() may work through for the current input
+      string, or zero for no limit. */
+  size_t budget;
+
+  /** Bytes of tables borrowed so far for the current input string. */
+  size_t borrowed;
+
+  /** Counts to add the work each program step does to, one for each
+      step, or NULL if nobody's counting. */
+  StepStats *stats;
+
+  /** Stack of tables for running a program. */
+  bool **stack;
+
+  /** Capacity of the stack. */
+  int stackCap;
+
+  /** DFA states built so far, or NULL if we haven't scanned anything. */
+  DfaCache *dfa;
+
+  /** Room for finding match spans, or NULL if we haven't needed any. */
+  SpanSearch *spans;
+};
+
+/**
+  Make an empty match context.
+
+  @return A dynamically allocated match context.
+*/
+MatchContext *makeMatchContext( void );
+
+/**
+  Free a match context and everything it holds.
+
+  @param ctx context to free.
+*/
+void freeMatchContext( MatchContext *ctx );
+
+/**
+  Get ready to fill in match tables for a new input string.  Any table
+  from the previous input is given back to the pool, and the work done
+  and tables borrowed for it are forgotten.
+
+  @param ctx context to prepare.
+  @param len length of the new input string.
+*/
+void startTables( MatchContext *ctx, size_t len );
+
+/**
+  Borrow a cleared match table from the context, large enough for the
+  current input string.  Clearing it counts as work on every cell.
+
+  @param ctx context we're matching with.
+  @return a table with every cell set to false.
+*/
+bool *acquireTable( MatchContext *ctx );
+
+/**
+  Give a table back to the context's pool, so it can be used again.
+
+  @param ctx context the table was borrowed from.
+  @param table table to give back.
+*/
+void releaseTable( MatchContext *ctx, bool *table );
+
+#endif
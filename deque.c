@@ -0,0 +1,154 @@
+/**
+ * @file deque.c
+ * @author sdcroche
+ *
+ * Deque is a lock-free work-stealing deque following Le, Pop, Cohen
+ * and Zappa Nardelli, "Correct and Efficient Work-Stealing for Weak
+ * Memory Models".  It uses the GCC atomic builtins, since C99 doesn't
+ * have atomics of its own.
+ */
+#include "deque.h"
+#include <stdbool.h>
+#include <stdlib.h>
+
+/** Number of items a new deque has room for. */
+#define INITIAL_SIZE 64
+
+/** Circular array of items.  Its size is always a power of two. */
+struct DequeArrayStruct {
+  /** Number of slots in items. */
+  long size;
+
+  /** Array that was replaced by this one, for freeing later. */
+  DequeArray *next;
+
+  /** The items. */
+  void **items;
+};
+
+/**
+  Make a new, empty array.
+
+  @param size number of slots in the array.
+  @return a dynamically allocated array.
+*/
+static DequeArray *makeArray( long size )
+{
+  DequeArray *a = (DequeArray *) malloc( sizeof( DequeArray ) );
+  a->size = size;
+  a->next = NULL;
+  a->items = (void **) calloc( size, sizeof( void * ) );
+  return a;
+}
+
+/**
+  Read an item from an array.
+
+  @param a array to read from.
+  @param i index of the item, which wraps around the array.
+  @return the item.
+*/
+static void *getItem( DequeArray *a, long i )
+{
+  return __atomic_load_n( &a->items[ i & ( a->size - 1 ) ], __ATOMIC_RELAXED );
+}
+
+/**
+  Store an item in an array.
+
+  @param a array to store into.
+  @param i index of the item, which wraps around the array.
+  @param item the item to store.
+*/
+static void putItem( DequeArray *a, long i, void *item )
+{
+  __atomic_store_n( &a->items[ i & ( a->size - 1 ) ], item, __ATOMIC_RELAXED );
+}
+
+// Documented in the header.
+void initDeque( Deque *dq )
+{
+  dq->top = 0;
+  dq->bottom = 0;
+  dq->array = makeArray( INITIAL_SIZE );
+  dq->retired = NULL;
+}
+
+// Documented in the header.
+void freeDeque( Deque *dq )
+{
+  dq->array->next = dq->retired;
+  while ( dq->array ) {
+    DequeArray *next = dq->array->next;
+    free( dq->array->items );
+    free( dq->array );
+    dq->array = next;
+  }
+}
+
+// Documented in the header.
+void pushDeque( Deque *dq, void *item )
+{
+  long b = __atomic_load_n( &dq->bottom, __ATOMIC_RELAXED );
+  long t = __atomic_load_n( &dq->top, __ATOMIC_ACQUIRE );
+  DequeArray *a = __atomic_load_n( &dq->array, __ATOMIC_RELAXED );
+
+  // If the array is full, copy everything into one twice as big.
+  if ( b - t > a->size - 1 ) {
+    DequeArray *bigger = makeArray( a->size * 2 );
+    for ( long i = t; i < b; i++ )
+      putItem( bigger, i, getItem( a, i ) );
+    a->next = dq->retired;
+    dq->retired = a;
+    __atomic_store_n( &dq->array, bigger, __ATOMIC_RELEASE );
+    a = bigger;
+  }
+
+  putItem( a, b, item );
+  __atomic_thread_fence( __ATOMIC_RELEASE );
+  __atomic_store_n( &dq->bottom, b + 1, __ATOMIC_RELAXED );
+}
+
+// Documented in the header.
+void *popDeque( Deque *dq )
+{
+  long b = __atomic_load_n( &dq->bottom, __ATOMIC_RELAXED ) - 1;
+  DequeArray *a = __atomic_load_n( &dq->array, __ATOMIC_RELAXED );
+  __atomic_store_n( &dq->bottom, b, __ATOMIC_RELAXED );
+  __atomic_thread_fence( __ATOMIC_SEQ_CST );
+  long t = __atomic_load_n( &dq->top, __ATOMIC_RELAXED );
+
+  void *item = NULL;
+  if ( t <= b ) {
+    item = getItem( a, b );
+    if ( t == b ) {
+      // This is the last item, so we have to race the thieves for it.
+      if ( !__atomic_compare_exchange_n( &dq->top, &t, t + 1, false,
+                                         __ATOMIC_SEQ_CST, __ATOMIC_RELAXED ) )
+        item = NULL;
+      __atomic_store_n( &dq->bottom, b + 1, __ATOMIC_RELAXED );
+    }
+  } else
+    __atomic_store_n( &dq->bottom, b + 1, __ATOMIC_RELAXED );
+
+  return item;
+}
+
+// Documented in the header.
+void *stealDeque( Deque *dq )
+{
+  long t = __atomic_load_n( &dq->top, __ATOMIC_ACQUIRE );
+  __atomic_thread_fence( __ATOMIC_SEQ_CST );
+  long b = __atomic_load_n( &dq->bottom, __ATOMIC_ACQUIRE );
+
+  if ( t >= b )
+    return NULL;
+
+  DequeArray *a = __atomic_load_n( &dq->array, __ATOMIC_ACQUIRE );
+  void *item = getItem( a, t );
+  if ( !__atomic_compare_exchange_n( &dq->top, &t, t + 1, false,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED ) )
+    return NULL;
+
+  return item;
+}
@@ -0,0 +1,72 @@
+#ifndef DEQUE_H
+#define DEQUE_H
+
+/** A short name to use for the work-stealing deque. */
+typedef struct DequeStruct Deque;
+
+/** Growable circular array of items, used inside a Deque. */
+typedef struct DequeArrayStruct DequeArray;
+
+/**
+  Lock-free work-stealing deque, in the style of Chase and Lev.  One
+  thread owns the deque and pushes and pops items at the bottom; any
+  other thread may steal items from the top.  When the deque fills up,
+  its owner moves the items to a bigger array; old arrays are kept
+  until the deque is freed, since a thief may still be reading one.
+*/
+struct DequeStruct {
+  /** Index of the next item a thief will steal. */
+  long top;
+
+  /** Index one past the item the owner will pop next. */
+  long bottom;
+
+  /** Array currently holding the items. */
+  DequeArray *array;
+
+  /** Arrays that have been replaced by bigger ones. */
+  DequeArray *retired;
+};
+
+/**
+  Initialize an empty deque.
+
+  @param dq deque to initialize.
+*/
+void initDeque( Deque *dq );
+
+/**
+  Free the memory held by a deque.  No other thread may be using it.
+
+  @param dq deque to free the contents of.
+*/
+void freeDeque( Deque *dq );
+
+/**
+  Add an item to the bottom of the deque.  Only the owner may call this.
+
+  @param dq deque to add to.
+  @param item item to add; it must not be NULL.
+*/
+void pushDeque( Deque *dq, void *item );
+
+/**
+  Remove the item at the bottom of the deque, the one pushed most
+  recently.  Only the owner may call this.
+
+  @param dq deque to take an item from.
+  @return the item, or NULL if the deque is empty.
+*/
+void *popDeque( Deque *dq );
+
+/**
+  Remove the item at the top of the deque, the oldest one.  Any thread
+  may call this.
+
+  @param dq deque to steal an item from.
+  @return the item, or NULL if the deque was empty or another thread
+          took the item first.
+*/
+void *stealDeque( Deque *dq );
+
+#endif
@@ -0,0 +1,198 @@
+/**
+ * @file files.c
+ * @author sdcroche
+ *
+ * Files turns the command-line inputs into a list of files to search,
+ * walking directories, and loads whole files into memory.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "files.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/** Initial capacity for the list of files. */
+#define INITIAL_CAP 16
+
+/**
+  Add a single path to the end of the list.
+
+  @param list list to add to.
+  @param path path to add; the list keeps its own copy.
+*/
+static void appendPath( FileList *list, char const *path )
+{
+  if ( list->count >= list->cap ) {
+    list->cap *= 2;
+    list->paths = (char **) realloc( list->paths, list->cap * sizeof( char * ) );
+  }
+  list->paths[ list->count ] = (char *) malloc( strlen( path ) + 1 );
+  strcpy( list->paths[ list->count++ ], path );
+}
+
+/**
+  Comparison function for sorting directory entries by name.
+
+  @param a pointer to the first name.
+  @param b pointer to the second name.
+  @return negative, zero or positive, like strcmp().
+*/
+static int compareNames( void const *a, void const *b )
+{
+  return strcmp( *(char * const *) a, *(char * const *) b );
+}
+
+/**
+  Add every regular file under a directory, in sorted order.
+  Symbolic links inside the directory aren't followed.
+
+  @param list list to add to.
+  @param dir path of the directory.
+*/
+static void addDirectory( FileList *list, char const *dir )
+{
+  DIR *d = opendir( dir );
+  if ( !d ) {
+    fprintf( stderr, "Can't open input file: %s\n", dir );
+    return;
+  }
+
+  // Collect the names first, so we can sort them.
+  int count = 0, cap = INITIAL_CAP;
+  char **names = (char **) malloc( cap * sizeof( char * ) );
+  struct dirent *ent;
+  while ( ( ent = readdir( d ) ) ) {
+    if ( strcmp( ent->d_name, "." ) == 0 || strcmp( ent->d_name, ".." ) == 0 )
+      continue;
+    if ( count >= cap ) {
+      cap *= 2;
+      names = (char **) realloc( names, cap * sizeof( char * ) );
+    }
+    names[ count ] = (char *) malloc( strlen( ent->d_name ) + 1 );
+    strcpy( names[ count++ ], ent->d_name );
+  }
+  closedir( d );
+  qsort( names, count, sizeof( char * ), compareNames );
+
+  for ( int i = 0; i < count; i++ ) {
+    size_t dlen = strlen( dir );
+    char path[ dlen + strlen( names[ i ] ) + 2 ];
+    strcpy( path, dir );
+    if ( dlen == 0 || dir[ dlen - 1 ] != '/' )
+      strcat( path, "/" );
+    strcat( path, names[ i ] );
+
+    struct stat st;
+    if ( lstat( path, &st ) == 0 ) {
+      if ( S_ISDIR( st.st_mode ) )
+        addDirectory( list, path );
+      else if ( S_ISREG( st.st_mode ) )
+        appendPath( list, path );
+    }
+    free( names[ i ] );
+  }
+  free( names );
+}
+
+// Documented in the header.
+void initFileList( FileList *list )
+{
+  list->count = 0;
+  list->cap = INITIAL_CAP;
+  list->paths = (char **) malloc( list->cap * sizeof( char * ) );
+  list->sawDirectory = false;
+}
+
+// Documented in the header.
+bool addInput( FileList *list, char const *path )
+{
+  struct stat st;
+  if ( stat( path, &st ) != 0 )
+    return false;
+
+  if ( S_ISDIR( st.st_mode ) ) {
+    list->sawDirectory = true;
+    addDirectory( list, path );
+    return true;
+  }
+
+  // Make sure we'll be able to read it.
+  FILE *fp = fopen( path, "r" );
+  if ( !fp )
+    return false;
+  fclose( fp );
+
+  appendPath( list, path );
+  return true;
+}
+
+// Documented in the header.
+void freeFileList( FileList *list )
+{
+  for ( int i = 0; i < list->count; i++ )
+    free( list->paths[ i ] );
+  free( list->paths );
+}
+
+// Documented in the header.
+bool loadFile( char const *path, FileData *fd )
+{
+  fd->data = NULL;
+  fd->len = 0;
+  fd->mapped = false;
+
+  int f = open( path, O_RDONLY );
+  if ( f < 0 )
+    return false;
+
+  // Regular, non-empty files can just be mapped.
+  struct stat st;
+  if ( fstat( f, &st ) == 0 && S_ISREG( st.st_mode ) && st.st_size > 0 ) {
+    void *p = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, f, 0 );
+    if ( p != MAP_FAILED ) {
+      fd->data = (char *) p;
+      fd->len = st.st_size;
+      fd->mapped = true;
+      close( f );
+      return true;
+    }
+  }
+
+  // Otherwise, read it all into a growing buffer.
+  size_t cap = 4096;
+  fd->data = (char *) malloc( cap );
+  ssize_t n;
+  while ( ( n = read( f, fd->data + fd->len, cap - fd->len ) ) > 0 ) {
+    fd->len += n;
+    if ( fd->len == cap ) {
+      cap *= 2;
+      fd->data = (char *) realloc( fd->data, cap );
+    }
+  }
+  close( f );
+
+  if ( n < 0 ) {
+    free( fd->data );
+    fd->data = NULL;
+    fd->len = 0;
+    return false;
+  }
+  return true;
+}
+
+// Documented in the header.
+void unloadFile( FileData *fd )
+{
+  if ( fd->mapped )
+    munmap( fd->data, fd->len );
+  else
+    free( fd->data );
+  fd->data = NULL;
+  fd->len = 0;
+}
@@ -0,0 +1,80 @@
+#ifndef FILES_H
+#define FILES_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+  List of input files to search, built from the command line.
+  Directories are replaced by all the files under them.
+*/
+typedef struct {
+  /** Paths of the files, in the order they should be searched. */
+  char **paths;
+
+  /** Number of paths in the list. */
+  int count;
+
+  /** Capacity of the paths array. */
+  int cap;
+
+  /** True if any of the inputs was a directory. */
+  bool sawDirectory;
+} FileList;
+
+/**
+  Contents of a whole input file, mapped into memory if possible.
+*/
+typedef struct {
+  /** Bytes of the file. */
+  char *data;
+
+  /** Number of bytes in data. */
+  size_t len;
+
+  /** True if data is mapped rather than allocated. */
+  bool mapped;
+} FileData;
+
+/**
+  Initialize an empty list of files.
+
+  @param list list to initialize.
+*/
+void initFileList( FileList *list );
+
+/**
+  Add an input to the list of files.  If it's a directory, every
+  regular file under it is added instead, in sorted order.
+
+  @param list list to add to.
+  @param path file or directory to add.
+  @return false if path doesn't exist or can't be read.
+*/
+bool addInput( FileList *list, char const *path );
+
+/**
+  Free the memory held by a list of files.
+
+  @param list list to free the contents of.
+*/
+void freeFileList( FileList *list );
+
+/**
+  Get the contents of a whole file, mapping it into memory when we
+  can and reading it when we can't.
+
+  @param path name of the file.
+  @param fd where to store the file's contents.
+  @return false if the file can't be read.
+*/
+bool loadFile( char const *path, FileData *fd );
+
+/**
+  Release the contents of a file loaded with loadFile().
+
+  @param fd file contents to release.
+*/
+void unloadFile( FileData *fd );
+
+#endif
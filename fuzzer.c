@@ -0,0 +1,759 @@
+/**
+ * @file fuzzer.c
+ * @author sdcroche
+ *
+ * Fuzzer checks every matching engine against the match tables run on
+ * the pattern just as it was parsed, before any simplifying.  It makes
+ * up random patterns in the syntax parse.c accepts and random lines to
+ * match them against, then checks that the tables for the simplified
+ * pattern, the tables with a budget, the automaton's spans, its line
+ * search and count and its pattern tags all agree with them.  Patterns
+ * that POSIX extended regular expressions read the same way are also
+ * checked against regcomp() and regexec().  Everything comes from a
+ * generator with a fixed seed, so a failure can be repeated, and the
+ * first one is printed with its pattern and line.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <regex.h>
+#include "arena.h"
+#include "pattern.h"
+#include "program.h"
+#include "context.h"
+#include "automaton.h"
+#include "parse.h"
+#include "simplify.h"
+
+/** Number of cases to run, unless it's given on the command line. */
+#define DEFAULT_ITERATIONS 5000
+
+/** Seed for the generator, unless one is given on the command line. */
+#define DEFAULT_SEED 0x9e3779b97f4a7c15ULL
+
+/** Number of lines each case is matched against. */
+#define CASE_LINES 12
+
+/** Longest line in a case.  The tables are cubic in the length, so
+    short lines keep the cases quick. */
+#define MAX_LINE 24
+
+/** Deepest nesting of groups in a pattern. */
+#define MAX_DEPTH 3
+
+/** Room for a pattern.  Nesting is limited, so they never get close. */
+#define PATTERN_CAP 1024
+
+/** Largest count in a counted repetition. */
+#define MAX_COUNT 3
+
+/** Added to the limit of some counted repetitions, so it's too big for
+    the automaton to copy their sub-pattern and it uses a counter. */
+#define BIG_COUNT 20
+
+/** Most spans a line can have; every one is at least a byte long. */
+#define MAX_SPANS ( MAX_LINE + 1 )
+
+/** Characters the pattern's literals and the lines are made of.  A
+    few of them are upper case, for -i, and there's a period and a
+    hyphen to go with the escapes and classes that use them. */
+static char const alphabet[] = "aaabbbcccABx.-";
+
+/** Characters that get a backslash to match themselves. */
+static char const specials[] = ".*+?|()[{\\^$";
+
+/** A pattern being made up. */
+typedef struct {
+  /** The pattern so far, always null-terminated. */
+  char str[ PATTERN_CAP ];
+
+  /** Number of characters in str. */
+  int len;
+
+  /** True if letters match in either case. */
+  bool fold;
+
+  /** Number of anchors so far. */
+  int anchors;
+
+  /** True until something's added that POSIX reads differently or
+      doesn't define or glibc gets wrong: a repetition of another
+      repetition or of anything with an anchor in it, or a range from
+      upper to lower case when ignoring case. */
+  bool posix;
+} Gen;
+
+/** The spans matched on a line. */
+typedef struct {
+  /** Start of each span. */
+  int begin[ MAX_SPANS ];
+
+  /** End of each span. */
+  int end[ MAX_SPANS ];
+
+  /** Number of spans. */
+  int count;
+
+  /** True if the pattern matches anywhere on the line, even just the
+      empty string. */
+  bool any;
+} Spans;
+
+/** A pattern compiled for every engine. */
+typedef struct {
+  /** The pattern text. */
+  char const *text;
+
+  /** Program compiled straight from the parsed pattern, with no
+      simplifying, to check everything else against. */
+  Program *ref;
+
+  /** Program compiled from the simplified pattern. */
+  Program *prog;
+
+  /** Automaton compiled from prog. */
+  Automaton *nfa;
+
+  /** POSIX version of the pattern, if posix is true. */
+  regex_t posixRe;
+
+  /** True if the pattern means the same thing to POSIX. */
+  bool posix;
+} Engines;
+
+/** State of the generator. */
+static uint64_t state;
+
+/** Number of the case being run, for reporting a failure. */
+static long iteration;
+
+/**
+  Return the next number from a xorshift generator.  It's the same on
+  every platform, unlike rand(), so the cases are too.
+
+  @return the next number.
+*/
+static uint64_t nextRandom( void )
+{
+  uint64_t x = state;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  state = x;
+  return x * 0x2545f4914f6cdd1dULL;
+}
+
+/**
+  Return a random number less than n.
+
+  @param n how many numbers to choose from.
+  @return the number.
+*/
+static int choose( int n )
+{
+  return (int) ( ( nextRandom() >> 33 ) % n );
+}
+
+/**
+  Add characters to the end of a pattern being made up.
+
+  @param g pattern to add to.
+  @param str characters to add.
+*/
+static void emit( Gen *g, char const *str )
+{
+  int n = strlen( str );
+  memcpy( g->str + g->len, str, n + 1 );
+  g->len += n;
+}
+
+/**
+  Add one character to the end of a pattern being made up.
+
+  @param g pattern to add to.
+  @param c character to add.
+*/
+static void emitChar( Gen *g, char c )
+{
+  char s[ 2 ] = { c, '\0' };
+  emit( g, s );
+}
+
+static void genAlternation( Gen *g, int depth );
+
+/**
+  Add a bracketed character class.  A hyphen only goes first or last,
+  where it's just a hyphen, and there's never a ] or [ inside, since
+  POSIX gives those meanings parse.c doesn't.
+
+  @param g pattern to add to.
+*/
+static void genClass( Gen *g )
+{
+  emitChar( g, '[' );
+  if ( choose( 3 ) == 0 )
+    emitChar( g, '^' );
+  if ( choose( 6 ) == 0 )
+    emitChar( g, '-' );
+
+  int items = 1 + choose( 3 );
+  for ( int i = 0; i < items; i++ ) {
+    if ( choose( 3 ) == 0 ) {
+      bool mixed = choose( 2 );
+      emit( g, mixed ? "A-b" : "a-c" );
+      if ( mixed && g->fold )
+        g->posix = false;
+    }
+    else {
+      char c;
+      do
+        c = alphabet[ choose( sizeof( alphabet ) - 1 ) ];
+      while ( c == '-' );
+      emitChar( g, c );
+    }
+  }
+
+  if ( choose( 6 ) == 0 )
+    emitChar( g, '-' );
+  emitChar( g, ']' );
+}
+
+/**
+  Add an atomic pattern and any repetitions after it.
+
+  @param g pattern to add to.
+  @param depth how many more groups can nest inside.
+*/
+static void genItem( Gen *g, int depth )
+{
+  int anchors = g->anchors;
+  int kind = choose( 12 );
+  if ( kind < 5 ) {
+    char c = alphabet[ choose( sizeof( alphabet ) - 1 ) ];
+    if ( strchr( specials, c ) )
+      emitChar( g, '\\' );
+    emitChar( g, c );
+  }
+  else if ( kind == 5 ) {
+    emitChar( g, '\\' );
+    emitChar( g, specials[ choose( sizeof( specials ) - 1 ) ] );
+  }
+  else if ( kind == 6 )
+    emitChar( g, '.' );
+  else if ( kind == 7 ) {
+    emitChar( g, choose( 2 ) ? '^' : '$' );
+    g->anchors++;
+  }
+  else if ( kind < 10 || depth == 0 )
+    genClass( g );
+  else {
+    emitChar( g, '(' );
+    genAlternation( g, depth - 1 );
+    emitChar( g, ')' );
+  }
+
+  // Usually one repetition at most.  POSIX doesn't say what more than
+  // one means, and glibc can match past an anchor that's repeated, as
+  // in (c.c|^c)+.
+  int reps = choose( 3 ) == 0 ? 1 + ( choose( 8 ) == 0 ) : 0;
+  if ( reps > 1 || ( reps && g->anchors > anchors ) )
+    g->posix = false;
+  for ( int r = 0; r < reps; r++ ) {
+    int op = choose( 6 );
+    if ( op < 3 )
+      emitChar( g, "*+?"[ op ] );
+    else {
+      char buf[ 32 ];
+      int min = choose( MAX_COUNT + 1 );
+      int max = min + choose( MAX_COUNT + 1 - min );
+      if ( choose( 2 ) == 0 )
+        max += BIG_COUNT;
+      if ( op == 3 )
+        snprintf( buf, sizeof( buf ), "{%d}", min );
+      else if ( op == 4 )
+        snprintf( buf, sizeof( buf ), "{%d,}", min );
+      else
+        snprintf( buf, sizeof( buf ), "{%d,%d}", min, max );
+      emit( g, buf );
+    }
+  }
+}
+
+/**
+  Add a concatenation of one or more items.
+
+  @param g pattern to add to.
+  @param depth how many more groups can nest inside.
+*/
+static void genConcatenation( Gen *g, int depth )
+{
+  int items = 1 + choose( 3 );
+  for ( int i = 0; i < items; i++ )
+    genItem( g, depth );
+}
+
+/**
+  Add an alternation of one or more concatenations.
+
+  @param g pattern to add to.
+  @param depth how many more groups can nest inside.
+*/
+static void genAlternation( Gen *g, int depth )
+{
+  genConcatenation( g, depth );
+  while ( choose( 4 ) == 0 ) {
+    emitChar( g, '|' );
+    genConcatenation( g, depth );
+  }
+}
+
+/**
+  Make up a line to match against.
+
+  @param line room for the line, MAX_LINE + 1 bytes.
+  @return its length.
+*/
+static int genLine( char *line )
+{
+  int len = choose( MAX_LINE + 1 );
+  for ( int i = 0; i < len; i++ )
+    line[ i ] = alphabet[ choose( sizeof( alphabet ) - 1 ) ];
+  line[ len ] = '\0';
+  return len;
+}
+
+/**
+  Compile a pattern for every engine.
+
+  @param c where to put everything compiled.
+  @param text the pattern.
+  @param posix true if POSIX reads it the same way.
+  @param fold true if letters match in either case.
+  @param arena arena to compile into.
+*/
+static void compile( Engines *c, char const *text, bool posix, bool fold,
+                     Arena *arena )
+{
+  c->text = text;
+  c->ref = compileProgram( parsePattern( text, fold, arena ), fold, arena );
+  c->prog = compileProgram( simplifyPattern( parsePattern( text, fold, arena ),
+                                             arena ), fold, arena );
+  c->nfa = compileAutomaton( c->prog, arena );
+
+  c->posix = posix;
+  if ( posix && regcomp( &c->posixRe, text,
+                         REG_EXTENDED | ( fold ? REG_ICASE : 0 ) ) != 0 ) {
+    fprintf( stderr, "case %ld: regcomp rejects: %s\n", iteration, text );
+    exit( EXIT_FAILURE );
+  }
+}
+
+/**
+  Release what compile() made outside the arena.
+
+  @param c compiled pattern.
+*/
+static void release( Engines *c )
+{
+  if ( c->posix )
+    regfree( &c->posixRe );
+}
+
+/**
+  Find the spans on a line from the latest match tables, the way
+  regular highlights them: the longest non-empty match starting
+  furthest left, then on from the end of it.
+
+  @param ctx context holding the tables.
+  @param len length of the line.
+  @param s spans to fill in.
+*/
+static void tableSpans( MatchContext const *ctx, int len, Spans *s )
+{
+  s->count = 0;
+  s->any = false;
+  for ( int begin = 0; begin <= len && !s->any; begin++ )
+    for ( int end = begin; end <= len && !s->any; end++ )
+      s->any = matches( ctx, begin, end );
+
+  int begin = 0;
+  while ( begin < len ) {
+    int end = len;
+    while ( end > begin && !matches( ctx, begin, end ) )
+      end--;
+    if ( end > begin ) {
+      s->begin[ s->count ] = begin;
+      s->end[ s->count++ ] = end;
+      begin = end;
+    }
+    else
+      begin++;
+  }
+}
+
+/**
+  Find the spans on a line with the automaton.
+
+  @param nfa automaton to match.
+  @param ctx context to match with.
+  @param line the line.
+  @param len its length.
+  @param s spans to fill in.
+*/
+static void automatonSpans( Automaton const *nfa, MatchContext *ctx,
+                            char const *line, int len, Spans *s )
+{
+  s->count = 0;
+  s->any = false;
+  size_t from = 0, begin, end;
+  while ( nextSpan( nfa, ctx, line, len, from, &begin, &end ) ) {
+    s->begin[ s->count ] = begin;
+    s->end[ s->count++ ] = end;
+    from = end;
+  }
+}
+
+/**
+  Find the spans on a line with regexec().  POSIX finds the leftmost
+  match, and the longest one there, but it may be empty, where regular
+  only highlights non-empty ones.  Nothing matches before an empty
+  match, so the search just picks up again one byte past it.  Past the
+  start of the line, REG_NOTBOL keeps ^ from matching.
+
+  @param re compiled POSIX pattern.
+  @param line the line.
+  @param len its length.
+  @param s spans to fill in.
+*/
+static void posixSpans( regex_t const *re, char const *line, int len,
+                        Spans *s )
+{
+  regmatch_t m;
+  s->count = 0;
+  s->any = regexec( re, line, 1, &m, 0 ) == 0;
+
+  int from = 0;
+  while ( from <= len &&
+          regexec( re, line + from, 1, &m, from ? REG_NOTBOL : 0 ) == 0 ) {
+    int begin = from + m.rm_so, end = from + m.rm_eo;
+    if ( end > begin ) {
+      s->begin[ s->count ] = begin;
+      s->end[ s->count++ ] = end;
+      from = end;
+    }
+    else
+      from = begin + 1;
+  }
+}
+
+/**
+  Print a line of spans, to show where engines disagree.
+
+  @param name name of the engine.
+  @param s its spans.
+*/
+static void printSpans( char const *name, Spans const *s )
+{
+  fprintf( stderr, "  %-10s any=%d", name, s->any );
+  for ( int i = 0; i < s->count; i++ )
+    fprintf( stderr, " [%d,%d)", s->begin[ i ], s->end[ i ] );
+  fprintf( stderr, "\n" );
+}
+
+/**
+  Start the report of an engine that disagrees with the reference.
+
+  @param what what disagreed.
+  @param c pattern it disagreed on.
+  @param line line it disagreed on, or NULL for a whole block.
+  @param fold true if letters match in either case.
+*/
+static void fail( char const *what, Engines const *c, char const *line,
+                  bool fold )
+{
+  fprintf( stderr, "case %ld: %s disagrees\n  pattern %s%s\n", iteration,
+           what, c->text, fold ? " (ignoring case)" : "" );
+  if ( line )
+    fprintf( stderr, "  line    \"%s\"\n", line );
+}
+
+/**
+  Report whether two sets of spans are the same.
+
+  @param a one set.
+  @param b the other.
+  @param checkAny true if whether they match anywhere should be
+                  compared too.
+  @return true if they're the same.
+*/
+static bool sameSpans( Spans const *a, Spans const *b, bool checkAny )
+{
+  if ( a->count != b->count || ( checkAny && a->any != b->any ) )
+    return false;
+  for ( int i = 0; i < a->count; i++ )
+    if ( a->begin[ i ] != b->begin[ i ] || a->end[ i ] != b->end[ i ] )
+      return false;
+  return true;
+}
+
+/**
+  Check every engine against the reference on one line.
+
+  @param c compiled pattern.
+  @param ctx context to match with.
+  @param line the line.
+  @param len its length.
+  @param fold true if letters match in either case.
+  @param ref set to the reference spans.
+*/
+static void checkLine( Engines const *c, MatchContext *ctx, char const *line,
+                       int len, bool fold, Spans *ref )
+{
+  Spans s;
+  locateMatches( c->ref, ctx, line, len, 0 );
+  tableSpans( ctx, len, ref );
+
+  locateMatches( c->prog, ctx, line, len, 0 );
+  tableSpans( ctx, len, &s );
+  if ( !sameSpans( ref, &s, true ) ) {
+    fail( "simplified tables", c, line, fold );
+    printSpans( "reference", ref );
+    printSpans( "simplified", &s );
+    exit( EXIT_FAILURE );
+  }
+
+  // Whatever the budget, the tables either give up or get it right.
+  size_t budget = 1 + choose( 20000 );
+  if ( locateMatches( c->prog, ctx, line, len, budget ) ) {
+    tableSpans( ctx, len, &s );
+    if ( !sameSpans( ref, &s, true ) ) {
+      fail( "tables with a budget", c, line, fold );
+      printSpans( "reference", ref );
+      printSpans( "budget", &s );
+      exit( EXIT_FAILURE );
+    }
+  }
+
+  automatonSpans( c->nfa, ctx, line, len, &s );
+  if ( !sameSpans( ref, &s, false ) ) {
+    fail( "automaton spans", c, line, fold );
+    printSpans( "reference", ref );
+    printSpans( "automaton", &s );
+    exit( EXIT_FAILURE );
+  }
+
+  if ( c->posix ) {
+    posixSpans( &c->posixRe, line, len, &s );
+    if ( !sameSpans( ref, &s, true ) ) {
+      fail( "regexec", c, line, fold );
+      printSpans( "reference", ref );
+      printSpans( "regexec", &s );
+      exit( EXIT_FAILURE );
+    }
+  }
+}
+
+/**
+  Check the automaton's line search and line count on a block of
+  lines, against the lines the reference found matches on.
+
+  @param c compiled pattern.
+  @param ctx context to match with.
+  @param block the lines, each ending in a newline but maybe the last.
+  @param len length of the block.
+  @param any whether each line has a match, from the reference.
+  @param fold true if letters match in either case.
+*/
+static void checkBlock( Engines const *c, MatchContext *ctx,
+                        char const *block, size_t len, bool const *any,
+                        bool fold )
+{
+  size_t expected = 0;
+  size_t pos = 0;
+  for ( int i = 0; i < CASE_LINES; i++ ) {
+    char const *nl = memchr( block + pos, '\n', len - pos );
+    size_t next = nl ? (size_t) ( nl - block ) + 1 : len;
+    if ( any[ i ] ) {
+      expected++;
+      if ( findMatchingLine( c->nfa, ctx, block, len, pos ) != pos ) {
+        fail( "line search", c, NULL, fold );
+        fprintf( stderr, "  misses line %d of:\n%.*s\n", i, (int) len,
+                 block );
+        exit( EXIT_FAILURE );
+      }
+    }
+    else if ( findMatchingLine( c->nfa, ctx, block, len, pos ) == pos ) {
+      fail( "line search", c, NULL, fold );
+      fprintf( stderr, "  finds line %d of:\n%.*s\n", i, (int) len, block );
+      exit( EXIT_FAILURE );
+    }
+    pos = next;
+  }
+
+  size_t count = countMatchingLines( c->nfa, ctx, block, len );
+  if ( count != expected ) {
+    fail( "line count", c, NULL, fold );
+    fprintf( stderr, "  counts %zu, expected %zu, in:\n%.*s\n", count,
+             expected, (int) len, block );
+    exit( EXIT_FAILURE );
+  }
+}
+
+/**
+  Check the tags found for two patterns joined the way -f joins them,
+  against the lines each one matches on its own.
+
+  @param a first pattern.
+  @param b second pattern.
+  @param ctx context to match with.
+  @param lines the lines.
+  @param lens their lengths.
+  @param anyA whether each line matches the first pattern.
+  @param anyB whether each line matches the second.
+  @param fold true if letters match in either case.
+  @param arena arena to compile into.
+*/
+static void checkTags( Engines const *a, Engines const *b,
+                       MatchContext *ctx, char lines[][ MAX_LINE + 1 ],
+                       int const *lens, bool const *anyA, bool const *anyB,
+                       bool fold, Arena *arena )
+{
+  Pattern *pa = makeConcatenationPattern( arena,
+                                          parsePattern( a->text, fold, arena ),
+                                          makeTagPattern( arena, 0 ) );
+  Pattern *pb = makeConcatenationPattern( arena,
+                                          parsePattern( b->text, fold, arena ),
+                                          makeTagPattern( arena, 1 ) );
+  Program *prog = compileProgram( simplifyPattern(
+                    makeAlterationPattern( arena, pa, pb ), arena ), fold,
+                                  arena );
+  Automaton *nfa = compileAutomaton( prog, arena );
+
+  for ( int i = 0; i < CASE_LINES; i++ ) {
+    int count;
+    int const *tags = matchingTags( nfa, ctx, lines[ i ], lens[ i ], &count );
+    bool gotA = false, gotB = false;
+    for ( int k = 0; k < count; k++ ) {
+      gotA |= tags[ k ] == 0;
+      gotB |= tags[ k ] == 1;
+    }
+    if ( gotA != anyA[ i ] || gotB != anyB[ i ] ) {
+      fail( "pattern tags", a, lines[ i ], fold );
+      fprintf( stderr, "  with    %s\n  tags %d,%d, expected %d,%d\n",
+               b->text, gotA, gotB, anyA[ i ], anyB[ i ] );
+      exit( EXIT_FAILURE );
+    }
+  }
+}
+
+/**
+  Run one case: two patterns, matched on their own against some lines
+  and as a block, then together with tags.  Each case gets its own
+  context, since a context keeps its DFA states for as long as it sees
+  the same automaton address, and the next case's automaton could be
+  put where this one was.
+
+  @param posixCases incremented for each pattern checked with regexec().
+*/
+static void runCase( long *posixCases )
+{
+  Arena *arena = makeArena();
+  MatchContext *ctx = makeMatchContext();
+  bool fold = choose( 4 ) == 0;
+
+  Gen gen[ 2 ];
+  Engines comp[ 2 ];
+  for ( int p = 0; p < 2; p++ ) {
+    gen[ p ].len = 0;
+    gen[ p ].str[ 0 ] = '\0';
+    gen[ p ].fold = fold;
+    gen[ p ].anchors = 0;
+    gen[ p ].posix = true;
+    genAlternation( gen + p, MAX_DEPTH );
+    compile( comp + p, gen[ p ].str, gen[ p ].posix, fold, arena );
+    *posixCases += gen[ p ].posix;
+  }
+
+  char lines[ CASE_LINES ][ MAX_LINE + 1 ];
+  int lens[ CASE_LINES ];
+  char block[ CASE_LINES * ( MAX_LINE + 1 ) ];
+  size_t blockLen = 0;
+  for ( int i = 0; i < CASE_LINES; i++ ) {
+    lens[ i ] = genLine( lines[ i ] );
+    memcpy( block + blockLen, lines[ i ], lens[ i ] );
+    blockLen += lens[ i ];
+    // The last line may not have a newline, unless it's empty and
+    // wouldn't be a line without one.
+    if ( i + 1 < CASE_LINES || !lens[ i ] || choose( 2 ) )
+      block[ blockLen++ ] = '\n';
+  }
+
+  bool any[ 2 ][ CASE_LINES ];
+  for ( int p = 0; p < 2; p++ ) {
+    for ( int i = 0; i < CASE_LINES; i++ ) {
+      Spans ref;
+      checkLine( comp + p, ctx, lines[ i ], lens[ i ], fold, &ref );
+      any[ p ][ i ] = ref.any;
+    }
+    checkBlock( comp + p, ctx, block, blockLen, any[ p ], fold );
+  }
+  checkTags( comp, comp + 1, ctx, lines, lens, any[ 0 ], any[ 1 ], fold,
+             arena );
+
+  release( comp );
+  release( comp + 1 );
+  freeMatchContext( ctx );
+  freeArena( arena );
+}
+
+/**
+  Print a usage message and exit unsuccessfully.
+*/
+static void usage( void )
+{
+  fprintf( stderr, "usage: fuzzer [iterations [seed]]\n" );
+  exit( EXIT_FAILURE );
+}
+
+/**
+  Parse a positive number from the command line.
+
+  @param str the argument.
+  @return the number.
+*/
+static unsigned long long parseNumber( char const *str )
+{
+  char *rest;
+  unsigned long long n = strtoull( str, &rest, 0 );
+  if ( !*str || *rest || n == 0 )
+    usage();
+  return n;
+}
+
+/**
+  Entry point for the program, runs the cases and reports how many
+  passed.
+
+  @param argc Number of command-line arguments.
+  @param argv List of command-line arguments.
+  @return exit status for the program.
+*/
+int main( int argc, char *argv[] )
+{
+  if ( argc > 3 )
+    usage();
+  long iterations = argc > 1 ? (long) parseNumber( argv[ 1 ] )
+                             : DEFAULT_ITERATIONS;
+  state = argc > 2 ? parseNumber( argv[ 2 ] ) : DEFAULT_SEED;
+
+  long posixCases = 0;
+  for ( iteration = 0; iteration < iterations; iteration++ )
+    runCase( &posixCases );
+
+  printf( "%ld cases, %ld patterns, %ld checked with regexec: all agree\n",
+          iterations, 2 * iterations, posixCases );
+  return EXIT_SUCCESS;
+}
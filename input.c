@@ -0,0 +1,176 @@
+/**
+ * @file input.c
+ * @author sdcroche
+ *
+ * Input reads a stream in large blocks of whole lines, carrying any
+ * partial line at the end of a read over to the next block.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "input.h"
+#include "scan.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+  Make sure the block has room for at least n bytes.
+
+  @param blk block whose buffer may need to grow.
+  @param n number of bytes the block needs room for.
+*/
+static void reserveBlock( Block *blk, size_t n )
+{
+  if ( n > blk->cap ) {
+    if ( blk->cap == 0 )
+      blk->cap = 1;
+    while ( n > blk->cap )
+      blk->cap *= 2;
+    blk->data = (char *) realloc( blk->data, blk->cap );
+  }
+}
+
+/**
+  Find the last newline in a region of memory.
+
+  @param data region to search.
+  @param len number of bytes in data.
+  @return index one past the last newline, or zero if there isn't one.
+*/
+static size_t pastLastNewline( char const *data, size_t len )
+{
+  char const *nl = findLastByte( data, len, '\n' );
+  return nl ? (size_t) ( nl - data ) + 1 : 0;
+}
+
+// Documented in the header.
+size_t checkLineLengths( char const *data, size_t len, int maxLine )
+{
+  size_t pos = 0;
+  while ( pos < len ) {
+    char const *nl = findByte( data + pos, len - pos, '\n' );
+    size_t end = nl ? (size_t) ( nl - data ) : len;
+    if ( end - pos > (size_t) maxLine )
+      return pos;
+    pos = end + 1;
+  }
+
+  return len;
+}
+
+// Documented in the header.
+Reader *makeReader( FILE *fp, int maxLine, size_t blockSize )
+{
+  Reader *r = (Reader *) malloc( sizeof( Reader ) );
+  r->fp = fp;
+  r->fd = fileno( fp );
+  r->maxLine = maxLine;
+  r->blockSize = blockSize;
+  r->carryCap = 0;
+  r->carryLen = 0;
+  r->carry = NULL;
+  r->done = false;
+
+  // Let the kernel know to read ahead aggressively.  This fails
+  // harmlessly for pipes and terminals.
+  posix_fadvise( r->fd, 0, 0, POSIX_FADV_SEQUENTIAL );
+
+  return r;
+}
+
+// Documented in the header.
+bool readBlock( Reader *r, Block *blk )
+{
+  blk->len = 0;
+  blk->tooLong = false;
+  if ( r->done )
+    return false;
+
+  // Start with the partial line left over from the last read.
+  reserveBlock( blk, r->carryLen + r->blockSize );
+  if ( r->carryLen )
+    memcpy( blk->data, r->carry, r->carryLen );
+  blk->len = r->carryLen;
+  r->carryLen = 0;
+
+  // Keep reading until we have at least one whole line, or there's no
+  // more input.
+  size_t whole = 0;
+  while ( whole == 0 ) {
+    // Read straight into the block, skipping the copy through a
+    // stdio buffer.
+    ssize_t n;
+    do
+      n = read( r->fd, blk->data + blk->len, blk->cap - blk->len );
+    while ( n < 0 && errno == EINTR );
+
+    if ( n <= 0 ) {
+      // Whatever's left is the last line, even without a newline.
+      r->done = true;
+      whole = blk->len;
+      break;
+    }
+    blk->len += n;
+
+    whole = pastLastNewline( blk->data, blk->len );
+
+    // A partial line that's already too long doesn't need the rest
+    // of its text to be rejected.
+    if ( whole == 0 && r->maxLine && blk->len > (size_t) r->maxLine )
+      break;
+
+    if ( whole == 0 )
+      reserveBlock( blk, blk->len + r->blockSize );
+  }
+
+  // Save the partial line at the end for next time.
+  if ( whole < blk->len ) {
+    r->carryLen = blk->len - whole;
+    if ( r->carryLen > r->carryCap ) {
+      r->carryCap = r->carryLen;
+      r->carry = (char *) realloc( r->carry, r->carryCap );
+    }
+    memcpy( r->carry, blk->data + whole, r->carryLen );
+    blk->len = whole;
+  }
+
+  // A partial line left over at the front of the block means it was
+  // too long all by itself.
+  if ( r->maxLine && whole == 0 && r->carryLen ) {
+    blk->tooLong = true;
+    r->done = true;
+  }
+  else if ( r->maxLine &&
+            ( blk->len = checkLineLengths( blk->data, whole, r->maxLine ) )
+            < whole ) {
+    blk->tooLong = true;
+    r->done = true;
+  }
+
+  return blk->len > 0 || blk->tooLong;
+}
+
+// Documented in the header.
+void freeReader( Reader *r )
+{
+  free( r->carry );
+  free( r );
+}
+
+// Documented in the header.
+void initBlock( Block *blk )
+{
+  blk->data = NULL;
+  blk->len = 0;
+  blk->cap = 0;
+  blk->tooLong = false;
+}
+
+// Documented in the header.
+void freeBlock( Block *blk )
+{
+  free( blk->data );
+  initBlock( blk );
+}
@@ -0,0 +1,113 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+  A block of input text, made up of whole lines.  Every line but the
+  last one in the input ends with a newline; the last line of the
+  input may not.
+*/
+typedef struct {
+  /** Bytes of input in this block. */
+  char *data;
+
+  /** Number of bytes in data. */
+  size_t len;
+
+  /** Capacity of data. */
+  size_t cap;
+
+  /** True if the input line right after this block was too long.  No
+      more blocks are read after one like this. */
+  bool tooLong;
+} Block;
+
+/** A short name to use for the block reader. */
+typedef struct ReaderStruct Reader;
+
+/**
+  Reader that splits an input stream into blocks of whole lines,
+  making sure no line is longer than a given limit.
+*/
+struct ReaderStruct {
+  /** Stream we're reading from. */
+  FILE *fp;
+
+  /** File descriptor for fp, which is what we actually read from. */
+  int fd;
+
+  /** Longest line we'll accept, or zero for no limit. */
+  int maxLine;
+
+  /** Number of bytes we try to read for each block. */
+  size_t blockSize;
+
+  /** Partial line left over at the end of the last block. */
+  char *carry;
+
+  /** Number of bytes in carry. */
+  size_t carryLen;
+
+  /** Capacity of carry. */
+  size_t carryCap;
+
+  /** True once there's nothing more to read. */
+  bool done;
+};
+
+/**
+  Make a reader for the given stream.
+
+  @param fp stream to read from.
+  @param maxLine longest line to accept, or zero for no limit.
+  @param blockSize number of bytes to try to read for each block.
+  @return a dynamically allocated reader.
+*/
+Reader *makeReader( FILE *fp, int maxLine, size_t blockSize );
+
+/**
+  Read the next block of whole lines.  If a line is too long, the
+  block ends right before that line and has its tooLong flag set.
+
+  @param r reader to read from.
+  @param blk block to fill in; its buffer is reused and grown as needed.
+  @return true if there was a block to read, false at the end of input.
+*/
+bool readBlock( Reader *r, Block *blk );
+
+/**
+  Check the lengths of the lines at the start of a region of text.
+
+  @param data region of whole lines.
+  @param len number of bytes in data.
+  @param maxLine longest line that's allowed.
+  @return number of bytes at the start of data before the first line
+          that's too long, or len if none are.
+*/
+size_t checkLineLengths( char const *data, size_t len, int maxLine );
+
+/**
+  Free the reader.  This doesn't close its stream.
+
+  @param r reader to free.
+*/
+void freeReader( Reader *r );
+
+/**
+  Initialize an empty block.
+
+  @param blk block to initialize.
+*/
+void initBlock( Block *blk );
+
+/**
+  Free the memory held by a block.
+
+  @param blk block to free the contents of.
+*/
+void freeBlock( Block *blk );
+
+#endif
@@ -0,0 +1,176 @@
+/**
+ * @file output.c
+ * @author sdcroche
+ *
+ * Output collects formatted lines in a buffer and writes them out in
+ * large blocks, so reporting a match doesn't cost a library call per
+ * character.
+ */
+#include "output.h"
+#include <stdlib.h>
+#include <string.h>
+
+/** Escape sequence that switches the terminal to red. */
+#define RED "\033[31m"
+
+/** Escape sequence that switches the terminal back to normal. */
+#define WHITE "\033[0m"
+
+/** Initial capacity of the output buffer. */
+#define INITIAL_CAP 1024
+
+/** Once this much output is buffered, it's written out. */
+#define BLOCK_SIZE ( 64 * 1024 )
+
+/**
+  Make sure there's room for at least n more bytes in the buffer.
+
+  @param out writer whose buffer may need to grow.
+  @param n number of bytes we're about to add.
+*/
+static void reserve( Output *out, size_t n )
+{
+  if ( out->len + n > out->cap ) {
+    while ( out->len + n > out->cap )
+      out->cap *= 2;
+    out->buf = (char *) realloc( out->buf, out->cap );
+  }
+}
+
+/**
+  Append bytes to the buffer.
+
+  @param out writer to append to.
+  @param str bytes to append.
+  @param n number of bytes in str.
+*/
+static void append( Output *out, char const *str, size_t n )
+{
+  reserve( out, n );
+  memcpy( out->buf + out->len, str, n );
+  out->len += n;
+}
+
+/**
+  If nothing has been added to the current line yet, start it with
+  the line prefix.
+
+  @param out writer whose line may be starting.
+*/
+static void startLine( Output *out )
+{
+  if ( !out->lineStarted && out->prefix )
+    append( out, out->prefix, strlen( out->prefix ) );
+  out->lineStarted = true;
+}
+
+/**
+  If we're inside a highlighted region, switch the color back.
+
+  @param out writer whose highlighting should end.
+*/
+static void endMatch( Output *out )
+{
+  if ( out->inMatch && out->color )
+    append( out, WHITE, sizeof( WHITE ) - 1 );
+  out->inMatch = false;
+}
+
+// Documented in the header.
+Output *makeOutput( FILE *fp, bool color )
+{
+  Output *out = (Output *) malloc( sizeof( Output ) );
+  out->fp = fp;
+  out->cap = INITIAL_CAP;
+  out->buf = (char *) malloc( out->cap );
+  out->len = 0;
+  out->color = color;
+  out->inMatch = false;
+  out->prefix = NULL;
+  out->lineStarted = false;
+
+  return out;
+}
+
+// Documented in the header.
+void setOutputPrefix( Output *out, char const *prefix )
+{
+  free( out->prefix );
+  out->prefix = NULL;
+  if ( prefix ) {
+    out->prefix = (char *) malloc( strlen( prefix ) + 1 );
+    strcpy( out->prefix, prefix );
+  }
+}
+
+// Documented in the header.
+void outputText( Output *out, char const *str, size_t n )
+{
+  if ( n == 0 )
+    return;
+
+  startLine( out );
+  endMatch( out );
+  append( out, str, n );
+}
+
+// Documented in the header.
+void outputMatch( Output *out, char const *str, size_t n )
+{
+  if ( n == 0 )
+    return;
+
+  startLine( out );
+
+  // Only switch to red if the previous region wasn't already red.
+  if ( !out->inMatch && out->color )
+    append( out, RED, sizeof( RED ) - 1 );
+  out->inMatch = true;
+  append( out, str, n );
+}
+
+// Documented in the header.
+void outputEndLine( Output *out )
+{
+  startLine( out );
+  endMatch( out );
+  append( out, "\n", 1 );
+  out->lineStarted = false;
+
+  if ( out->len >= BLOCK_SIZE )
+    flushOutput( out );
+}
+
+// Documented in the header.
+void appendOutput( Output *dst, Output *src )
+{
+  append( dst, src->buf, src->len );
+  src->len = 0;
+  src->inMatch = false;
+
+  if ( dst->len >= BLOCK_SIZE )
+    flushOutput( dst );
+}
+
+// Documented in the header.
+void flushOutput( Output *out )
+{
+  // Output that's only collected in memory stays where it is.
+  if ( !out->fp )
+    return;
+
+  if ( out->len ) {
+    fwrite( out->buf, 1, out->len, out->fp );
+    out->len = 0;
+  }
+  fflush( out->fp );
+}
+
+// Documented in the header.
+void freeOutput( Output *out )
+{
+  flushOutput( out );
+  free( out->prefix );
+  free( out->buf );
+  free( out );
+}
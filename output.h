@@ -0,0 +1,114 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/** A short name to use for the buffered output writer. */
+typedef struct OutputStruct Output;
+
+/**
+  Buffered writer for the program's output.  Lines are built up in a
+  reusable buffer, highlighted regions are wrapped in color escape
+  codes (adjacent highlighted regions share one pair of codes), and
+  the buffer is written out in large blocks with a single fwrite().
+*/
+struct OutputStruct {
+  /** Stream the buffer is flushed to. */
+  FILE *fp;
+
+  /** Buffered bytes that haven't been written yet. */
+  char *buf;
+
+  /** Number of bytes used in buf. */
+  size_t len;
+
+  /** Capacity of buf. */
+  size_t cap;
+
+  /** True if highlighted text should be wrapped in escape codes. */
+  bool color;
+
+  /** True if we're in the middle of a highlighted region. */
+  bool inMatch;
+
+  /** Copy of the text printed at the start of every line, or NULL for
+      none. */
+  char *prefix;
+
+  /** True once something has been added to the current line. */
+  bool lineStarted;
+};
+
+/**
+  Make a new output writer.
+
+  @param fp stream the output will eventually be written to, or NULL
+            for a writer that just collects output in memory.
+  @param color true if matches should be highlighted with escape codes.
+  @return a dynamically allocated output writer.
+*/
+Output *makeOutput( FILE *fp, bool color );
+
+/**
+  Set the text printed at the start of every line from now on, like
+  the name of the file the line came from.  The writer keeps its own
+  copy, so the caller's string doesn't need to outlive it.
+
+  @param out writer to set the prefix for.
+  @param prefix text for the start of each line, or NULL for none.
+*/
+void setOutputPrefix( Output *out, char const *prefix );
+
+/**
+  Add ordinary, un-highlighted text to the current line.
+
+  @param out writer to add the text to.
+  @param str text to add.
+  @param n number of bytes in str.
+*/
+void outputText( Output *out, char const *str, size_t n );
+
+/**
+  Add highlighted text to the current line.  If the previous text on
+  the line was also highlighted, the two regions are merged.
+
+  @param out writer to add the text to.
+  @param str text to add.
+  @param n number of bytes in str.
+*/
+void outputMatch( Output *out, char const *str, size_t n );
+
+/**
+  Finish the current line, and write out the buffer if it's gotten
+  large enough.
+
+  @param out writer whose line is finished.
+*/
+void outputEndLine( Output *out );
+
+/**
+  Move everything buffered in one writer onto the end of another.
+  The source writer is left empty, ready to collect more output.
+
+  @param dst writer to add the output to.
+  @param src writer the output is taken from.
+*/
+void appendOutput( Output *dst, Output *src );
+
+/**
+  Write everything that's buffered to the output stream.
+
+  @param out writer to flush.
+*/
+void flushOutput( Output *out );
+
+/**
+  Flush any buffered output and free the writer.
+
+  @param out writer to free.
+*/
+void freeOutput( Output *out );
+
+#endif
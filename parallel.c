@@ -0,0 +1,691 @@
+/**
+ * @file parallel.c
+ * @author sdcroche
+ *
+ * Parallel runs the matching for blocks of input on a pool of worker
+ * threads.  For a stream, the calling thread reads blocks, the workers
+ * match them, and an output thread writes the results back out in
+ * input order.  For files, the workers pull (file, chunk) tasks off
+ * work-stealing deques, and the calling thread writes the results,
+ * releasing more tasks as it goes so the workers can't get too far
+ * ahead of it.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "parallel.h"
+#include "deque.h"
+#include "scan.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Number of blocks that can be in flight for each worker thread. */
+#define SLOTS_PER_THREAD 2
+
+/** Where a slot in the pipeline is in its life cycle. */
+typedef enum {
+  SLOT_EMPTY,   ///< Waiting to be filled by the reader.
+  SLOT_READY,   ///< Holds a block that no worker has claimed yet.
+  SLOT_RUNNING, ///< A worker is matching the block.
+  SLOT_DONE     ///< The report is ready to be written.
+} SlotState;
+
+/** One block of input on its way through the pipeline, along with
+    the report for it. */
+typedef struct {
+  /** Block of input lines. */
+  Block blk;
+
+  /** Report for this block, collected in memory. */
+  Output *out;
+
+  /** What's happening to this slot right now. */
+  SlotState state;
+} Slot;
+
+/**
+  State shared by the reader, the workers and the output thread.  The
+  slots form a ring used as a reorder buffer; block number seq always
+  goes in slot seq % slotCount.  Everything here is protected by lock.
+*/
+typedef struct {
+  pthread_mutex_t lock;
+
+  /** Signaled whenever any slot or sequence number changes. */
+  pthread_cond_t changed;
+
+  /** Ring of slots. */
+  Slot *slots;
+
+  /** Number of slots in the ring. */
+  int slotCount;
+
+  /** Number of blocks read so far. */
+  long readSeq;
+
+  /** Sequence number of the next block for a worker to claim. */
+  long claimSeq;
+
+  /** Sequence number of the next block to write out. */
+  long writeSeq;
+
+  /** True once the reader has run out of blocks. */
+  bool eof;
+
+  /** True if the output stopped at a line that was too long. */
+  bool tooLong;
+
+  /** Matching function to call for each block, and its argument. */
+  BlockFunction fn;
+  void *arg;
+
+  /** Where the reports go, in input order. */
+  Output *out;
+} Pipeline;
+
+/**
+  Return the slot for a given sequence number.
+
+  @param pl the pipeline.
+  @param seq sequence number of a block.
+  @return the slot that block goes in.
+*/
+static Slot *slotFor( Pipeline *pl, long seq )
+{
+  return &pl->slots[ seq % pl->slotCount ];
+}
+
+/**
+  Start routine for a worker thread.  It claims blocks in order and
+  matches them until there are no more.
+
+  @param p the pipeline.
+  @return NULL
+*/
+static void *worker( void *p )
+{
+  Pipeline *pl = (Pipeline *) p;
+  MatchContext *ctx = makeMatchContext();
+
+  pthread_mutex_lock( &pl->lock );
+  for ( ;; ) {
+    while ( pl->claimSeq == pl->readSeq && !pl->eof )
+      pthread_cond_wait( &pl->changed, &pl->lock );
+    if ( pl->claimSeq == pl->readSeq )
+      break;
+
+    Slot *s = slotFor( pl, pl->claimSeq++ );
+    s->state = SLOT_RUNNING;
+    pthread_mutex_unlock( &pl->lock );
+
+    pl->fn( pl->arg, ctx, s->blk.data, s->blk.len, s->out );
+
+    pthread_mutex_lock( &pl->lock );
+    s->state = SLOT_DONE;
+    pthread_cond_broadcast( &pl->changed );
+  }
+  pthread_mutex_unlock( &pl->lock );
+
+  freeMatchContext( ctx );
+  return NULL;
+}
+
+/**
+  Start routine for the output thread.  It writes finished reports in
+  sequence order, freeing up their slots for the reader.
+
+  @param p the pipeline.
+  @return NULL
+*/
+static void *writer( void *p )
+{
+  Pipeline *pl = (Pipeline *) p;
+
+  pthread_mutex_lock( &pl->lock );
+  for ( ;; ) {
+    while ( !( pl->writeSeq < pl->readSeq &&
+               slotFor( pl, pl->writeSeq )->state == SLOT_DONE ) &&
+            !( pl->eof && pl->writeSeq == pl->readSeq ) )
+      pthread_cond_wait( &pl->changed, &pl->lock );
+    if ( pl->writeSeq == pl->readSeq )
+      break;
+
+    Slot *s = slotFor( pl, pl->writeSeq );
+    pthread_mutex_unlock( &pl->lock );
+
+    appendOutput( pl->out, s->out );
+
+    pthread_mutex_lock( &pl->lock );
+    if ( s->blk.tooLong )
+      pl->tooLong = true;
+    s->state = SLOT_EMPTY;
+    pl->writeSeq++;
+    pthread_cond_broadcast( &pl->changed );
+  }
+  pthread_mutex_unlock( &pl->lock );
+
+  return NULL;
+}
+
+// Documented in the header.
+bool runParallel( Reader *r, int threads, BlockFunction fn, void *arg,
+                  Output *out )
+{
+  Pipeline pl;
+  pthread_mutex_init( &pl.lock, NULL );
+  pthread_cond_init( &pl.changed, NULL );
+  pl.slotCount = threads * SLOTS_PER_THREAD;
+  pl.slots = (Slot *) malloc( pl.slotCount * sizeof( Slot ) );
+  for ( int i = 0; i < pl.slotCount; i++ ) {
+    initBlock( &pl.slots[ i ].blk );
+    pl.slots[ i ].out = makeOutput( NULL, out->color );
+    pl.slots[ i ].state = SLOT_EMPTY;
+  }
+  pl.readSeq = pl.claimSeq = pl.writeSeq = 0;
+  pl.eof = false;
+  pl.tooLong = false;
+  pl.fn = fn;
+  pl.arg = arg;
+  pl.out = out;
+
+  pthread_t workers[ threads ];
+  for ( int i = 0; i < threads; i++ )
+    pthread_create( &workers[ i ], NULL, worker, &pl );
+  pthread_t output;
+  pthread_create( &output, NULL, writer, &pl );
+
+  // This thread is the reader.  It fills empty slots as long as the
+  // output thread isn't too far behind.
+  for ( ;; ) {
+    pthread_mutex_lock( &pl.lock );
+    while ( pl.readSeq - pl.writeSeq == pl.slotCount )
+      pthread_cond_wait( &pl.changed, &pl.lock );
+    pthread_mutex_unlock( &pl.lock );
+
+    // Only the reader touches an empty slot, so we can fill it without
+    // holding the lock.
+    Slot *s = slotFor( &pl, pl.readSeq );
+    bool more = readBlock( r, &s->blk );
+
+    pthread_mutex_lock( &pl.lock );
+    if ( more ) {
+      s->state = SLOT_READY;
+      pl.readSeq++;
+    } else
+      pl.eof = true;
+    pthread_cond_broadcast( &pl.changed );
+    pthread_mutex_unlock( &pl.lock );
+
+    if ( !more )
+      break;
+  }
+
+  for ( int i = 0; i < threads; i++ )
+    pthread_join( workers[ i ], NULL );
+  pthread_join( output, NULL );
+
+  for ( int i = 0; i < pl.slotCount; i++ ) {
+    freeBlock( &pl.slots[ i ].blk );
+    freeOutput( pl.slots[ i ].out );
+  }
+  free( pl.slots );
+  pthread_cond_destroy( &pl.changed );
+  pthread_mutex_destroy( &pl.lock );
+
+  return !pl.tooLong;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Work-stealing scheduler for files
+
+/** The kinds of task a worker can be given. */
+typedef enum {
+  FILE_TASK,  ///< Load a file and split it into chunks.
+  CHUNK_TASK  ///< Match the lines in one chunk of a file.
+} TaskKind;
+
+/**
+  Superclass for the tasks the workers pull off their deques.  Each
+  kind of task starts with the same fields, so a worker can look at
+  the kind and cast down.
+*/
+typedef struct {
+  TaskKind kind;
+} Task;
+
+/** A short name for the task representing a whole file. */
+typedef struct FileTaskStruct FileTask;
+
+/** Task for matching one chunk of whole lines from a file. */
+typedef struct {
+  // Fields from our superclass.
+  TaskKind kind;
+
+  /** File this chunk came from. */
+  FileTask *file;
+
+  /** Where the chunk starts in the file, and how long it is. */
+  size_t start, len;
+
+  /** Report for this chunk, collected in memory. */
+  Output *out;
+
+  /** True if the chunk was cut short by a line that's too long. */
+  bool tooLong;
+
+  /** True once the report is ready to be written. */
+  bool done;
+} ChunkTask;
+
+/** Task for loading one file and splitting it into chunks. */
+struct FileTaskStruct {
+  // Fields from our superclass.
+  TaskKind kind;
+
+  /** Name of the file. */
+  char const *path;
+
+  /** Prefix for output lines from this file, or NULL for none. */
+  char *prefix;
+
+  /** Contents of the file. */
+  FileData data;
+
+  /** Number of chunks, or -1 until the file has been split. */
+  int chunkCount;
+
+  /** The chunks of this file. */
+  ChunkTask *chunks;
+};
+
+/**
+  State shared by all the workers and the output stage.  Tasks are
+  released in input order, and only so many of them can be ahead of
+  the output at once, so a slow file at the front can't leave every
+  later file mapped and every later report sitting in memory.
+*/
+typedef struct {
+  /** One deque for each worker, and one more the output stage
+      releases tasks onto. */
+  Deque *deques;
+
+  /** Number of workers. */
+  int workers;
+
+  /** Set when the output has stopped, so the workers can skip what's
+      left and quit once they run out. */
+  bool stop;
+
+  /** Protects the chunkCount and done fields the output stage waits
+      on, and the release counts below. */
+  pthread_mutex_t lock;
+
+  /** Signaled when a file is split or a chunk is done. */
+  pthread_cond_t changed;
+
+  /** Signaled when tasks are released or the output stops, to wake up
+      idle workers. */
+  pthread_cond_t work;
+
+  /** Bumped every time tasks are released, so an idle worker can tell
+      whether there's anything new since it last looked. */
+  long published;
+
+  /** Most files that can be released ahead of the one being written,
+      and most chunks that can be released but not yet written. */
+  int window;
+
+  /** Index of the file the output stage is writing. */
+  int writeFile;
+
+  /** Index of the next file task to release. */
+  int nextFile;
+
+  /** File and index of the next chunk task to release. */
+  int chunkFile, nextChunk;
+
+  /** Number of chunks released but not yet written. */
+  int inFlight;
+
+  /** One task for each input file. */
+  FileTask *files;
+
+  /** Number of input files. */
+  int fileCount;
+
+  /** Longest line to accept. */
+  int maxLine;
+
+  /** Number of bytes to try to put in each chunk. */
+  size_t chunkSize;
+
+  /** Matching function to call for each chunk, and its argument. */
+  BlockFunction fn;
+  void *arg;
+
+  /** True if matches should be colored. */
+  bool color;
+} Scheduler;
+
+/** What each worker thread is given when it starts. */
+typedef struct {
+  /** The shared scheduler. */
+  Scheduler *s;
+
+  /** Index of this worker's deque. */
+  int id;
+} WorkerStart;
+
+/**
+  Release as many file and chunk tasks as the window allows, in input
+  order, pushing them onto the given deque, and wake up idle workers
+  if there are any new ones.  The caller must hold the lock and own
+  the deque.
+
+  @param s the scheduler.
+  @param dq deque belonging to the calling thread.
+*/
+static void releaseTasks( Scheduler *s, Deque *dq )
+{
+  bool any = false;
+  while ( s->nextFile < s->fileCount &&
+          s->nextFile < s->writeFile + s->window ) {
+    pushDeque( dq, &s->files[ s->nextFile++ ] );
+    any = true;
+  }
+
+  // Chunks can only be released once their file has been split.
+  while ( s->inFlight < s->window && s->chunkFile < s->nextFile &&
+          s->files[ s->chunkFile ].chunkCount >= 0 ) {
+    FileTask *f = &s->files[ s->chunkFile ];
+    if ( s->nextChunk < f->chunkCount ) {
+      pushDeque( dq, &f->chunks[ s->nextChunk++ ] );
+      s->inFlight++;
+      any = true;
+    } else {
+      s->chunkFile++;
+      s->nextChunk = 0;
+    }
+  }
+
+  if ( any ) {
+    __atomic_add_fetch( &s->published, 1, __ATOMIC_RELEASE );
+    pthread_cond_broadcast( &s->work );
+  }
+}
+
+/**
+  Load a file and split it into chunks that end at line boundaries.
+  Whatever chunks the window allows go on this worker's deque, so
+  the worker starts on them while other workers steal.
+
+  @param s the scheduler.
+  @param id index of the worker doing this.
+  @param f the file to split.
+*/
+static void splitFile( Scheduler *s, int id, FileTask *f )
+{
+  int count = 0;
+  ChunkTask *chunks = NULL;
+
+  // There's no point loading the file if the output has already stopped.
+  if ( __atomic_load_n( &s->stop, __ATOMIC_RELAXED ) )
+    f->data.data = NULL;
+  else if ( loadFile( f->path, &f->data ) ) {
+    // Count the chunks first, so we can allocate them all at once.
+    for ( int pass = 0; pass < 2; pass++ ) {
+      count = 0;
+      size_t start = 0;
+      while ( start < f->data.len ) {
+        size_t end = start + s->chunkSize;
+        if ( end >= f->data.len )
+          end = f->data.len;
+        else {
+          char const *nl = findByte( f->data.data + end - 1,
+                                     f->data.len - end + 1, '\n' );
+          end = nl ? (size_t) ( nl - f->data.data ) + 1 : f->data.len;
+        }
+
+        if ( chunks ) {
+          ChunkTask *c = &chunks[ count ];
+          c->kind = CHUNK_TASK;
+          c->file = f;
+          c->start = start;
+          c->len = end - start;
+          c->out = makeOutput( NULL, s->color );
+          setOutputPrefix( c->out, f->prefix );
+          c->tooLong = false;
+          c->done = false;
+        }
+        count++;
+        start = end;
+      }
+
+      if ( !chunks )
+        chunks = (ChunkTask *) malloc( ( count ? count : 1 ) * sizeof( ChunkTask ) );
+    }
+  } else
+    fprintf( stderr, "Can't open input file: %s\n", f->path );
+
+  pthread_mutex_lock( &s->lock );
+  f->chunks = chunks;
+  f->chunkCount = count;
+  releaseTasks( s, &s->deques[ id ] );
+  pthread_cond_broadcast( &s->changed );
+  pthread_mutex_unlock( &s->lock );
+}
+
+/**
+  Match the lines in one chunk of a file.
+
+  @param s the scheduler.
+  @param ctx match context belonging to this worker.
+  @param c the chunk to match.
+*/
+static void matchChunk( Scheduler *s, MatchContext *ctx, ChunkTask *c )
+{
+  if ( !__atomic_load_n( &s->stop, __ATOMIC_RELAXED ) ) {
+    char const *data = c->file->data.data + c->start;
+    size_t len = checkLineLengths( data, c->len, s->maxLine );
+    c->tooLong = len < c->len;
+    s->fn( s->arg, ctx, data, len, c->out );
+  }
+
+  pthread_mutex_lock( &s->lock );
+  c->done = true;
+  pthread_cond_broadcast( &s->changed );
+  pthread_mutex_unlock( &s->lock );
+}
+
+/**
+  Look for a task on some other worker's deque.
+
+  @param s the scheduler.
+  @param id index of the worker that's looking.
+  @param seed state for picking victims at random.
+  @return a stolen task, or NULL if we didn't find one.
+*/
+static Task *stealTask( Scheduler *s, int id, unsigned *seed )
+{
+  // Start with a random victim, so thieves don't all pile on the same one.
+  *seed = *seed * 1103515245 + 12345;
+  int first = ( *seed >> 16 ) % ( s->workers + 1 );
+  for ( int i = 0; i <= s->workers; i++ ) {
+    int victim = ( first + i ) % ( s->workers + 1 );
+    if ( victim != id ) {
+      Task *t = (Task *) stealDeque( &s->deques[ victim ] );
+      if ( t )
+        return t;
+    }
+  }
+
+  return NULL;
+}
+
+/**
+  Start routine for a work-stealing worker.  It runs tasks from its
+  own deque and steals when that's empty.  When there's nothing to
+  steal either, it sleeps until more tasks are released, and quits
+  once the output has stopped.
+
+  @param p the WorkerStart for this thread.
+  @return NULL
+*/
+static void *stealingWorker( void *p )
+{
+  WorkerStart *w = (WorkerStart *) p;
+  Scheduler *s = w->s;
+  MatchContext *ctx = makeMatchContext();
+  unsigned seed = w->id + 1;
+
+  for ( ;; ) {
+    // Tasks are pushed before published is bumped, so if it hasn't
+    // changed by the time we wait, there was nothing we missed.
+    long seen = __atomic_load_n( &s->published, __ATOMIC_ACQUIRE );
+    Task *t = (Task *) popDeque( &s->deques[ w->id ] );
+    if ( !t )
+      t = stealTask( s, w->id, &seed );
+
+    if ( !t ) {
+      pthread_mutex_lock( &s->lock );
+      while ( s->published == seen && !s->stop )
+        pthread_cond_wait( &s->work, &s->lock );
+      bool quit = s->published == seen;
+      pthread_mutex_unlock( &s->lock );
+      if ( quit )
+        break;
+      continue;
+    }
+
+    if ( t->kind == FILE_TASK )
+      splitFile( s, w->id, (FileTask *) t );
+    else
+      matchChunk( s, ctx, (ChunkTask *) t );
+  }
+
+  freeMatchContext( ctx );
+  return NULL;
+}
+
+// Documented in the header.
+bool runFiles( FileList const *files, bool showNames, int threads,
+               int maxLine, size_t chunkSize, BlockFunction fn, void *arg,
+               Output *out )
+{
+  Scheduler s;
+  s.workers = threads;
+  s.deques = (Deque *) malloc( ( threads + 1 ) * sizeof( Deque ) );
+  for ( int i = 0; i <= threads; i++ )
+    initDeque( &s.deques[ i ] );
+  s.stop = false;
+  pthread_mutex_init( &s.lock, NULL );
+  pthread_cond_init( &s.changed, NULL );
+  pthread_cond_init( &s.work, NULL );
+  s.published = 0;
+  s.window = threads * SLOTS_PER_THREAD;
+  s.writeFile = s.nextFile = 0;
+  s.chunkFile = s.nextChunk = 0;
+  s.inFlight = 0;
+  s.maxLine = maxLine;
+  s.chunkSize = chunkSize;
+  s.fn = fn;
+  s.arg = arg;
+  s.color = out->color;
+
+  s.fileCount = files->count;
+  s.files = (FileTask *) malloc( ( s.fileCount ? s.fileCount : 1 ) *
+                                 sizeof( FileTask ) );
+  for ( int i = 0; i < s.fileCount; i++ ) {
+    FileTask *f = &s.files[ i ];
+    f->kind = FILE_TASK;
+    f->path = files->paths[ i ];
+    f->prefix = NULL;
+    if ( showNames ) {
+      f->prefix = (char *) malloc( strlen( f->path ) + 2 );
+      strcpy( f->prefix, f->path );
+      strcat( f->prefix, ":" );
+    }
+    f->data.data = NULL;
+    f->chunkCount = -1;
+    f->chunks = NULL;
+  }
+
+  // The last deque belongs to this thread.  The first few files go on
+  // it for the workers to steal, and more are released as they're
+  // written.
+  Deque *own = &s.deques[ threads ];
+  pthread_mutex_lock( &s.lock );
+  releaseTasks( &s, own );
+  pthread_mutex_unlock( &s.lock );
+
+  WorkerStart starts[ threads ];
+  pthread_t workers[ threads ];
+  for ( int i = 0; i < threads; i++ ) {
+    starts[ i ].s = &s;
+    starts[ i ].id = i;
+    pthread_create( &workers[ i ], NULL, stealingWorker, &starts[ i ] );
+  }
+
+  // This thread is the output stage.  It writes each chunk's report
+  // in order, waiting for it to finish if it has to.
+  bool tooLong = false;
+  for ( int i = 0; i < s.fileCount && !tooLong; i++ ) {
+    FileTask *f = &s.files[ i ];
+
+    pthread_mutex_lock( &s.lock );
+    s.writeFile = i;
+    releaseTasks( &s, own );
+    while ( f->chunkCount < 0 )
+      pthread_cond_wait( &s.changed, &s.lock );
+    for ( int j = 0; j < f->chunkCount && !tooLong; j++ ) {
+      ChunkTask *c = &f->chunks[ j ];
+      while ( !c->done )
+        pthread_cond_wait( &s.changed, &s.lock );
+      pthread_mutex_unlock( &s.lock );
+
+      appendOutput( out, c->out );
+      freeOutput( c->out );
+      c->out = NULL;
+      tooLong = c->tooLong;
+
+      pthread_mutex_lock( &s.lock );
+      s.inFlight--;
+      releaseTasks( &s, own );
+    }
+    pthread_mutex_unlock( &s.lock );
+
+    // Once all its chunks are written, we're done with the file.
+    if ( !tooLong && f->data.data )
+      unloadFile( &f->data );
+  }
+
+  // If we stopped early, the workers can skip anything that's left.
+  // Either way, idle workers need waking up so they can quit.
+  pthread_mutex_lock( &s.lock );
+  __atomic_store_n( &s.stop, true, __ATOMIC_RELAXED );
+  pthread_cond_broadcast( &s.work );
+  pthread_mutex_unlock( &s.lock );
+  for ( int i = 0; i < threads; i++ )
+    pthread_join( workers[ i ], NULL );
+
+  for ( int i = 0; i < s.fileCount; i++ ) {
+    FileTask *f = &s.files[ i ];
+    for ( int j = 0; j < f->chunkCount; j++ )
+      if ( f->chunks[ j ].out )
+        freeOutput( f->chunks[ j ].out );
+    free( f->chunks );
+    if ( f->data.data )
+      unloadFile( &f->data );
+    free( f->prefix );
+  }
+  free( s.files );
+  for ( int i = 0; i <= threads; i++ )
+    freeDeque( &s.deques[ i ] );
+  free( s.deques );
+  pthread_cond_destroy( &s.work );
+  pthread_cond_destroy( &s.changed );
+  pthread_mutex_destroy( &s.lock );
+
+  return !tooLong;
+}
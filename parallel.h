@@ -0,0 +1,67 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stddef.h>
+#include "context.h"
+#include "input.h"
+#include "output.h"
+#include "files.h"
+
+/**
+  Function that does the matching for one block of input lines,
+  adding whatever it reports to out.
+
+  @param arg extra argument passed through from runParallel().
+  @param ctx match context that belongs to the calling thread.
+  @param data block of whole input lines.
+  @param len number of bytes in data.
+  @param out writer to add the report for this block to.
+*/
+typedef void (*BlockFunction)( void *arg, MatchContext *ctx, char const *data,
+                               size_t len, Output *out );
+
+/**
+  Match all the input from a reader using a pool of worker threads.
+  The reader's blocks are handed out to the workers, each with its
+  own MatchContext, and the report for each block is written to out
+  in the same order the blocks were read, no matter which block
+  finishes first.  If the reader finds a line that's too long,
+  everything before it is still written before this returns.
+
+  @param r reader supplying the input.
+  @param threads number of worker threads to use.
+  @param fn function to call for each block.
+  @param arg extra argument to pass to fn.
+  @param out writer the reports are written to, in input order.
+  @return false if the input stopped at a line that was too long.
+*/
+bool runParallel( Reader *r, int threads, BlockFunction fn, void *arg,
+                  Output *out );
+
+/**
+  Match every file in a list using a pool of worker threads that
+  balance the load by stealing work from each other.  Each file is
+  split into chunks of whole lines, and each (file, chunk) pair is a
+  separate task, so one big file keeps every thread busy just as well
+  as many small ones do.  Reports are written to out in input order,
+  file by file and chunk by chunk.  Only a few files and chunks per
+  thread are let ahead of the output, so memory stays bounded however
+  slow the first file is.  If showNames is true, each output line
+  starts with the name of its file.  If a line is too long, everything
+  before it is still written before this returns.
+
+  @param files files to match.
+  @param showNames true if output lines should be prefixed with file names.
+  @param threads number of worker threads to use.
+  @param maxLine longest line to accept.
+  @param chunkSize number of bytes to try to put in each chunk.
+  @param fn function to call for each chunk.
+  @param arg extra argument to pass to fn.
+  @param out writer the reports are written to, in input order.
+  @return false if the input stopped at a line that was too long.
+*/
+bool runFiles( FileList const *files, bool showNames, int threads,
+               int maxLine, size_t chunkSize, BlockFunction fn, void *arg,
+               Output *out );
+
+#endif
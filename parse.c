@@ -11,6 +11,31 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+/** Largest count allowed in a counted repetition, like p{m,n}. */
+#define MAX_REPEAT 1000
+
+/** Initial capacity of the stack of open groups. */
+#define INITIAL_GROUPS 16
+
+/** Deepest nesting of groups and repetitions allowed.  The parser
+    doesn't care, but the passes after it recurse once for each level,
+    so this keeps them from running out of stack. */
+#define MAX_NESTING 20000
+
+/** A group that's still being parsed, either the whole pattern or one
+    in parentheses. */
+typedef struct {
+  /** Alternatives before the latest |, or NULL if there haven't been any. */
+  Pattern *alt;
+
+  /** Concatenation of everything since the latest | or the start of
+      the group, or NULL if there's nothing yet. */
+  Pattern *cat;
+
+  /** Deepest nesting of any item in the group so far. */
+  int nesting;
+} Group;
+
 /**
    Return true if  the given character is ordinary, if it should just
    match occurrences of itself.  This returns false for metacharacters
@@ -22,7 +47,7 @@
 static bool ordinary( char c )
 {
   // See if c is on our list of special characters.
-  if ( strchr( ".^$*?+|()[{", c ) )
+  if ( strchr( ".^$*?+|()[{\\", c ) )
     return false;
   return true;
 }
@@ -39,93 +64,152 @@ static void invalidPattern()
 
 /**
    Parse regular expression syntax with the highest precedence,
-   individual, ordinary symbols, start and end anchors, character
-   classes and patterns surrounded by parentheses.
+   individual, ordinary symbols, start and end anchors and character
+   classes.  Groups in parentheses are handled by parsePattern(), since
+   they can nest.
 
    @param str The string being parsed.
    @param pos A pass-by-reference value for the location in str being parsed,
               increased as characters from str are parsed.
-   @return a dynamically allocated representation of the pattern for the next
+   @param fold True if character classes should match letters in either case.
+   @param arena Arena to allocate the pattern from.
+   @return a representation of the pattern for the next
            portion of str.
 */
-static Pattern *parseAtomicPattern( char const *str, int *pos )
+static Pattern *parseAtomicPattern( char const *str, int *pos, bool fold,
+                                    Arena *arena )
 {
   if ( ordinary( str[ *pos ] ) )
-    return makeSymbolPattern( str[ (*pos)++ ] );
+    return makeSymbolPattern( arena, str[ (*pos)++ ] );
 
-  else{
-    while (str[ *pos ] && strchr( ".^$([", str[ *pos ])){
-      if ( str[ *pos] == '('){
-        int i = 0;
-        char subs[strlen(str)];
-        (*pos)++;
-        while (str[ *pos] != ')'){
-          subs[i] = str[*pos];
-          i++;
-          (*pos)++;
-        }
-        (*pos)++;
-        subs[i] = '\0';
-        return parsePattern(subs);
-      }
+  // A backslash makes the next character match itself.
+  if ( str[ *pos ] == '\\' ){
+    if ( !str[ *pos + 1 ] )
+      invalidPattern();
+    *pos += 2;
+    return makeEscapedPattern( arena, str[ *pos - 1 ] );
+  }
 
-      else if ( str[ *pos] == '['){
-        int i = 0;
-        char subs[strlen(str)];
-        (*pos)++;
-        while (str[ *pos] != ']'){
-          if (!str[*pos]){
-            invalidPattern();
-          }
-          subs[i] = str[*pos];
-          i++;
-          (*pos)++;
-        }
-        (*pos)++;
-        subs[i] = '\0';
-        char *p = (char *)malloc(sizeof(char) * (strlen(subs) + 1));
-        strcpy(p, subs);
-        return makeCharacterClassPattern(p);
+  if ( str[ *pos ] && strchr( ".^$", str[ *pos ] ) )
+    return makeSymbolPattern( arena, str[ (*pos)++ ] );
+
+  if ( str[ *pos ] == '[' ){
+    (*pos)++;
+    ByteSet set = { { 0, 0, 0, 0 } };
+
+    // A ^ at the start means the class matches everything else.
+    bool negate = false;
+    if ( str[ *pos ] == '^' ){
+      negate = true;
+      (*pos)++;
+    }
+
+    while (str[ *pos] != ']'){
+      if (!str[*pos]){
+        invalidPattern();
       }
 
-      else{
-        return makeSymbolPattern( str[ (*pos)++ ] );
+      // A - between two characters makes a range of them; anywhere
+      // else, it's just a -.
+      unsigned char lo = str[ (*pos)++ ];
+      unsigned char hi = lo;
+      if ( str[ *pos ] == '-' && str[ *pos + 1 ] && str[ *pos + 1 ] != ']' ){
+        hi = str[ *pos + 1 ];
+        *pos += 2;
+        if ( hi < lo )
+          invalidPattern();
       }
+      for ( int c = lo; c <= hi; c++ )
+        addToByteSet( &set, c );
+    }
+    (*pos)++;
+
+    // Fold case before negating, so [^a] doesn't match A either.
+    if ( fold )
+      foldByteSet( &set );
+
+    // Lines never contain a newline, so a negated class can't match one.
+    if ( negate ){
+      for ( int w = 0; w < 4; w++ )
+        set.words[ w ] = ~set.words[ w ];
+      set.words[ '\n' >> 6 ] &= ~( (uint64_t) 1 << ( '\n' & 63 ) );
     }
 
+    return makeCharacterClassPattern( arena, &set );
   }
 
   invalidPattern();
   return NULL; // Just to make the compiler happy :)
 }
 
+/**
+   Parse a count in a counted repetition.
+
+   @param str The string being parsed.
+   @param pos A pass-by-reference value for the location in str being parsed,
+              increased past the digits.
+   @return the count.
+*/
+static int parseCount( char const *str, int *pos )
+{
+  if ( str[ *pos ] < '0' || str[ *pos ] > '9' )
+    invalidPattern();
+
+  int n = 0;
+  while ( str[ *pos ] >= '0' && str[ *pos ] <= '9' ){
+    n = n * 10 + str[ (*pos)++ ] - '0';
+    if ( n > MAX_REPEAT )
+      invalidPattern();
+  }
+  return n;
+}
+
 /**
    Parse regular expression syntax with the second-highest precedence,
-   a pattern, p, optionally followed by one or more repetition syntax like '*' or '+'.
-   If there's no repetition syntax, it just returns the pattern object for p.
+   one or more repetition syntax like '*' or '+' after a pattern, p.
+   If there's no repetition syntax, it just returns p.
 
    @param str The string being parsed.
    @param pos A pass-by-reference value for the location in str being parsed,
               increased as characters from str are parsed.
-   @return a dynamically allocated representation of the pattern for the next
-           portion of str.
+   @param p The pattern the repetition syntax applies to.
+   @param nesting A pass-by-reference value for how deeply p is nested,
+                  increased for each repetition.
+   @param arena Arena to allocate the pattern from.
+   @return a representation of the pattern for p along with any
+           repetition after it.
 */
-static Pattern *parseRepetition( char const *str, int *pos )
+static Pattern *parseRepetition( char const *str, int *pos, Pattern *p,
+                                 int *nesting, Arena *arena )
 {
-  Pattern *p = parseAtomicPattern( str, pos );
-
-  while (str[ *pos ] && (str[ *pos ] == '*' || str[ *pos ] == '+' || str[ *pos ] == '?')){
+  while (str[ *pos ] && strchr( "*+?{", str[ *pos ] )){
+    if ( ++*nesting > MAX_NESTING )
+      invalidPattern();
     if (str[ *pos ] == '*'){
       (*pos)++;
-      p = makeAsteriskPattern(p);
+      p = makeAsteriskPattern( arena, p );
     }
     else if ( str[ *pos ] == '+' ){
       (*pos)++;
-      p = makePlusPattern(p);
+      p = makePlusPattern( arena, p );
     }
     else if (str[ *pos ] == '?'){
       (*pos)++;
-      p = makeOptionalPattern(p);
+      p = makeOptionalPattern( arena, p );
+    }
+    else {
+      // Counted repetition, p{m}, p{m,} or p{m,n}.
+      (*pos)++;
+      int min = parseCount( str, pos );
+      int max = min;
+      if ( str[ *pos ] == ',' ){
+        (*pos)++;
+        max = str[ *pos ] == '}' ? -1 : parseCount( str, pos );
+      }
+      if ( str[ *pos ] != '}' || ( max >= 0 && max < min ) )
+        invalidPattern();
+      (*pos)++;
+      p = makeCountedPattern( arena, p, min, max );
     }
   }
 
@@ -133,66 +217,83 @@ static Pattern *parseRepetition( char const *str, int *pos )
 }
 
 /**
-   Parse regular expression syntax with the third-highest precedence,
-   one pattern, p, (optionally) followed by additional patterns
-   (concatenation).  If there are no additional patterns, it just
-   returns the pattern object for p.
+   Add the concatenation since the last | to the alternatives of a
+   group.  It's an error for it to be empty.
 
-   @param str The string being parsed.
-   @param pos A pass-by-reference value for the location in str being parsed,
-              increased as characters from str are parsed.
-   @return a dynamically allocated representation of the pattern for the next
-           portion of str.
+   @param g The group to add to.
+   @param arena Arena to allocate the pattern from.
 */
-static Pattern *parseConcatenation( char const *str, int *pos )
+static void endAlternative( Group *g, Arena *arena )
 {
-  // Parse the first pattern
-  Pattern *p1 = parseRepetition( str, pos );
-  // While there are additional patterns, parse them
-  while ( str[ *pos ] && str[ *pos ] != '|' && str[ *pos ] != ')' ) {
-    Pattern *p2 = parseRepetition( str, pos );
-    // And build a concatenation pattern to match the sequence.
-    p1 = makeConcatenationPattern( p1, p2 );
-  }
-
-  return p1;
+  if ( !g->cat )
+    invalidPattern();
+  g->alt = g->alt ? makeAlterationPattern( arena, g->alt, g->cat ) : g->cat;
+  g->cat = NULL;
 }
 
-/**
-   Parse regular expression syntax with the lowest precedence, one
-   pattern, p, (optionally) followed by additional patterns separated
-   by | (alternation).  If there are no additional patterns, it just
-   returns the pattern object for p.
-
-   @param str The string being parsed.
-   @param pos A pass-by-reference value for the location in str being
-              parsed, increased as characters from str are parsed.
-   @return a dynamically allocated representation of the pattern for
-   the next portion of str.
-*/
-static Pattern *parseAlternation( char const *str, int *pos )
+// Documented in the header
+Pattern *parsePattern( char const *str, bool fold, Arena *arena )
 {
-  Pattern *p1 = parseConcatenation( str, pos );
+  // The whole pattern is the bottom group, with one more on top for
+  // every ( that's still open.  Everything is built left to right in a
+  // single pass, however deeply the groups nest.
+  int cap = INITIAL_GROUPS;
+  Group *groups = (Group *) checkedMalloc( cap * sizeof( Group ) );
+  int depth = 1;
+  groups[ 0 ].alt = groups[ 0 ].cat = NULL;
+  groups[ 0 ].nesting = 0;
 
-  while (str[*pos] && str[*pos] == '|'){
-    (*pos)++;
-    Pattern *p2 = parseConcatenation( str, pos );
-    p1 = makeAlterationPattern(p1, p2);
-  }
+  int pos = 0;
+  while ( str[ pos ] ){
+    if ( str[ pos ] == '(' ){
+      pos++;
+      if ( depth >= cap ){
+        cap *= 2;
+        groups = (Group *) checkedRealloc( groups, cap * sizeof( Group ) );
+      }
+      groups[ depth ].alt = groups[ depth ].cat = NULL;
+      groups[ depth ].nesting = 0;
+      depth++;
+      continue;
+    }
 
-  return p1;
-}
+    if ( str[ pos ] == '|' ){
+      pos++;
+      endAlternative( groups + depth - 1, arena );
+      continue;
+    }
 
-// Documented in the header
-Pattern *parsePattern( char const *str )
-{
-  // Parse the argument into a tree of pattern objects.
-  int pos = 0;
-  Pattern *pat = parseAlternation( str, &pos );
+    // Anything else is one item of a concatenation: a whole group
+    // that just closed, or an atomic pattern.
+    Pattern *item;
+    int nesting = 0;
+    if ( str[ pos ] == ')' ){
+      if ( depth == 1 )
+        invalidPattern();
+      pos++;
+      depth--;
+      endAlternative( groups + depth, arena );
+      item = groups[ depth ].alt;
+      nesting = groups[ depth ].nesting + 1;
+      if ( nesting > MAX_NESTING )
+        invalidPattern();
+    }
+    else
+      item = parseAtomicPattern( str, &pos, fold, arena );
+    item = parseRepetition( str, &pos, item, &nesting, arena );
+
+    Group *g = groups + depth - 1;
+    if ( nesting > g->nesting )
+      g->nesting = nesting;
+    g->cat = g->cat ? makeConcatenationPattern( arena, g->cat, item ) : item;
+  }
 
-  // Complain if this didn't consume the whole pattern.
-  if ( str[ pos ] )
+  // Complain about any group that never got closed.
+  if ( depth > 1 )
     invalidPattern();
+  endAlternative( groups, arena );
 
+  Pattern *pat = groups[ 0 ].alt;
+  free( groups );
   return pat;
 }
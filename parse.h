@@ -6,8 +6,13 @@
 /** Parse the given string into Pattern object.
     
     @param str string cntaining a pattern.
+    @param fold true if letters should match in either case.  Only
+                character classes are folded here, before any ^
+                negates them; the rest of the pattern is folded when
+                it's compiled.
+    @param arena arena to allocate the pattern from.
     @return pointer to a representation of the pattern.
 ***/
-Pattern *parsePattern( char const *str );
+Pattern *parsePattern( char const *str, bool fold, Arena *arena );
 
 #endif
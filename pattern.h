@@ -2,6 +2,53 @@
 #define PATTERN_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "arena.h"
+
+/** A set of byte values, stored as a 256-bit bitmap. */
+typedef struct {
+  /** One bit for each byte value, 64 to a word. */
+  uint64_t words[ 4 ];
+} ByteSet;
+
+/**
+  Report whether a byte is in a set.
+
+  @param set set to check.
+  @param c byte to look for.
+  @return true if c is in the set.
+*/
+static inline bool inByteSet( ByteSet const *set, unsigned char c )
+{
+  return ( set->words[ c >> 6 ] >> ( c & 63 ) ) & 1;
+}
+
+/**
+  Add a byte to a set.
+
+  @param set set to add to.
+  @param c byte to add.
+*/
+static inline void addToByteSet( ByteSet *set, unsigned char c )
+{
+  set->words[ c >> 6 ] |= (uint64_t) 1 << ( c & 63 );
+}
+
+/**
+  Widen a set so it matches ASCII letters in either case: if it has
+  either case of a letter, it gets both.
+
+  @param set set to widen.
+*/
+static inline void foldByteSet( ByteSet *set )
+{
+  for ( int c = 'a'; c <= 'z'; c++ )
+    if ( inByteSet( set, c ) || inByteSet( set, c - 'a' + 'A' ) ) {
+      addToByteSet( set, c );
+      addToByteSet( set, c - 'a' + 'A' );
+    }
+}
 
 //////////////////////////////////////////////////////////////////////
 // Superclass for Patterns
@@ -9,74 +56,162 @@
 /** A short name to use for the Pattern interface. */
 typedef struct PatternStruct Pattern;
 
+/** The kinds of pattern, so code outside the pattern's own methods
+    (like the program compiler) can tell them apart. */
+typedef enum {
+  SYMBOL_PATTERN,          ///< An ordinary symbol, in a SymbolPattern.
+  LITERAL_PATTERN,         ///< A run of ordinary symbols, in a LiteralPattern.
+  ANY_PATTERN,             ///< The . symbol, in a SymbolPattern.
+  START_PATTERN,           ///< The ^ anchor, in a SymbolPattern.
+  END_PATTERN,             ///< The $ anchor, in a SymbolPattern.
+  TAG_PATTERN,             ///< End of one of several patterns, in a TagPattern.
+  CONCATENATION_PATTERN,   ///< Two patterns in a row, in a BinaryPattern.
+  ALTERNATION_PATTERN,     ///< Either of two patterns, in a BinaryPattern.
+  OPTIONAL_PATTERN,        ///< p?, in a RepetitionPattern.
+  ASTERISK_PATTERN,        ///< p*, in a RepetitionPattern.
+  PLUS_PATTERN,            ///< p+, in a RepetitionPattern.
+  COUNTED_PATTERN,         ///< p{m,n}, in a CountedPattern.
+  CHARACTER_CLASS_PATTERN  ///< [...], in a CharacterClassPattern.
+} PatternKind;
+
 /**
   Structure used as a superclass/interface for a regular expression
-  pattern.  It includes a representation for a resizable 2D table
-  where we can record regions (substrings) of an input string that are
-  matched by the pattern.  There's a function pointer for an
-  overridable method, locate(), that uses the table to mark all the
-  places where the pattern matches the input string, and another
-  overridable method for freeing resources for the pattern.
+  pattern.  The kind tells what struct a pattern really is.  The tree
+  is just the parser's output; it's compiled into a program before
+  anything is matched.  Every node of a pattern is allocated from the
+  same arena, so the whole tree is freed at once by freeing the arena.
 */
 struct PatternStruct {
-  /** Length of the current input string, as recorded by the latest call
-      to locate(). */
+  /** What kind of pattern this is, which tells what struct it really is. */
+  PatternKind kind;
+};
+
+/**
+   Type of pattern used to represent a single, ordinary symbol,
+   like 'a' or '5', or one of the single-character special symbols
+   '.', '^' and '$'.
+*/
+typedef struct {
+  // Fields from our superclass.
+  PatternKind kind;
+
+  /** Symbol this pattern is supposed to match. */
+  char sym;
+} SymbolPattern;
+
+/**
+   Type of pattern used for a run of ordinary symbols that have to match
+   one after another, like "abc".  The parser doesn't make these; they
+   come from simplifying a concatenation of symbols.
+*/
+typedef struct {
+  // Fields from our superclass.
+  PatternKind kind;
+
+  /** Symbols this pattern is supposed to match, in order. */
+  char *str;
+
+  /** Number of symbols in str. */
   int len;
+} LiteralPattern;
 
-  /** The match table, a (len + 1) X (len + 1) 2D array represented as
-      an array of pointers to arrays.  The job of the locate() functon
-      is to fill in this table so table[ begin ][ end ] is true if
-      this pattern can match the [ begin, end ) substring of the
-      current input string.  */
-  bool **table;
-
-  /** Relallocate the match table.  Find all the [ begin, end )
-      substrings of input string, str, that match the pattern.  For
-      any match, set table[ begin ][ end ] to true in the match
-      table.
-
-      @param pat pointer to the pattern being matched (essentially, a this
-                 pointer.
-      @param str input string in which we're finding matches.
-  */
-  void (*locate)( Pattern *pat, char const *str );
-
-  /** Free memory for this pattern, including any subpatterns it contains.
-      @param pat pattern to free.
-  */
-  void (*destroy)( Pattern *pat );
-};
+/**
+   Representation for a type of pattern that contains two sub-patterns
+   (e.g., concatenation).  This representation could be used by more
+   than one type of pattern, as long as it has a different kind.
+*/
+typedef struct {
+  // Fields from our superclass.
+  PatternKind kind;
 
-/** Report elements of the match table for the given pattern.  This
-    can be called after the pattern's locate() function, to see where
-    it found a match.  It's like a non-overridable instance method for
-    the Pattern object.
-
-    @param pat pointer to the pattern for which we want to check
-               reported matches.
-    @param begin index of the first character in the substring
-    @param end index one-past-the-end of the string
-    @return true if this pattern matches the [ begin, end ) substring
-            of the most recent input string
- */
-bool matches( Pattern *pat, int begin, int end );
+  // Pointers to the two sub-patterns.
+  Pattern *p1, *p2;
+} BinaryPattern;
+
+/**
+   Type of pattern used for repititons
+*/
+typedef struct {
+  // Fields from our superclass.
+  PatternKind kind;
+
+  /** pattern this repetition is supposed to match  */
+  Pattern *sym;
+} RepetitionPattern;
+
+/**
+   Type of pattern used for counted repetitions, like p{m,n}.  The
+   sub-pattern is only stored once, no matter how many times it has to
+   repeat.
+*/
+typedef struct {
+  // Fields from our superclass.
+  PatternKind kind;
+
+  /** pattern this repetition is supposed to match  */
+  Pattern *sym;
+
+  /** fewest repetitions that match */
+  int min;
+
+  /** most repetitions that match, or -1 for no limit */
+  int max;
+} CountedPattern;
+
+/**
+   Type of pattern that matches the empty string at the end of one of
+   several patterns that are matched together, so the automaton can
+   tell which of them matched.
+*/
+typedef struct {
+  // Fields from our superclass.
+  PatternKind kind;
+
+  /** Number of the pattern this ends, counting from zero. */
+  int tag;
+} TagPattern;
+
+/**
+   Type of pattern used to match a character class for multiple characters
+*/
+typedef struct {
+  // Fields from our superclass.
+  PatternKind kind;
+
+  /** bytes this class matches */
+  ByteSet set;
+} CharacterClassPattern;
 
 /**
   Make a pattern for a single, non-special character, like `a` or `5`.
 
+  @param arena Arena to allocate the pattern from.
   @param sym The symbol this pattern is supposed to match.
-  @return A dynamically allocated representation for this new pattern.
+  @return A representation for this new pattern, allocated from arena.
 */
-Pattern *makeSymbolPattern( char sym );
+Pattern *makeSymbolPattern( Arena *arena, char sym );
 
 /**
- * Make a pattern for a singe . regex symbol, where
- * any character can match with an individual . in a pattern
- *
- * @param the character symbol '.'
- * @return A synamically allocated pattern for the . pattern
- */
-Pattern *makeSymbolPatternPeriod( char sym );
+  Make a pattern for a character that was escaped with a backslash.  It
+  matches just that character, even one like '.' that's normally special.
+
+  @param arena Arena to allocate the pattern from.
+  @param sym The symbol this pattern is supposed to match.
+  @return A representation for this new pattern, allocated from arena.
+*/
+Pattern *makeEscapedPattern( Arena *arena, char sym );
+
+/**
+  Make a pattern for a run of ordinary characters that match one after
+  another.
+
+  @param arena Arena to allocate the pattern from.
+  @param str The symbols this pattern is supposed to match; they're
+             copied into the pattern.
+  @param len Number of symbols in str.
+  @return A representation for this new pattern, allocated from arena.
+*/
+Pattern *makeLiteralPattern( Arena *arena, char const *str, int len );
 
 /**
   Make a pattern for the concatenation of patterns p1 and p2.  It
@@ -84,59 +219,88 @@ Pattern *makeSymbolPatternPeriod( char sym );
   s2, where the p1 matches the first part (s1) and p2 matches the
   second part (s2).
 
+  @param arena Arena to allocate the pattern from.
   @param p1 Subpattern for matching the first part of the string.
   @param p2 Subpattern for matching the second part of the string.
-  @return A dynamically allocated representation for this new pattern.
+  @return A representation for this new pattern, allocated from arena.
 */
-Pattern *makeConcatenationPattern( Pattern *p1, Pattern *p2 );
+Pattern *makeConcatenationPattern( Arena *arena, Pattern *p1, Pattern *p2 );
 
 /**
  * Makes an alteration pattern based off the binary structure, where
  * a string can match with either p1 or p2 first represented as p1|p2
  *
+ * @param arena arena to allocate the pattern from
  * @param p1 pattern
  * @param p2 pattern
- * @return the dyamically allocated alteration pattern representation
+ * @return the alteration pattern representation, allocated from arena
  */
-Pattern *makeAlterationPattern( Pattern *p1, Pattern *p2 );
+Pattern *makeAlterationPattern( Arena *arena, Pattern *p1, Pattern *p2 );
 
 /**
  * Makes an optinal symbol pattern based off the repetion pattern struct
  * where a symbol can optionally match in a string
  *
+ * @param arena arena to allocate the pattern from
  * @param p1 pattern that is optional
- * @return the dynamically allocated optional pattern representation
+ * @return the optional pattern representation, allocated from arena
  */
-Pattern *makeOptionalPattern( Pattern *p1 );
+Pattern *makeOptionalPattern( Arena *arena, Pattern *p1 );
 
 /**
  * Makes a pattern symbol for the asterisk regex symbol, which marks a pattern
  * as something that can be matched either zero or many times in a string represented
  * for a pattern p as: p*
  *
+ * @param arena arena to allocate the pattern from
  * @param pat pattern to apply to the asterisk
- * @return the dynamically allocated asterisk pattern
+ * @return the asterisk pattern, allocated from arena
  */
-Pattern *makeAsteriskPattern( Pattern *pat );
+Pattern *makeAsteriskPattern( Arena *arena, Pattern *pat );
+
+/**
+ * Makes a pattern for counted repetition, which matches anywhere from
+ * min to max repetitions of a pattern, written p{m}, p{m,} or p{m,n}.
+ *
+ * @param arena arena to allocate the pattern from
+ * @param pat pattern to repeat
+ * @param min fewest repetitions
+ * @param max most repetitions, or -1 for no limit
+ * @return the counted pattern, allocated from arena
+ */
+Pattern *makeCountedPattern( Arena *arena, Pattern *pat, int min, int max );
 
 /**
  * Makes a pattern symbol using the repetition struct for the plus regex symbol,
  * which marks a pattern as something that can be matched one or more times in
  * a stirng represented for the pattern p as: p+
  *
+ * @param arena arena to allocate the pattern from
  * @param pat pattern to apply to the plus
- * @return the dynamically allocated plus pattern
+ * @return the plus pattern, allocated from arena
+ */
+Pattern *makePlusPattern( Arena *arena, Pattern *pat );
+
+/**
+ * Makes a tag pattern, which matches the empty string and marks the end
+ * of one pattern out of several joined in an alternation.  It has to be
+ * the last thing in that pattern.
+ *
+ * @param arena arena to allocate the pattern from
+ * @param tag number of the pattern, counting from zero
+ * @return the tag pattern, allocated from arena
  */
-Pattern *makePlusPattern( Pattern *pat );
+Pattern *makeTagPattern( Arena *arena, int tag );
 
 /**
- * Makes a character class pattern, which takes in a string of characters between
- * brackets, and matches any character in a string that appears in the brackets.
- * This is made using it's own custom structure, build to handle the string pointer
+ * Makes a character class pattern, which matches any one byte in the
+ * given set.  The parser builds the set from the brackets, with any
+ * ranges and negation already worked out.
  *
- * @param sym string
- * @return the dynamically allocated character class pattern
+ * @param arena arena to allocate the pattern from
+ * @param set bytes the class matches; it's copied into the pattern
+ * @return the character class pattern, allocated from arena
  */
-Pattern *makeCharacterClassPattern( char *sym );
+Pattern *makeCharacterClassPattern( Arena *arena, ByteSet const *set );
 
 #endif
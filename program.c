@@ -0,0 +1,587 @@
+/**
+ * @file program.c
+ * @author sdcroche
+ *
+ * Program compiles a pattern tree into a flat array of steps and runs
+ * them to fill in match tables.  The interpreter is a single loop over
+ * the steps with a stack of tables, so there's no pointer chasing or
+ * indirect call for each node of the tree.
+ */
+#include "program.h"
+#include "scan.h"
+#include "stats.h"
+#include <stdlib.h>
+#include <string.h>
+
+/** Initial capacity for the arrays built while compiling. */
+#define INITIAL_CAP 16
+
+/** A pattern node waiting on the stack used to walk the tree. */
+typedef struct {
+  /** The pattern. */
+  Pattern const *pat;
+
+  /** Index of its first step once its operands have been pushed, or
+      -1 if they haven't been yet. */
+  int first;
+} Visit;
+
+/** Growable arrays for a program while it's being compiled. */
+typedef struct {
+  /** Steps so far. */
+  Step *steps;
+
+  /** Number of steps. */
+  int count;
+
+  /** Capacity of steps. */
+  int cap;
+
+  /** Byte sets so far. */
+  ByteSet *sets;
+
+  /** Number of byte sets. */
+  int setCount;
+
+  /** Capacity of sets. */
+  int setCap;
+
+  /** Literal bytes so far. */
+  char *text;
+
+  /** Number of literal bytes. */
+  int textLen;
+
+  /** Capacity of text. */
+  int textCap;
+
+  /** True if letters should match in either case. */
+  bool fold;
+} Builder;
+
+/**
+  Add a step to the end of the program being built.
+
+  @param b builder to add to.
+  @param op operation for the step.
+  @param first index of the first step of its operands.
+  @return the new step, with its other fields cleared.
+*/
+static Step *addStep( Builder *b, StepOp op, int first )
+{
+  if ( b->count >= b->cap ) {
+    b->cap *= 2;
+    b->steps = (Step *) checkedRealloc( b->steps, b->cap * sizeof( Step ) );
+  }
+  Step *s = b->steps + b->count++;
+  s->op = op;
+  s->arg = 0;
+  s->len = 0;
+  s->min = 0;
+  s->max = 0;
+  s->first = first;
+  return s;
+}
+
+/**
+  Add a BYTE_STEP for a byte set to the end of the program being built.
+  If we're folding case, the step's set gets letters in both cases.
+
+  @param b builder to add to.
+  @param set bytes the step matches; it's copied.
+*/
+static void addByteStep( Builder *b, ByteSet const *set )
+{
+  if ( b->setCount >= b->setCap ) {
+    b->setCap *= 2;
+    b->sets = (ByteSet *) checkedRealloc( b->sets,
+                                          b->setCap * sizeof( ByteSet ) );
+  }
+  b->sets[ b->setCount ] = *set;
+  if ( b->fold )
+    foldByteSet( b->sets + b->setCount );
+  addStep( b, BYTE_STEP, b->count )->arg = b->setCount++;
+}
+
+/**
+  Add a LITERAL_STEP to the end of the program being built.  If we're
+  folding case, its text is stored in lower case.
+
+  @param b builder to add to.
+  @param str bytes the step matches; they're copied.
+  @param len number of bytes in str.
+*/
+static void addLiteralStep( Builder *b, char const *str, int len )
+{
+  while ( b->textLen + len > b->textCap ) {
+    b->textCap *= 2;
+    b->text = (char *) checkedRealloc( b->text, b->textCap );
+  }
+  memcpy( b->text + b->textLen, str, len );
+  if ( b->fold )
+    for ( int k = 0; k < len; k++ )
+      b->text[ b->textLen + k ] = foldByte( str[ k ] );
+
+  Step *s = addStep( b, LITERAL_STEP, b->count );
+  s->arg = b->textLen;
+  s->len = len;
+  b->textLen += len;
+}
+
+/**
+  Add the step for one pattern node, once the steps for its operands
+  are already there.
+
+  @param b builder to add to.
+  @param pat pattern node to add a step for.
+  @param first index of the first step of its operands.
+*/
+static void addPattern( Builder *b, Pattern const *pat, int first )
+{
+  switch ( pat->kind ) {
+  case SYMBOL_PATTERN: {
+    ByteSet set = { { 0, 0, 0, 0 } };
+    addToByteSet( &set, ( (SymbolPattern const *) pat )->sym );
+    addByteStep( b, &set );
+    break;
+  }
+  case ANY_PATTERN: {
+    // Any byte but the newline, which is never part of a line.
+    ByteSet set = { { 0, 0, 0, 0 } };
+    for ( int c = 0; c < 256; c++ )
+      if ( c != '\n' )
+        addToByteSet( &set, c );
+    addByteStep( b, &set );
+    break;
+  }
+  case CHARACTER_CLASS_PATTERN:
+    addByteStep( b, &( (CharacterClassPattern const *) pat )->set );
+    break;
+  case LITERAL_PATTERN: {
+    LiteralPattern const *this = (LiteralPattern const *) pat;
+    addLiteralStep( b, this->str, this->len );
+    break;
+  }
+  case START_PATTERN:
+    addStep( b, START_STEP, first );
+    break;
+  case END_PATTERN:
+    addStep( b, END_STEP, first );
+    break;
+  case TAG_PATTERN:
+    addStep( b, TAG_STEP, first )->arg = ( (TagPattern const *) pat )->tag;
+    break;
+  case CONCATENATION_PATTERN:
+    addStep( b, CONCAT_STEP, first );
+    break;
+  case ALTERNATION_PATTERN:
+    addStep( b, ALTERNATE_STEP, first );
+    break;
+  case OPTIONAL_PATTERN:
+    addStep( b, OPTIONAL_STEP, first );
+    break;
+  case ASTERISK_PATTERN:
+    addStep( b, STAR_STEP, first );
+    break;
+  case PLUS_PATTERN:
+    addStep( b, PLUS_STEP, first );
+    break;
+  case COUNTED_PATTERN: {
+    CountedPattern const *this = (CountedPattern const *) pat;
+    Step *s = addStep( b, COUNT_STEP, first );
+    s->min = this->min;
+    s->max = this->max;
+    break;
+  }
+  }
+}
+
+/**
+  Push a pattern node on the stack used to walk the tree.
+
+  @param stack pointer to the stack array, which may be moved.
+  @param top number of entries on the stack.
+  @param cap pointer to the capacity of the stack.
+  @param pat pattern to push.
+*/
+static void pushVisit( Visit **stack, int top, int *cap, Pattern const *pat )
+{
+  if ( top >= *cap ) {
+    *cap *= 2;
+    *stack = (Visit *) checkedRealloc( *stack, *cap * sizeof( Visit ) );
+  }
+  (*stack)[ top ].pat = pat;
+  (*stack)[ top ].first = -1;
+}
+
+// Documented in the header.
+Program *compileProgram( Pattern const *pat, bool fold, Arena *arena )
+{
+  Builder b;
+  b.fold = fold;
+  b.count = 0;
+  b.cap = INITIAL_CAP;
+  b.steps = (Step *) checkedMalloc( b.cap * sizeof( Step ) );
+  b.setCount = 0;
+  b.setCap = INITIAL_CAP;
+  b.sets = (ByteSet *) checkedMalloc( b.setCap * sizeof( ByteSet ) );
+  b.textLen = 0;
+  b.textCap = INITIAL_CAP;
+  b.text = (char *) checkedMalloc( b.textCap );
+
+  // Walk the tree in postfix order with our own stack, since a chain
+  // of concatenations can be very deep.  Each node stays on the stack
+  // until its operands are done.
+  int cap = INITIAL_CAP;
+  Visit *stack = (Visit *) checkedMalloc( cap * sizeof( Visit ) );
+  int top = 0;
+  pushVisit( &stack, top++, &cap, pat );
+
+  int height = 0, depth = 0;
+  while ( top ) {
+    Visit *v = stack + top - 1;
+    Pattern const *p = v->pat;
+    if ( v->first < 0 ) {
+      v->first = b.count;
+      if ( p->kind == CONCATENATION_PATTERN ||
+           p->kind == ALTERNATION_PATTERN ) {
+        BinaryPattern const *this = (BinaryPattern const *) p;
+        pushVisit( &stack, top++, &cap, this->p2 );
+        pushVisit( &stack, top++, &cap, this->p1 );
+        continue;
+      }
+      if ( p->kind == OPTIONAL_PATTERN || p->kind == ASTERISK_PATTERN ||
+           p->kind == PLUS_PATTERN ) {
+        pushVisit( &stack, top++, &cap, ( (RepetitionPattern const *) p )->sym );
+        continue;
+      }
+      if ( p->kind == COUNTED_PATTERN ) {
+        pushVisit( &stack, top++, &cap, ( (CountedPattern const *) p )->sym );
+        continue;
+      }
+    }
+
+    // Operands are done, so this node's step goes next.
+    addPattern( &b, p, v->first );
+    top--;
+
+    // Keep track of how many tables running it would need.
+    if ( p->kind == CONCATENATION_PATTERN || p->kind == ALTERNATION_PATTERN )
+      height--;
+    else if ( b.steps[ b.count - 1 ].first == b.count - 1 )
+      height++;
+    if ( height > depth )
+      depth = height;
+  }
+  free( stack );
+
+  // Move everything into the arena, now that we know how big it is.
+  Program *prog = (Program *) allocArena( arena, sizeof( Program ) );
+  prog->count = b.count;
+  prog->steps = (Step *) allocArena( arena, b.count * sizeof( Step ) );
+  memcpy( prog->steps, b.steps, b.count * sizeof( Step ) );
+  prog->setCount = b.setCount;
+  prog->sets = (ByteSet *) allocArena( arena, b.setCount * sizeof( ByteSet ) );
+  memcpy( prog->sets, b.sets, b.setCount * sizeof( ByteSet ) );
+  prog->textLen = b.textLen;
+  prog->text = (char *) allocArena( arena, b.textLen );
+  memcpy( prog->text, b.text, b.textLen );
+  prog->depth = depth;
+  prog->fold = fold;
+
+  free( b.steps );
+  free( b.sets );
+  free( b.text );
+  return prog;
+}
+
+/** Return the index of the [ begin, end ) cell in a match table for
+    the current input string.
+
+    @param ctx The context we're matching with.
+    @param begin index of the first character in the substring.
+    @param end index one-past-the-end of the substring.
+    @return index of the cell for this substring.
+*/
+static int at( MatchContext const *ctx, int begin, int end )
+{
+  return begin * ( ctx->len + 1 ) + end;
+}
+
+// Documented in the header.
+bool matches( MatchContext const *ctx, int begin, int end )
+{
+  return ctx->result[ at( ctx, begin, end ) ];
+}
+
+/** Report whether the work on the current input string has gone past
+    its budget.  The loops that can take a long time check this as
+    they go, so they stop soon after it runs out.
+
+    @param ctx The context we're matching with.
+    @return true if there's a budget and it's used up.
+*/
+static bool overBudget( MatchContext const *ctx )
+{
+  return ctx->budget && ctx->work > ctx->budget;
+}
+
+/**
+ * Fill in a new table with the concatenation of two others.  The
+ * [ begin, end ) substring matches if it can be split at some k with
+ * [ begin, k ) matching the first table and [ k, end ) the second.
+ *
+ * @param ctx context holding the match state for this input
+ * @param t1 table for the first part
+ * @param t2 table for the second part
+ * @return table for the concatenation
+ */
+static bool *compose( MatchContext *ctx, bool const *t1, bool const *t2 )
+{
+  bool *table = acquireTable( ctx );
+
+  for ( int begin = 0; begin <= ctx->len && !overBudget( ctx ); begin++ ) {
+    ctx->work += ctx->len + 1 - begin;
+    for ( int k = begin; k <= ctx->len; k++ )
+      if ( t1[ at( ctx, begin, k ) ] ) {
+        ctx->work += ctx->len + 1 - k;
+        for ( int end = k; end <= ctx->len; end++ )
+          if ( t2[ at( ctx, k, end ) ] )
+            table[ at( ctx, begin, end ) ] = true;
+      }
+  }
+
+  return table;
+}
+
+/**
+ * Fill in a table with one or more repetitions of a sub-pattern.
+ * The [ begin, end ) substring matches if the sub-pattern matches
+ * [ begin, k ) and then one or more repetitions match [ k, end ).
+ * Working backward from the end of the string means the table is
+ * already filled in for every k after begin.
+ *
+ * @param ctx context holding the match state for this input
+ * @param sub match table for the sub-pattern
+ * @param table table to fill in
+ */
+static void repeat( MatchContext *ctx, bool const *sub, bool *table )
+{
+  for ( int begin = ctx->len; begin >= 0 && !overBudget( ctx ); begin-- )
+    for ( int end = begin; end <= ctx->len; end++ ) {
+      ctx->work += end - begin + 1;
+      if ( sub[ at( ctx, begin, end ) ] )
+        table[ at( ctx, begin, end ) ] = true;
+      for ( int k = begin + 1; k < end && !table[ at( ctx, begin, end ) ]; k++ )
+        if ( sub[ at( ctx, begin, k ) ] && table[ at( ctx, k, end ) ] )
+          table[ at( ctx, begin, end ) ] = true;
+    }
+}
+
+/**
+ * Mark the empty string everywhere in a table.
+ *
+ * @param ctx context holding the match state for this input
+ * @param table table to fill in
+ */
+static void addEmpty( MatchContext *ctx, bool *table )
+{
+  for ( int begin = 0; begin <= ctx->len; begin++ )
+    table[ at( ctx, begin, begin ) ] = true;
+}
+
+/**
+ * Fill in a new table for n repetitions of a sub-pattern, by repeated
+ * squaring, so it only takes about log n concatenations.
+ *
+ * @param ctx context holding the match state for this input
+ * @param base match table for one repetition
+ * @param n number of repetitions
+ * @return table for n repetitions in a row
+ */
+static bool *power( MatchContext *ctx, bool const *base, int n )
+{
+  // Zero repetitions match the empty string everywhere.
+  bool *result = acquireTable( ctx );
+  addEmpty( ctx, result );
+
+  // Concatenating the base with no repetitions is just a copy of it.
+  bool *square = compose( ctx, base, result );
+  while ( n ) {
+    if ( n & 1 ) {
+      bool *next = compose( ctx, result, square );
+      releaseTable( ctx, result );
+      result = next;
+    }
+    n >>= 1;
+    if ( n ) {
+      bool *next = compose( ctx, square, square );
+      releaseTable( ctx, square );
+      square = next;
+    }
+  }
+
+  releaseTable( ctx, square );
+  return result;
+}
+
+/**
+ * Fill in a new table for a counted repetition.  This is min
+ * repetitions of the sub-pattern followed by up to max - min optional
+ * ones (or any number, with no max).  A line of length len can't tell
+ * apart more than len + 1 repetitions, since past that some of them
+ * have to match the empty string, so the counts are capped there.
+ *
+ * @param ctx context holding the match state for this input
+ * @param sub match table for the sub-pattern
+ * @param min fewest repetitions
+ * @param max most repetitions, or -1 for no limit
+ * @return table for the repetition
+ */
+static bool *count( MatchContext *ctx, bool const *sub, int min, int max )
+{
+  int limit = ctx->len + 1;
+  bool *head = power( ctx, sub, min < limit ? min : limit );
+
+  // After the required repetitions, the rest are optional.
+  bool *tail = acquireTable( ctx );
+  addEmpty( ctx, tail );
+  if ( max < 0 )
+    repeat( ctx, sub, tail );
+  else if ( max > min ) {
+    int extra = max - min < limit ? max - min : limit;
+    for ( int begin = 0; begin <= ctx->len; begin++ )
+      for ( int end = begin; end <= ctx->len; end++ )
+        if ( sub[ at( ctx, begin, end ) ] )
+          tail[ at( ctx, begin, end ) ] = true;
+    ctx->work += (size_t) ( ctx->len + 1 ) * ( ctx->len + 1 );
+    bool *optional = power( ctx, tail, extra );
+    releaseTable( ctx, tail );
+    tail = optional;
+  }
+
+  bool *table = compose( ctx, head, tail );
+  releaseTable( ctx, head );
+  releaseTable( ctx, tail );
+  return table;
+}
+
+// Documented in the header.
+bool locateMatches( Program const *prog, MatchContext *ctx, char const *str,
+                    size_t len, size_t budget )
+{
+  startTables( ctx, len );
+  ctx->budget = budget;
+  if ( ctx->stackCap < prog->depth ) {
+    ctx->stackCap = prog->depth;
+    ctx->stack = (bool **) checkedRealloc( ctx->stack,
+                                           ctx->stackCap * sizeof( bool * ) );
+  }
+
+  // Each step pops its operands' tables off the stack and pushes its
+  // own.  The ones that can are done in place, on an operand's table.
+  bool **stack = ctx->stack;
+  int top = 0;
+  for ( int i = 0; i < prog->count; i++ ) {
+    Step const *s = prog->steps + i;
+    size_t work = ctx->work, borrowed = ctx->borrowed;
+    long long start = ctx->stats ? clockNanos() : 0;
+    bool *table;
+    switch ( s->op ) {
+    case BYTE_STEP: {
+      ByteSet const *set = prog->sets + s->arg;
+      table = acquireTable( ctx );
+      for ( int begin = 0; begin < ctx->len; begin++ )
+        if ( inByteSet( set, str[ begin ] ) )
+          table[ at( ctx, begin, begin + 1 ) ] = true;
+      break;
+    }
+    case LITERAL_STEP: {
+      // The search jumps straight from one occurrence to the next.
+      char const *(*search)( char const *, size_t, char const *, size_t ) =
+        prog->fold ? findSubstringFold : findSubstring;
+      char const *lit = prog->text + s->arg;
+      table = acquireTable( ctx );
+      char const *hit = search( str, ctx->len, lit, s->len );
+      while ( hit ) {
+        int begin = hit - str;
+        table[ at( ctx, begin, begin + s->len ) ] = true;
+        hit = search( hit + 1, ctx->len - begin - 1, lit, s->len );
+      }
+      break;
+    }
+    case START_STEP:
+      table = acquireTable( ctx );
+      table[ at( ctx, 0, 0 ) ] = true;
+      break;
+    case END_STEP:
+      table = acquireTable( ctx );
+      table[ at( ctx, ctx->len, ctx->len ) ] = true;
+      break;
+    case TAG_STEP:
+      table = acquireTable( ctx );
+      addEmpty( ctx, table );
+      break;
+    case CONCAT_STEP: {
+      bool *t2 = stack[ --top ];
+      bool *t1 = stack[ --top ];
+      table = compose( ctx, t1, t2 );
+      releaseTable( ctx, t1 );
+      releaseTable( ctx, t2 );
+      break;
+    }
+    case ALTERNATE_STEP: {
+      bool *t2 = stack[ --top ];
+      table = stack[ --top ];
+      size_t cells = (size_t) ( ctx->len + 1 ) * ( ctx->len + 1 );
+      for ( size_t c = 0; c < cells; c++ )
+        table[ c ] |= t2[ c ];
+      ctx->work += cells;
+      releaseTable( ctx, t2 );
+      break;
+    }
+    case OPTIONAL_STEP:
+      table = stack[ --top ];
+      addEmpty( ctx, table );
+      break;
+    case STAR_STEP:
+    case PLUS_STEP: {
+      bool *sub = stack[ --top ];
+      table = acquireTable( ctx );
+      if ( s->op == STAR_STEP )
+        addEmpty( ctx, table );
+      repeat( ctx, sub, table );
+      releaseTable( ctx, sub );
+      break;
+    }
+    case COUNT_STEP: {
+      bool *sub = stack[ --top ];
+      table = count( ctx, sub, s->min, s->max );
+      releaseTable( ctx, sub );
+      break;
+    }
+    }
+    stack[ top++ ] = table;
+
+    // Worker threads can share the counts, so they're added atomically.
+    if ( ctx->stats ) {
+      StepStats *st = ctx->stats + i;
+      __atomic_add_fetch( &st->calls, 1, __ATOMIC_RELAXED );
+      __atomic_add_fetch( &st->cells, ctx->work - work, __ATOMIC_RELAXED );
+      __atomic_add_fetch( &st->bytes, ctx->borrowed - borrowed,
+                          __ATOMIC_RELAXED );
+      __atomic_add_fetch( &st->nanos, clockNanos() - start, __ATOMIC_RELAXED );
+    }
+
+    // Once the budget runs out, whatever's been done so far goes back
+    // to the pool.
+    if ( overBudget( ctx ) ) {
+      while ( top )
+        releaseTable( ctx, stack[ --top ] );
+      return false;
+    }
+  }
+
+  ctx->result = stack[ 0 ];
+  return true;
+}
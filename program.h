@@ -0,0 +1,144 @@
+#ifndef PROGRAM_H
+#define PROGRAM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "pattern.h"
+#include "context.h"
+#include "arena.h"
+
+/** Operations a program step can perform. */
+typedef enum {
+  BYTE_STEP,       ///< One byte from byte set arg.
+  LITERAL_STEP,    ///< The len bytes of text starting at offset arg.
+  START_STEP,      ///< The ^ anchor.
+  END_STEP,        ///< The $ anchor.
+  TAG_STEP,        ///< The empty string, ending the pattern tagged arg.
+  CONCAT_STEP,     ///< The two operands before it, one after the other.
+  ALTERNATE_STEP,  ///< Either of the two operands before it.
+  OPTIONAL_STEP,   ///< The operand before it, or nothing.
+  STAR_STEP,       ///< Zero or more repetitions of the operand before it.
+  PLUS_STEP,       ///< One or more repetitions of the operand before it.
+  COUNT_STEP       ///< From min to max repetitions of the operand before it.
+} StepOp;
+
+/** One step of a program. */
+typedef struct {
+  /** What this step does. */
+  StepOp op;
+
+  /** Byte set for BYTE_STEP, where the bytes for LITERAL_STEP start
+      in the program's text, or the tag for TAG_STEP. */
+  int arg;
+
+  /** Number of bytes for LITERAL_STEP. */
+  int len;
+
+  /** Fewest repetitions for COUNT_STEP. */
+  int min;
+
+  /** Most repetitions for COUNT_STEP, or -1 for no limit. */
+  int max;
+
+  /** Index of the first step of the sub-program that ends with this
+      step, so an engine can find where each operand starts. */
+  int first;
+} Step;
+
+/** A short name to use for the program. */
+typedef struct ProgramStruct Program;
+
+/**
+  Pattern compiled into a flat array of steps in postfix order, so
+  each step's operands come right before it, and the last step is the
+  whole pattern.  The match tables are filled in by running the steps
+  in order with a stack of tables, and the automaton is compiled from
+  the same steps, so every engine starts from this one representation
+  instead of walking the pattern tree.  A program never changes once
+  it's compiled, and threads can share it.
+*/
+struct ProgramStruct {
+  /** The steps, in postfix order. */
+  Step *steps;
+
+  /** Number of steps. */
+  int count;
+
+  /** Byte sets used by BYTE_STEP steps. */
+  ByteSet *sets;
+
+  /** Number of byte sets. */
+  int setCount;
+
+  /** Bytes for all the LITERAL_STEP steps, one after another. */
+  char *text;
+
+  /** Number of bytes in text. */
+  int textLen;
+
+  /** Most tables that are ever on the stack at once while running it. */
+  int depth;
+
+  /** True if letters match in either case.  The byte sets already
+      have both cases, and text is stored in lower case, so LITERAL_STEP
+      compares it with the input folded to lower case. */
+  bool fold;
+};
+
+/**
+  Compile a pattern into a program.
+
+  @param pat pattern to compile.
+  @param fold true if letters should match in either case.
+  @param arena arena to allocate the program from.
+  @return the new program.
+*/
+Program *compileProgram( Pattern const *pat, bool fold, Arena *arena );
+
+/**
+  Return the index of the last step of the first operand of a
+  CONCAT_STEP or ALTERNATE_STEP.  The second operand always ends right
+  before the step itself.
+
+  @param prog program holding the step.
+  @param i index of the step.
+  @return index of the step the first operand ends with.
+*/
+static inline int firstOperand( Program const *prog, int i )
+{
+  return prog->steps[ i - 1 ].first - 1;
+}
+
+/** Find all the places where the given program matches the given
+    input string, recording the result in ctx so it can be checked
+    with matches().  The work grows with the number of steps and the
+    cube of the length, so it's limited by a budget, counted in table
+    cells cleared, filled in or checked.  If the budget runs out, this
+    gives up right away, and the string has to be matched some other
+    way.
+
+    @param prog program to run.
+    @param ctx context for the match state; only one thread at a time
+               may use it.
+    @param str input string in which we're finding matches.
+    @param len number of characters in str.
+    @param budget most table cells to work through, or zero for no limit.
+    @return true if the matches were found, or false if the budget ran
+            out first, in which case there's nothing to check with
+            matches().
+*/
+bool locateMatches( Program const *prog, MatchContext *ctx, char const *str,
+                    size_t len, size_t budget );
+
+/** Report elements of the match table from the most recent call to
+    locateMatches() with the given context.
+
+    @param ctx context holding the latest match table.
+    @param begin index of the first character in the substring
+    @param end index one-past-the-end of the string
+    @return true if the pattern matches the [ begin, end ) substring
+            of the most recent input string
+ */
+bool matches( MatchContext const *ctx, int begin, int end );
+
+#endif
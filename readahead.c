@@ -0,0 +1,146 @@
+/**
+ * @file readahead.c
+ * @author sdcroche
+ *
+ * ReadAhead runs a reader on its own thread, so input is read while
+ * the previous block is being matched.  Blocks go back and forth
+ * through two single-producer, single-consumer queues: empty ones to
+ * the I/O thread and full ones back to the caller.  Semaphores only
+ * come into it when one side has to wait for the other.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "readahead.h"
+#include "spsc.h"
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdlib.h>
+
+/** State shared by the I/O thread and the thread doing the matching. */
+struct ReadAheadStruct {
+  /** Reader the I/O thread reads from. */
+  Reader *reader;
+
+  /** Ring of block buffers. */
+  Block *blocks;
+
+  /** Number of buffers. */
+  int count;
+
+  /** Buffers waiting to be filled. */
+  SpscQueue empty;
+
+  /** Filled buffers, in input order, with NULL at the end of the input. */
+  SpscQueue full;
+
+  /** Number of buffers in the empty queue. */
+  sem_t space;
+
+  /** Number of entries in the full queue. */
+  sem_t ready;
+
+  /** Block the caller is using right now, or NULL. */
+  Block *current;
+
+  /** True once the caller has seen the end of the input. */
+  bool finished;
+
+  /** Set to tell the I/O thread to quit early. */
+  bool stop;
+
+  /** The I/O thread. */
+  pthread_t thread;
+};
+
+/**
+  Start routine for the I/O thread.  It fills empty buffers until it
+  runs out of input or it's told to stop.
+
+  @param p the read-ahead state.
+  @return NULL
+*/
+static void *readLoop( void *p )
+{
+  ReadAhead *ra = (ReadAhead *) p;
+
+  for ( ;; ) {
+    sem_wait( &ra->space );
+    if ( __atomic_load_n( &ra->stop, __ATOMIC_ACQUIRE ) )
+      break;
+
+    void *item;
+    popSpsc( &ra->empty, &item );
+    Block *blk = (Block *) item;
+    bool more = readBlock( ra->reader, blk );
+
+    pushSpsc( &ra->full, more ? blk : NULL );
+    sem_post( &ra->ready );
+    if ( !more )
+      break;
+  }
+
+  return NULL;
+}
+
+// Documented in the header.
+ReadAhead *startReadAhead( Reader *r, int buffers )
+{
+  ReadAhead *ra = (ReadAhead *) malloc( sizeof( ReadAhead ) );
+  ra->reader = r;
+  ra->count = buffers;
+  ra->blocks = (Block *) malloc( buffers * sizeof( Block ) );
+  initSpsc( &ra->empty, buffers );
+  initSpsc( &ra->full, buffers );
+  for ( int i = 0; i < buffers; i++ ) {
+    initBlock( &ra->blocks[ i ] );
+    pushSpsc( &ra->empty, &ra->blocks[ i ] );
+  }
+  sem_init( &ra->space, 0, buffers );
+  sem_init( &ra->ready, 0, 0 );
+  ra->current = NULL;
+  ra->finished = false;
+  ra->stop = false;
+
+  pthread_create( &ra->thread, NULL, readLoop, ra );
+  return ra;
+}
+
+// Documented in the header.
+Block const *nextBlock( ReadAhead *ra )
+{
+  // Hand the last block back to be filled again.
+  if ( ra->current ) {
+    pushSpsc( &ra->empty, ra->current );
+    sem_post( &ra->space );
+    ra->current = NULL;
+  }
+  if ( ra->finished )
+    return NULL;
+
+  sem_wait( &ra->ready );
+  void *item;
+  popSpsc( &ra->full, &item );
+  ra->current = (Block *) item;
+  if ( !ra->current )
+    ra->finished = true;
+
+  return ra->current;
+}
+
+// Documented in the header.
+void stopReadAhead( ReadAhead *ra )
+{
+  // Wake the I/O thread up in case it's waiting for a buffer.
+  __atomic_store_n( &ra->stop, true, __ATOMIC_RELEASE );
+  sem_post( &ra->space );
+  pthread_join( ra->thread, NULL );
+
+  for ( int i = 0; i < ra->count; i++ )
+    freeBlock( &ra->blocks[ i ] );
+  free( ra->blocks );
+  freeSpsc( &ra->empty );
+  freeSpsc( &ra->full );
+  sem_destroy( &ra->space );
+  sem_destroy( &ra->ready );
+  free( ra );
+}
@@ -0,0 +1,39 @@
+#ifndef READAHEAD_H
+#define READAHEAD_H
+
+#include "input.h"
+
+/** A short name to use for the read-ahead thread. */
+typedef struct ReadAheadStruct ReadAhead;
+
+/**
+  Start a thread that reads blocks from a reader into a ring of
+  buffers, so the next block is being read while the caller is
+  matching the current one.
+
+  @param r reader to read blocks from; it belongs to the new thread
+           until stopReadAhead() is called.
+  @param buffers number of blocks that can be read ahead, at least 2.
+  @return a dynamically allocated read-ahead thread.
+*/
+ReadAhead *startReadAhead( Reader *r, int buffers );
+
+/**
+  Get the next block from the read-ahead thread, waiting for it if it
+  isn't ready yet.  The block from the previous call is given back to
+  be filled again, so it mustn't be used after this.
+
+  @param ra read-ahead thread to get a block from.
+  @return the next block, or NULL at the end of the input.
+*/
+Block const *nextBlock( ReadAhead *ra );
+
+/**
+  Stop the read-ahead thread and free its buffers.  This may be called
+  before all the blocks have been read.
+
+  @param ra read-ahead thread to stop.
+*/
+void stopReadAhead( ReadAhead *ra );
+
+#endif
@@ -7,85 +7,675 @@
  * the input with a given regex
  *
  */
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include "arena.h"
 #include "pattern.h"
+#include "program.h"
+#include "automaton.h"
 #include "parse.h"
+#include "simplify.h"
+#include "output.h"
+#include "input.h"
+#include "readahead.h"
+#include "parallel.h"
+#include "files.h"
+#include "scan.h"
+#include "compiled.h"
+#include "stats.h"
 
 // On the command line, which argument is the pattern.
 #define PAT_ARG 1
 
-// On the command line, which argument is the input file.
+// On the command line, which argument is the first input file.
 #define FILE_ARG 2
 
-/** length of buffer string to read input */
-#define BUFFLEN 200
+/** number of bytes to read for each block of input lines */
+#define BLOCKLEN ( 256 * 1024 )
+
+/** number of blocks the reader thread can get ahead of the matching */
+#define READAHEAD 3
 
 /** valid line length */
 #define LINELEN 100
 
-#define ARGCFILE 3
-#define ARGCNOFILE 2
+/** table cells the match tables may work through on one line before
+    it's highlighted with the automaton instead */
+#define LINE_BUDGET 1000000
+
+/** When to highlight matches with color escape codes. */
+typedef enum { COLOR_ALWAYS, COLOR_NEVER, COLOR_AUTO } ColorMode;
+
+/** Settings from command-line options. */
+typedef struct {
+  /** When to color matches, from --color=WHEN. */
+  ColorMode color;
+
+  /** Number of worker threads from -j N, or zero to match in this thread. */
+  int threads;
+
+  /** Most table cells to spend on a line, from --line-budget=N, or
+      zero for no limit. */
+  long budget;
+
+  /** True for -q, to print nothing and stop at the first match. */
+  bool quiet;
+
+  /** True for -l, to print just the names of inputs with a match. */
+  bool listFiles;
+
+  /** True for -c, to print just the number of matching lines. */
+  bool count;
+
+  /** True for -o, to print just the matching parts of each line. */
+  bool onlyMatching;
+
+  /** True for -i, to match letters in either case. */
+  bool ignoreCase;
+
+  /** True for --stats, to report where the time went. */
+  bool stats;
+
+  /** File to write the compiled pattern to from --save-compiled, or NULL. */
+  char const *saveTo;
+
+  /** File to read a compiled pattern from with --load-compiled instead
+      of taking a pattern argument, or NULL. */
+  char const *loadFrom;
+
+  /** File to read patterns from with -f, one per line, instead of
+      taking a pattern argument, or NULL. */
+  char const *patternFile;
+} Options;
 
 /**
  * Report matches is responsible for providing the correct formatted output
- * for users to identify the matchex string given a regex
+ * for users to identify the matchex string given a regex.  Starting from
+ * the left, the longest non-empty match at each position is highlighted,
+ * and the search picks up again right after it.
+ *
+ * @param out writer the formatted line is added to
+ * @param ctx match context holding the matches found for str
+ * @param str string to detect and highlight matches for
+ * @param len number of characters in str
+ */
+void reportMatches( Output *out, MatchContext const *ctx, char const *str,
+                    int len )
+{
+  int begin = 0;
+  while ( begin < len ){
+    // Look for the longest match starting here.
+    int end = len;
+    while ( end > begin && !matches( ctx, begin, end ) )
+      end--;
+
+    if ( end > begin ){
+      outputMatch( out, str + begin, end - begin );
+      begin = end;
+    }
+    else{
+      outputText( out, str + begin, 1 );
+      begin++;
+    }
+  }
+  outputEndLine( out );
+}
+
+/**
+ * Highlight the matches on a line using the automaton's spans instead
+ * of match tables.  The spans are the same ones reportMatches() would
+ * highlight, but finding them doesn't take time for every step of the
+ * program, which matters for an alternation of thousands of patterns
+ * or a line the tables would take too long on.
  *
- * @param pat pattern to use to match
- * @param pstr string of the regex pattern
- * @param string to detect and highlight matches for
+ * @param out writer the formatted line is added to
+ * @param nfa automaton to find the spans with
+ * @param ctx match context that belongs to the calling thread
+ * @param str string to detect and highlight matches for
+ * @param len number of characters in str
  */
-void reportMatches( Pattern *pat, char const *pstr, char const *str)
+static void reportSpans( Output *out, Automaton const *nfa, MatchContext *ctx,
+                         char const *str, size_t len )
 {
+  size_t from = 0, begin, end;
+  while ( nextSpan( nfa, ctx, str, len, from, &begin, &end ) ){
+    outputText( out, str + from, begin - from );
+    outputMatch( out, str + begin, end - begin );
+    from = end;
+  }
+  outputText( out, str + from, len - from );
+  outputEndLine( out );
+}
 
-  // make the transition characters from red to white a character array
-  char red[] = "\033[31m";
+/** A compiled pattern, along with the automaton compiled from it. */
+typedef struct {
+  /** Program used to find where the matches are on a line. */
+  Program *prog;
 
-  char white[] = "\033[0m";
+  /** Automaton used to find the lines that have a match. */
+  Automaton *nfa;
 
-  int len = strlen( str );
+  /** True if each matching line starts with the numbers of the
+      patterns that matched it. */
+  bool showTags;
 
-  // runs through the match array ans see if there are any matches at all
-  bool anyMatch = false;
-  for ( int begin = 0; begin <= len; begin++ ){
-    for ( int end = begin; end <= len; end++ ){
-      if ( matches( pat, begin, end ) ) {
-        anyMatch = true;
-      }
+  /** Most table cells to spend finding the matches on a line, or zero
+      for no limit. */
+  size_t budget;
+
+  /** Counts for --stats, or NULL if we're not counting. */
+  Stats *stats;
+} Matcher;
+
+/**
+ * Add the time since start to the output time for --stats.  Worker
+ * threads all add to it, so it's done atomically.
+ *
+ * @param m matcher with the counts, if any
+ * @param start when the output began, from clockNanos()
+ */
+static void addOutputTime( Matcher const *m, long long start )
+{
+  if ( m->stats )
+    __atomic_add_fetch( &m->stats->output, clockNanos() - start,
+                        __ATOMIC_RELAXED );
+}
+
+/**
+ * Report which patterns match a line, as a comma-separated list of
+ * their line numbers in the pattern file, followed by a colon.
+ *
+ * @param out writer the list is added to
+ * @param m matcher with the patterns
+ * @param ctx match context that belongs to the calling thread
+ * @param str line to report the patterns for
+ * @param len number of characters in str
+ */
+static void reportTags( Output *out, Matcher const *m, MatchContext *ctx,
+                        char const *str, size_t len )
+{
+  int count;
+  int const *tags = matchingTags( m->nfa, ctx, str, len, &count );
+  for ( int k = 0; k < count; k++ ){
+    char num[ 32 ];
+    int n = snprintf( num, sizeof( num ), k + 1 < count ? "%d," : "%d:",
+                      tags[ k ] + 1 );
+    outputText( out, num, n );
+  }
+}
+
+/**
+ * Find and report matches for every line in a block of input.  This
+ * has the signature of a BlockFunction, so worker threads can call it.
+ * The automaton scans the whole block for lines that match, and only
+ * those lines get their matches located.
+ *
+ * @param arg the matcher to use
+ * @param ctx match context that belongs to the calling thread
+ * @param data block of whole input lines
+ * @param len number of bytes in data
+ * @param out writer the report for the block is added to
+ */
+static void matchLines( void *arg, MatchContext *ctx, char const *data,
+                        size_t len, Output *out )
+{
+  Matcher const *m = (Matcher const *) arg;
+  ctx->stats = m->stats ? m->stats->steps : NULL;
+
+  size_t pos = findMatchingLine( m->nfa, ctx, data, len, 0 );
+  while ( pos < len ){
+    // The last line of the input may not have a newline.
+    char const *nl = findByte( data + pos, len - pos, '\n' );
+    size_t end = nl ? (size_t) ( nl - data ) : len;
+
+    // With tags there are many patterns, so the automaton finds the
+    // matches.  Otherwise the match tables do, unless this line would
+    // take them more than their budget.
+    bool located = false;
+    if ( !m->showTags ){
+      located = locateMatches( m->prog, ctx, data + pos, end - pos,
+                               m->budget );
+      if ( m->stats )
+        __atomic_add_fetch( located ? &m->stats->tableLines :
+                            &m->stats->overBudget, 1, __ATOMIC_RELAXED );
     }
+
+    long long start = m->stats ? clockNanos() : 0;
+    if ( m->showTags )
+      reportTags( out, m, ctx, data + pos, end - pos );
+    if ( located )
+      reportMatches( out, ctx, data + pos, end - pos );
+    else
+      reportSpans( out, m->nfa, ctx, data + pos, end - pos );
+    addOutputTime( m, start );
+
+    pos = end < len ? end + 1 : len;
+    pos = findMatchingLine( m->nfa, ctx, data, len, pos );
   }
+}
 
-  // if there is at least one match, we want to print output
-  if ( anyMatch ){
-    bool mflag = false;
-    for ( int begin = 0; begin <= len; begin++ ){
-      for ( int end = begin; end <= len; end++ ){
+/**
+ * Report just the matching parts of every line in a block of input,
+ * one per output line, for -o.  The spans come straight from the
+ * automaton, leftmost first and longest at each position, the same
+ * ones that would be highlighted, but without building match tables.
+ * This has the signature of a BlockFunction, so worker threads can
+ * call it.
+ *
+ * @param arg the matcher to use
+ * @param ctx match context that belongs to the calling thread
+ * @param data block of whole input lines
+ * @param len number of bytes in data
+ * @param out writer the report for the block is added to
+ */
+static void matchSpans( void *arg, MatchContext *ctx, char const *data,
+                        size_t len, Output *out )
+{
+  Matcher const *m = (Matcher const *) arg;
 
-        // if there is a match at beginning,end
-        if ( matches( pat, begin, end ) ) {
-          //print the sequence to switch to red
-          printf("%s", red);
+  size_t pos = findMatchingLine( m->nfa, ctx, data, len, 0 );
+  while ( pos < len ){
+    char const *nl = findByte( data + pos, len - pos, '\n' );
+    size_t end = nl ? (size_t) ( nl - data ) : len;
 
-          // loop from beginning to end and print all matching characters
-          for ( int k = begin; k < end; k++ )
-            putchar(str[ k ]);
+    // Report each match on the line, picking up after the last one.
+    long long start = m->stats ? clockNanos() : 0;
+    size_t from = 0, begin, stop;
+    while ( nextSpan( m->nfa, ctx, data + pos, end - pos, from, &begin,
+                      &stop ) ){
+      outputMatch( out, data + pos + begin, stop - begin );
+      outputEndLine( out );
+      from = stop;
+    }
+    addOutputTime( m, start );
 
-          // print the sequence to switch back to white
-          printf("%s", white);
+    pos = end < len ? end + 1 : len;
+    pos = findMatchingLine( m->nfa, ctx, data, len, pos );
+  }
+}
 
-          begin = end - 1;
-          mflag = true;
-        }
-      }
-      if (!mflag && begin != len){
-        putchar(str[begin]);
-      }
-      mflag = false;
+/** A matcher, along with a count of the lines it has matched. */
+typedef struct {
+  /** Matcher to use. */
+  Matcher const *m;
+
+  /** Number of matching lines so far; worker threads add to it. */
+  long count;
+} Counter;
+
+/**
+ * Count the matching lines in a block of input, for -c.  Only the
+ * automaton is used, so no match tables are built and nothing is
+ * formatted.  This has the signature of a BlockFunction, so worker
+ * threads can call it.
+ *
+ * @param arg the counter to add to
+ * @param ctx match context that belongs to the calling thread
+ * @param data block of whole input lines
+ * @param len number of bytes in data
+ * @param out unused, since nothing is reported for each block
+ */
+static void countLines( void *arg, MatchContext *ctx, char const *data,
+                        size_t len, Output *out )
+{
+  Counter *c = (Counter *) arg;
+  long n = countMatchingLines( c->m->nfa, ctx, data, len );
+  __atomic_add_fetch( &c->count, n, __ATOMIC_RELAXED );
+}
 
+/**
+   Print a usage message and exit unsuccessfully.
+*/
+static void usage()
+{
+  fprintf(stderr,
+          "usage: regular [options] <pattern> [file-or-dir ...]\n"
+          "       regular [options] -f FILE [file-or-dir ...]\n"
+          "       regular [options] --load-compiled FILE [file-or-dir ...]\n"
+          "options:\n"
+          "  --color=WHEN          highlight matches always, never or auto\n"
+          "  -j N                  match with N worker threads\n"
+          "  -q                    print nothing; exit successfully on a match\n"
+          "  -l                    print just the names of inputs with a match\n"
+          "  -c                    print just the number of matching lines\n"
+          "  -o                    print just the matching parts of each line\n"
+          "  -i                    match letters in either case\n"
+          "  -f FILE               match the patterns in FILE, one per line\n"
+          "  --line-budget=N       table cells to spend on a line, 0 for no limit\n"
+          "  --stats               report where the time went on standard error\n"
+          "  --save-compiled FILE  write the compiled pattern to FILE and exit\n"
+          "  --load-compiled FILE  use a pattern saved with --save-compiled\n" );
+  exit(EXIT_FAILURE);
+}
+
+/**
+   Pull options out of the command-line arguments, recording them in
+   opts.  The remaining arguments are shifted down, so the pattern and
+   the input files start at PAT_ARG and FILE_ARG just as if no options
+   had been given.
+
+   @param argc Number of command-line arguments.
+   @param argv List of command-line arguments, compacted in place.
+   @param opts Options structure to fill in.
+   @return the number of arguments left after the options are removed.
+*/
+static int parseOptions( int argc, char *argv[], Options *opts )
+{
+  opts->color = COLOR_ALWAYS;
+  opts->threads = 0;
+  opts->budget = LINE_BUDGET;
+  opts->quiet = false;
+  opts->listFiles = false;
+  opts->count = false;
+  opts->onlyMatching = false;
+  opts->ignoreCase = false;
+  opts->stats = false;
+  opts->saveTo = NULL;
+  opts->loadFrom = NULL;
+  opts->patternFile = NULL;
+
+  int n = 1;
+  bool done = false;
+  for ( int i = 1; i < argc; i++ ){
+    char *arg = argv[ i ];
+    if ( done || arg[ 0 ] != '-' || arg[ 1 ] == '\0' ){
+      argv[ n++ ] = arg;
+    }
+    else if ( strcmp( arg, "--" ) == 0 ){
+      done = true;
+    }
+    else if ( strcmp( arg, "--color=always" ) == 0 ){
+      opts->color = COLOR_ALWAYS;
+    }
+    else if ( strcmp( arg, "--color=never" ) == 0 ){
+      opts->color = COLOR_NEVER;
+    }
+    else if ( strcmp( arg, "--color=auto" ) == 0 ){
+      opts->color = COLOR_AUTO;
+    }
+    else if ( strcmp( arg, "-q" ) == 0 ){
+      opts->quiet = true;
+    }
+    else if ( strcmp( arg, "-l" ) == 0 ){
+      opts->listFiles = true;
+    }
+    else if ( strcmp( arg, "-c" ) == 0 ){
+      opts->count = true;
+    }
+    else if ( strcmp( arg, "-o" ) == 0 ){
+      opts->onlyMatching = true;
+    }
+    else if ( strcmp( arg, "-i" ) == 0 ){
+      opts->ignoreCase = true;
+    }
+    else if ( strcmp( arg, "--stats" ) == 0 ){
+      opts->stats = true;
+    }
+    else if ( strncmp( arg, "-j", 2 ) == 0 ){
+      // The thread count can be attached (-j4) or separate (-j 4).
+      char *count = arg[ 2 ] ? arg + 2 : ( i + 1 < argc ? argv[ ++i ] : NULL );
+      char *rest;
+      if ( !count || ( opts->threads = strtol( count, &rest, 10 ) ) < 1 ||
+           *rest )
+        usage();
+    }
+    else if ( strncmp( arg, "--line-budget=", 14 ) == 0 ){
+      char *rest;
+      if ( ( opts->budget = strtol( arg + 14, &rest, 10 ) ) < 0 ||
+           !arg[ 14 ] || *rest )
+        usage();
+    }
+    else if ( strcmp( arg, "-f" ) == 0 ){
+      if ( i + 1 >= argc )
+        usage();
+      opts->patternFile = argv[ ++i ];
+    }
+    else if ( strcmp( arg, "--save-compiled" ) == 0 ){
+      if ( i + 1 >= argc )
+        usage();
+      opts->saveTo = argv[ ++i ];
+    }
+    else if ( strcmp( arg, "--load-compiled" ) == 0 ){
+      if ( i + 1 >= argc )
+        usage();
+      opts->loadFrom = argv[ ++i ];
+    }
+    else{
+      usage();
     }
-    putchar('\n');
   }
+
+  return n;
+}
+
+/**
+   Match every line read from a stream, checking to see if any line is
+   too long.
+
+   @param in stream to read.
+   @param opts settings from the command line.
+   @param fn function to call for each block of lines.
+   @param arg extra argument to pass to fn.
+   @param ctx match context for this thread.
+   @param out writer the report is added to.
+   @return false if the stream had a line that was too long.
+*/
+static bool matchStream( FILE *in, Options const *opts, BlockFunction fn,
+                         void *arg, MatchContext *ctx, Output *out )
+{
+  // Read the input in blocks of whole lines.
+  Reader *r = makeReader( in, LINELEN, BLOCKLEN );
+  bool ok = true;
+  if ( opts->threads ){
+    ok = runParallel( r, opts->threads, fn, arg, out );
+  }
+  else{
+    // Read the next block on another thread while this one is matched.
+    ReadAhead *ra = startReadAhead( r, READAHEAD );
+    Block const *blk;
+    while ( ok && ( blk = nextBlock( ra ) ) ){
+      fn( arg, ctx, blk->data, blk->len, out );
+      ok = !blk->tooLong;
+    }
+    stopReadAhead( ra );
+  }
+
+  freeReader( r );
+  return ok;
+}
+
+/**
+   Handle the -c option, writing the number of matching lines in each
+   input.  With more than one input, each count is labeled with the
+   name of its input.
+
+   @param files input files, or an empty list for standard input.
+   @param showNames true if counts should be labeled with file names.
+   @param opts settings from the command line.
+   @param m matcher to use.
+   @param ctx match context for this thread.
+   @param out writer the counts are added to.
+   @return false if an input had a line that was too long.
+*/
+static bool countFiles( FileList const *files, bool showNames,
+                        Options const *opts, Matcher const *m,
+                        MatchContext *ctx, Output *out )
+{
+  bool ok = true;
+  for ( int i = 0; ok && i < ( files->count ? files->count : 1 ); i++ ){
+    char const *name = files->count ? files->paths[ i ] : "(standard input)";
+    FILE *in = files->count ? fopen( name, "r" ) : stdin;
+    if ( !in ){
+      fprintf(stderr, "Can't open input file: %s\n", name);
+      continue;
+    }
+
+    Counter c = { m, 0 };
+    ok = matchStream( in, opts, countLines, &c, ctx, out );
+    if ( in != stdin )
+      fclose( in );
+
+    if ( ok ){
+      char prefix[ strlen( name ) + 2 ];
+      strcpy( prefix, name );
+      strcat( prefix, ":" );
+      setOutputPrefix( out, showNames ? prefix : NULL );
+
+      char num[ 32 ];
+      int n = snprintf( num, sizeof( num ), "%ld", c.count );
+      outputText( out, num, n );
+      outputEndLine( out );
+    }
+  }
+
+  return ok;
+}
+
+/**
+   Check whether any line read from a stream matches, stopping as soon
+   as one does.  Only the automaton is used, so no match tables are
+   built.
+
+   @param in stream to read.
+   @param m matcher to use.
+   @param ctx match context for this thread.
+   @param found set to true if a line matched.
+   @return false if the stream had a line that was too long before
+           any match.
+*/
+static bool streamHasMatch( FILE *in, Matcher const *m, MatchContext *ctx,
+                            bool *found )
+{
+  // Blocks are read right here, so we don't read any further than we
+  // need to.
+  Reader *r = makeReader( in, LINELEN, BLOCKLEN );
+  Block blk;
+  initBlock( &blk );
+  bool ok = true;
+  *found = false;
+  while ( ok && !*found && readBlock( r, &blk ) ){
+    *found = findMatchingLine( m->nfa, ctx, blk.data, blk.len, 0 ) < blk.len;
+    ok = !blk.tooLong;
+  }
+  freeBlock( &blk );
+  freeReader( r );
+
+  return ok || *found;
+}
+
+/**
+   Handle the -q and -l options, looking for the first match in each
+   input.  With -q, this stops as soon as anything matches.  With -l,
+   the name of each input with a match is written.
+
+   @param files input files, or an empty list for standard input.
+   @param opts settings from the command line.
+   @param m matcher to use.
+   @param ctx match context for this thread.
+   @param out writer the file names are added to.
+   @param found set to true if any input had a match.
+   @return false if an input had a line that was too long.
+*/
+static bool findMatchingFiles( FileList const *files, Options const *opts,
+                               Matcher const *m, MatchContext *ctx,
+                               Output *out, bool *found )
+{
+  *found = false;
+  bool ok = true;
+  for ( int i = 0; ok && i < ( files->count ? files->count : 1 ); i++ ){
+    char const *name = files->count ? files->paths[ i ] : "(standard input)";
+    FILE *in = files->count ? fopen( name, "r" ) : stdin;
+    if ( !in ){
+      fprintf(stderr, "Can't open input file: %s\n", name);
+      continue;
+    }
+
+    bool match;
+    ok = streamHasMatch( in, m, ctx, &match );
+    if ( in != stdin )
+      fclose( in );
+
+    if ( match ){
+      *found = true;
+      if ( opts->quiet )
+        break;
+      outputText( out, name, strlen( name ) );
+      outputEndLine( out );
+    }
+  }
+
+  return ok;
+}
+
+/**
+   Read the patterns for -f, one per line, and compile them into a
+   matcher.  Each pattern ends with a tag for its line, and they're all
+   joined in one alternation, so one automaton finds the lines any of
+   them match and can tell which ones did.
+
+   @param path name of the pattern file.
+   @param fold true if letters should match in either case.
+   @param m matcher to fill in.
+   @param arena arena the patterns are compiled into.
+   @param parseTime set to the time spent parsing the patterns, in
+                    nanoseconds.
+*/
+static void compilePatternFile( char const *path, bool fold, Matcher *m,
+                                Arena *arena, long long *parseTime )
+{
+  FILE *fp = fopen( path, "r" );
+  if ( !fp ){
+    fprintf(stderr, "Can't open pattern file: %s\n", path);
+    exit(EXIT_FAILURE);
+  }
+
+  Pattern *all = NULL;
+  int count = 0;
+  char *line = NULL;
+  size_t cap = 0;
+  ssize_t n;
+  while ( ( n = getline( &line, &cap, fp ) ) >= 0 ){
+    if ( n > 0 && line[ n - 1 ] == '\n' )
+      line[ n - 1 ] = '\0';
+
+    long long start = clockNanos();
+    Pattern *parsed = parsePattern( line, fold, arena );
+    *parseTime += clockNanos() - start;
+
+    Pattern *pat = makeConcatenationPattern( arena, parsed,
+                                             makeTagPattern( arena, count++ ) );
+    all = all ? makeAlterationPattern( arena, all, pat ) : pat;
+  }
+  free( line );
+  fclose( fp );
+
+  if ( !all ){
+    fprintf(stderr, "No patterns in file: %s\n", path);
+    exit(EXIT_FAILURE);
+  }
+
+  m->prog = compileProgram( simplifyPattern( all, arena ), fold, arena );
+  m->nfa = compileAutomaton( m->prog, arena );
+}
+
+/**
+   Check whether a program has any tags, so it came from a pattern file
+   and the numbers of the patterns that match each line get reported.
+   This works the same for a program loaded from a compiled file.
+
+   @param prog program to check.
+   @return true if the program has a TAG_STEP.
+*/
+static bool hasTags( Program const *prog )
+{
+  for ( int i = 0; i < prog->count; i++ )
+    if ( prog->steps[ i ].op == TAG_STEP )
+      return true;
+  return false;
 }
 
 /**
@@ -98,48 +688,150 @@ void reportMatches( Pattern *pat, char const *pstr, char const *str)
 */
 int main( int argc, char *argv[] )
 {
-  FILE * in;
+  Options opts;
+
+  argc = parseOptions( argc, argv, &opts );
 
-  if (argc == ARGCFILE){
-    in = fopen(argv[FILE_ARG], "r");
+  // Patterns from a file take the place of the pattern argument, so
+  // the input files start one argument sooner.  A compiled pattern
+  // already matches either case or not, from when it was saved.
+  bool patternArg = !opts.loadFrom && !opts.patternFile;
+  int fileArg = patternArg ? FILE_ARG : PAT_ARG;
+  if ( argc < fileArg || ( opts.loadFrom && ( opts.saveTo ||
+                                              opts.patternFile ||
+                                              opts.ignoreCase ) ) ){
+    usage();
   }
-  else if (argc == ARGCNOFILE){
-    in = stdin;
+
+  // The pattern tree and everything compiled from it share one arena.
+  // Compiling takes whatever time building the matcher took besides
+  // parsing.
+  Arena *arena = makeArena();
+  long long start = clockNanos();
+  long long parseTime = 0;
+  Matcher m;
+  Compiled *loaded = NULL;
+  if ( opts.loadFrom ){
+    loaded = loadCompiled( opts.loadFrom, arena );
+    if ( !loaded ){
+      fprintf(stderr, "Invalid compiled pattern: %s\n", opts.loadFrom);
+      exit(EXIT_FAILURE);
+    }
+    m.prog = loaded->prog;
+    m.nfa = loaded->nfa;
+  }
+  else if ( opts.patternFile ){
+    compilePatternFile( opts.patternFile, opts.ignoreCase, &m, arena,
+                        &parseTime );
   }
   else{
-    fprintf(stderr, "usage: regular <pattern> [input-file.txt]\n");
-    exit(EXIT_FAILURE);
+    char *pstr = argv[PAT_ARG];
+    Pattern *parsed = parsePattern( pstr, opts.ignoreCase, arena );
+    parseTime = clockNanos() - start;
+    Pattern *pat = simplifyPattern( parsed, arena );
+    m.prog = compileProgram( pat, opts.ignoreCase, arena );
+    m.nfa = compileAutomaton( m.prog, arena );
   }
-
-  char *pstr = argv[PAT_ARG];
-  Pattern *pat = parsePattern( pstr );
-
-  if (in == NULL){
-    fprintf(stderr, "Can't open input file: %s\n", argv[FILE_ARG]);
-    exit(EXIT_FAILURE);
+  m.showTags = hasTags( m.prog );
+  m.budget = opts.budget;
+  m.stats = NULL;
+  if ( opts.stats ){
+    m.stats = makeStats( m.prog );
+    m.stats->parse = parseTime;
+    m.stats->compile = clockNanos() - start - parseTime;
   }
 
-  char *str = (char *)malloc(sizeof(char) * BUFFLEN);
-  char c = '\0';
-  // read the input line, checking to see if it is too long
+  // Saving the compiled pattern is all there is to do; no input is read.
+  if ( opts.saveTo ){
+    if ( !saveCompiled( opts.saveTo, m.prog, m.nfa ) ){
+      fprintf(stderr, "Can't write compiled pattern: %s\n", opts.saveTo);
+      exit(EXIT_FAILURE);
+    }
+    if ( m.stats ){
+      reportStats( stderr, m.stats, m.prog );
+      freeStats( m.stats );
+    }
+    freeArena( arena );
+    return EXIT_SUCCESS;
+  }
 
-  while (fscanf(in, "%[^\n]%c", str, &c) != EOF ){
-    if (strlen(str) > LINELEN){
-      fprintf(stderr, "Input line too long\n");
+  // Gather up the input files; directories stand for all the files
+  // under them.
+  FileList files;
+  initFileList( &files );
+  for ( int i = fileArg; i < argc; i++ ){
+    if ( !addInput( &files, argv[ i ] ) ){
+      fprintf(stderr, "Can't open input file: %s\n", argv[ i ]);
       exit(EXIT_FAILURE);
     }
+  }
+
+  // With more than one file, each line is labeled with its file name.
+  bool showNames = files.count > 1 || files.sawDirectory;
+
+  // Only color the output if we're asked to, or if it's going to a terminal.
+  bool color = opts.color == COLOR_ALWAYS ||
+    ( opts.color == COLOR_AUTO && isatty( fileno( stdout ) ) );
+  Output *out = makeOutput( stdout, color );
+  MatchContext *ctx = makeMatchContext();
 
-    if (c == '\n'){
-      // Find matches for this pattern.
-      pat->locate( pat, str );
+  // With -o, only the matching parts of lines are reported.
+  BlockFunction fn = opts.onlyMatching ? matchSpans : matchLines;
 
-      reportMatches( pat, pstr, str);
+  bool ok = true;
+  bool found = true;
+  start = clockNanos();
+  if ( opts.quiet || opts.listFiles ){
+    ok = findMatchingFiles( &files, &opts, &m, ctx, out, &found );
+  }
+  else if ( opts.count ){
+    ok = countFiles( &files, showNames, &opts, &m, ctx, out );
+  }
+  else if (argc == fileArg){
+    ok = matchStream( stdin, &opts, fn, &m, ctx, out );
+  }
+  else if ( opts.threads ){
+    ok = runFiles( &files, showNames, opts.threads, LINELEN, BLOCKLEN,
+                   fn, &m, out );
+  }
+  else{
+    for ( int i = 0; ok && i < files.count; i++ ){
+      FILE *in = fopen( files.paths[ i ], "r" );
+      if ( !in ){
+        fprintf(stderr, "Can't open input file: %s\n", files.paths[ i ]);
+        continue;
+      }
+
+      char prefix[ strlen( files.paths[ i ] ) + 2 ];
+      strcpy( prefix, files.paths[ i ] );
+      strcat( prefix, ":" );
+      setOutputPrefix( out, showNames ? prefix : NULL );
+
+      ok = matchStream( in, &opts, fn, &m, ctx, out );
+      fclose( in );
     }
   }
 
-  pat->destroy( pat );
+  // With -q or -l, it's a failure if nothing matched.
+  int status = found ? EXIT_SUCCESS : EXIT_FAILURE;
+  if ( !ok ){
+    // Everything before the long line still gets reported.
+    flushOutput( out );
+    fprintf(stderr, "Input line too long\n");
+    status = EXIT_FAILURE;
+  }
+
+  freeOutput( out );
+  if ( m.stats ){
+    m.stats->match = clockNanos() - start;
+    reportStats( stderr, m.stats, m.prog );
+    freeStats( m.stats );
+  }
+  freeMatchContext( ctx );
+  freeFileList( &files );
+  if ( loaded )
+    unloadCompiled( loaded );
+  freeArena( arena );
 
-  free(str);
-  fclose(in);
-  return EXIT_SUCCESS;
+  return status;
 }
@@ -0,0 +1,508 @@
+/**
+ * @file scan.c
+ * @author sdcroche
+ *
+ * Scan finds delimiter bytes and literal strings in large regions of
+ * input.  Each kernel compares a block of bytes against the delimiter
+ * in a few vector instructions and turns the result into a bit mask,
+ * so the position of the first (or last) match is just a bit scan
+ * away.
+ */
+#include "scan.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+#include <immintrin.h>
+#define HAVE_X86 1
+#endif
+
+/** Signature shared by all the versions of findByte() and findLastByte(). */
+typedef char const *(*ScanFunction)( char const *data, size_t len, char byte );
+
+/** Signature shared by all the versions of findSubstring(), for
+    strings at least two bytes long. */
+typedef char const *(*SearchFunction)( char const *data, size_t len,
+                                       char const *str, size_t n );
+
+/**
+  Portable version of findByte(), one byte at a time.
+
+  @param data region to search.
+  @param len number of bytes in data.
+  @param byte byte to look for.
+  @return pointer to the first occurrence, or NULL if there isn't one.
+*/
+static char const *findByteScalar( char const *data, size_t len, char byte )
+{
+  for ( size_t i = 0; i < len; i++ )
+    if ( data[ i ] == byte )
+      return data + i;
+  return NULL;
+}
+
+/**
+  Portable version of findLastByte(), one byte at a time.
+
+  @param data region to search.
+  @param len number of bytes in data.
+  @param byte byte to look for.
+  @return pointer to the last occurrence, or NULL if there isn't one.
+*/
+static char const *findLastByteScalar( char const *data, size_t len,
+                                       char byte )
+{
+  while ( len > 0 )
+    if ( data[ --len ] == byte )
+      return data + len;
+  return NULL;
+}
+
+/**
+  Portable version of findSubstring(), one candidate position at a
+  time.
+
+  @param data region to search.
+  @param len number of bytes in data.
+  @param str bytes to look for.
+  @param n number of bytes in str, at least 2.
+  @return pointer to the first occurrence, or NULL if there isn't one.
+*/
+static char const *findSubstringScalar( char const *data, size_t len,
+                                        char const *str, size_t n )
+{
+  for ( size_t i = 0; i + n <= len; i++ )
+    if ( data[ i ] == str[ 0 ] && data[ i + n - 1 ] == str[ n - 1 ] &&
+         memcmp( data + i + 1, str + 1, n - 2 ) == 0 )
+      return data + i;
+  return NULL;
+}
+
+/**
+  Report whether a region of memory matches a string of bytes, ignoring
+  the case of letters in the region.
+
+  @param data region to compare.
+  @param str bytes to compare with, with any letters in lower case.
+  @param n number of bytes to compare.
+  @return true if they match.
+*/
+static bool sameFolded( char const *data, char const *str, size_t n )
+{
+  for ( size_t i = 0; i < n; i++ )
+    if ( foldByte( data[ i ] ) != str[ i ] )
+      return false;
+  return true;
+}
+
+/**
+  Portable version of findSubstringFold(), one candidate position at a
+  time.
+
+  @param data region to search.
+  @param len number of bytes in data.
+  @param str bytes to look for, with any letters in lower case.
+  @param n number of bytes in str, at least 1.
+  @return pointer to the first occurrence, or NULL if there isn't one.
+*/
+static char const *findSubstringFoldScalar( char const *data, size_t len,
+                                            char const *str, size_t n )
+{
+  for ( size_t i = 0; i + n <= len; i++ )
+    if ( sameFolded( data + i, str, n ) )
+      return data + i;
+  return NULL;
+}
+
+/**
+  Return the bit that tells the two cases of a letter apart, or zero
+  for a byte that isn't a letter.  Setting that bit in an input byte
+  folds it to lower case if it's a letter, and only letters in str ever
+  get compared that way, so the vector kernels can fold a whole block
+  with a single OR.
+
+  @param c a byte from the string being searched for, in lower case.
+  @return the bit to set in input bytes compared with c.
+*/
+static char caseBit( char c )
+{
+  return c >= 'a' && c <= 'z' ? 'a' - 'A' : 0;
+}
+
+#ifdef HAVE_X86
+
+/**
+  SSE2 version of findByte(), 64 bytes at a time in four 16-byte
+  vectors.
+
+  @param data region to search.
+  @param len number of bytes in data.
+  @param byte byte to look for.
+  @return pointer to the first occurrence, or NULL if there isn't one.
+*/
+__attribute__(( target( "sse2" ) ))
+static char const *findByteSSE2( char const *data, size_t len, char byte )
+{
+  __m128i d = _mm_set1_epi8( byte );
+  size_t i = 0;
+  for ( ; i + 64 <= len; i += 64 ) {
+    uint64_t m0 = _mm_movemask_epi8(
+      _mm_cmpeq_epi8( _mm_loadu_si128( (__m128i const *) ( data + i ) ), d ) );
+    uint64_t m1 = _mm_movemask_epi8(
+      _mm_cmpeq_epi8( _mm_loadu_si128( (__m128i const *) ( data + i + 16 ) ), d ) );
+    uint64_t m2 = _mm_movemask_epi8(
+      _mm_cmpeq_epi8( _mm_loadu_si128( (__m128i const *) ( data + i + 32 ) ), d ) );
+    uint64_t m3 = _mm_movemask_epi8(
+      _mm_cmpeq_epi8( _mm_loadu_si128( (__m128i const *) ( data + i + 48 ) ), d ) );
+    uint64_t mask = m0 | m1 << 16 | m2 << 32 | m3 << 48;
+    if ( mask )
+      return data + i + __builtin_ctzll( mask );
+  }
+  for ( ; i + 16 <= len; i += 16 ) {
+    unsigned int mask = _mm_movemask_epi8(
+      _mm_cmpeq_epi8( _mm_loadu_si128( (__m128i const *) ( data + i ) ), d ) );
+    if ( mask )
+      return data + i + __builtin_ctz( mask );
+  }
+  return findByteScalar( data + i, len - i, byte );
+}
+
+/**
+  SSE2 version of findLastByte(), 64 bytes at a time from the end.
+
+  @param data region to search.
+  @param len number of bytes in data.
+  @param byte byte to look for.
+  @return pointer to the last occurrence, or NULL if there isn't one.
+*/
+__attribute__(( target( "sse2" ) ))
+static char const *findLastByteSSE2( char const *data, size_t len, char byte )
+{
+  __m128i d = _mm_set1_epi8( byte );
+  for ( ; len >= 64; len -= 64 ) {
+    char const *p = data + len - 64;
+    uint64_t m0 = _mm_movemask_epi8(
+      _mm_cmpeq_epi8( _mm_loadu_si128( (__m128i const *) p ), d ) );
+    uint64_t m1 = _mm_movemask_epi8(
+      _mm_cmpeq_epi8( _mm_loadu_si128( (__m128i const *) ( p + 16 ) ), d ) );
+    uint64_t m2 = _mm_movemask_epi8(
+      _mm_cmpeq_epi8( _mm_loadu_si128( (__m128i const *) ( p + 32 ) ), d ) );
+    uint64_t m3 = _mm_movemask_epi8(
+      _mm_cmpeq_epi8( _mm_loadu_si128( (__m128i const *) ( p + 48 ) ), d ) );
+    uint64_t mask = m0 | m1 << 16 | m2 << 32 | m3 << 48;
+    if ( mask )
+      return p + 63 - __builtin_clzll( mask );
+  }
+  return findLastByteScalar( data, len, byte );
+}
+
+/**
+  AVX2 version of findByte(), 64 bytes at a time in two 32-byte
+  vectors.
+
+  @param data region to search.
+  @param len number of bytes in data.
+  @param byte byte to look for.
+  @return pointer to the first occurrence, or NULL if there isn't one.
+*/
+__attribute__(( target( "avx2" ) ))
+static char const *findByteAVX2( char const *data, size_t len, char byte )
+{
+  __m256i d = _mm256_set1_epi8( byte );
+  size_t i = 0;
+  for ( ; i + 64 <= len; i += 64 ) {
+    uint64_t lo = (uint32_t) _mm256_movemask_epi8(
+      _mm256_cmpeq_epi8( _mm256_loadu_si256( (__m256i const *) ( data + i ) ), d ) );
+    uint64_t hi = (uint32_t) _mm256_movemask_epi8(
+      _mm256_cmpeq_epi8( _mm256_loadu_si256( (__m256i const *) ( data + i + 32 ) ), d ) );
+    uint64_t mask = lo | hi << 32;
+    if ( mask )
+      return data + i + __builtin_ctzll( mask );
+  }
+  for ( ; i + 32 <= len; i += 32 ) {
+    unsigned int mask = _mm256_movemask_epi8(
+      _mm256_cmpeq_epi8( _mm256_loadu_si256( (__m256i const *) ( data + i ) ), d ) );
+    if ( mask )
+      return data + i + __builtin_ctz( mask );
+  }
+  return findByteScalar( data + i, len - i, byte );
+}
+
+/**
+  AVX2 version of findLastByte(), 64 bytes at a time from the end.
+
+  @param data region to search.
+  @param len number of bytes in data.
+  @param byte byte to look for.
+  @return pointer to the last occurrence, or NULL if there isn't one.
+*/
+__attribute__(( target( "avx2" ) ))
+static char const *findLastByteAVX2( char const *data, size_t len, char byte )
+{
+  __m256i d = _mm256_set1_epi8( byte );
+  for ( ; len >= 64; len -= 64 ) {
+    char const *p = data + len - 64;
+    uint64_t lo = (uint32_t) _mm256_movemask_epi8(
+      _mm256_cmpeq_epi8( _mm256_loadu_si256( (__m256i const *) p ), d ) );
+    uint64_t hi = (uint32_t) _mm256_movemask_epi8(
+      _mm256_cmpeq_epi8( _mm256_loadu_si256( (__m256i const *) ( p + 32 ) ), d ) );
+    uint64_t mask = lo | hi << 32;
+    if ( mask )
+      return p + 63 - __builtin_clzll( mask );
+  }
+  return findLastByteScalar( data, len, byte );
+}
+
+/**
+  SSE2 version of findSubstring(), checking 16 candidate positions at
+  a time.  A candidate survives if its first byte and the byte n - 1
+  after it both match; only survivors are compared in full.
+
+  @param data region to search.
+  @param len number of bytes in data.
+  @param str bytes to look for.
+  @param n number of bytes in str, at least 2.
+  @return pointer to the first occurrence, or NULL if there isn't one.
+*/
+__attribute__(( target( "sse2" ) ))
+static char const *findSubstringSSE2( char const *data, size_t len,
+                                      char const *str, size_t n )
+{
+  __m128i first = _mm_set1_epi8( str[ 0 ] );
+  __m128i last = _mm_set1_epi8( str[ n - 1 ] );
+  size_t i = 0;
+  for ( ; i + n - 1 + 16 <= len; i += 16 ) {
+    __m128i f = _mm_cmpeq_epi8(
+      _mm_loadu_si128( (__m128i const *) ( data + i ) ), first );
+    __m128i l = _mm_cmpeq_epi8(
+      _mm_loadu_si128( (__m128i const *) ( data + i + n - 1 ) ), last );
+    unsigned int mask = _mm_movemask_epi8( _mm_and_si128( f, l ) );
+    while ( mask ) {
+      int bit = __builtin_ctz( mask );
+      if ( memcmp( data + i + bit + 1, str + 1, n - 2 ) == 0 )
+        return data + i + bit;
+      mask &= mask - 1;
+    }
+  }
+  return findSubstringScalar( data + i, len - i, str, n );
+}
+
+/**
+  AVX2 version of findSubstring(), checking 32 candidate positions at
+  a time.
+
+  @param data region to search.
+  @param len number of bytes in data.
+  @param str bytes to look for.
+  @param n number of bytes in str, at least 2.
+  @return pointer to the first occurrence, or NULL if there isn't one.
+*/
+__attribute__(( target( "avx2" ) ))
+static char const *findSubstringAVX2( char const *data, size_t len,
+                                      char const *str, size_t n )
+{
+  __m256i first = _mm256_set1_epi8( str[ 0 ] );
+  __m256i last = _mm256_set1_epi8( str[ n - 1 ] );
+  size_t i = 0;
+  for ( ; i + n - 1 + 32 <= len; i += 32 ) {
+    __m256i f = _mm256_cmpeq_epi8(
+      _mm256_loadu_si256( (__m256i const *) ( data + i ) ), first );
+    __m256i l = _mm256_cmpeq_epi8(
+      _mm256_loadu_si256( (__m256i const *) ( data + i + n - 1 ) ), last );
+    unsigned int mask = _mm256_movemask_epi8( _mm256_and_si256( f, l ) );
+    while ( mask ) {
+      int bit = __builtin_ctz( mask );
+      if ( memcmp( data + i + bit + 1, str + 1, n - 2 ) == 0 )
+        return data + i + bit;
+      mask &= mask - 1;
+    }
+  }
+  return findSubstringScalar( data + i, len - i, str, n );
+}
+
+/**
+  SSE2 version of findSubstringFold(), checking 16 candidate positions
+  at a time.  The first and last bytes of each candidate are folded
+  with caseBit() before they're compared, so survivors only need the
+  rest of the string checked.
+
+  @param data region to search.
+  @param len number of bytes in data.
+  @param str bytes to look for, with any letters in lower case.
+  @param n number of bytes in str, at least 1.
+  @return pointer to the first occurrence, or NULL if there isn't one.
+*/
+__attribute__(( target( "sse2" ) ))
+static char const *findSubstringFoldSSE2( char const *data, size_t len,
+                                          char const *str, size_t n )
+{
+  __m128i first = _mm_set1_epi8( str[ 0 ] );
+  __m128i firstBit = _mm_set1_epi8( caseBit( str[ 0 ] ) );
+  __m128i last = _mm_set1_epi8( str[ n - 1 ] );
+  __m128i lastBit = _mm_set1_epi8( caseBit( str[ n - 1 ] ) );
+  size_t i = 0;
+  for ( ; i + n - 1 + 16 <= len; i += 16 ) {
+    __m128i f = _mm_cmpeq_epi8(
+      _mm_or_si128( _mm_loadu_si128( (__m128i const *) ( data + i ) ),
+                    firstBit ), first );
+    __m128i l = _mm_cmpeq_epi8(
+      _mm_or_si128( _mm_loadu_si128( (__m128i const *) ( data + i + n - 1 ) ),
+                    lastBit ), last );
+    unsigned int mask = _mm_movemask_epi8( _mm_and_si128( f, l ) );
+    while ( mask ) {
+      int bit = __builtin_ctz( mask );
+      if ( sameFolded( data + i + bit + 1, str + 1, n - 1 ) )
+        return data + i + bit;
+      mask &= mask - 1;
+    }
+  }
+  return findSubstringFoldScalar( data + i, len - i, str, n );
+}
+
+/**
+  AVX2 version of findSubstringFold(), checking 32 candidate positions
+  at a time.
+
+  @param data region to search.
+  @param len number of bytes in data.
+  @param str bytes to look for, with any letters in lower case.
+  @param n number of bytes in str, at least 1.
+  @return pointer to the first occurrence, or NULL if there isn't one.
+*/
+__attribute__(( target( "avx2" ) ))
+static char const *findSubstringFoldAVX2( char const *data, size_t len,
+                                          char const *str, size_t n )
+{
+  __m256i first = _mm256_set1_epi8( str[ 0 ] );
+  __m256i firstBit = _mm256_set1_epi8( caseBit( str[ 0 ] ) );
+  __m256i last = _mm256_set1_epi8( str[ n - 1 ] );
+  __m256i lastBit = _mm256_set1_epi8( caseBit( str[ n - 1 ] ) );
+  size_t i = 0;
+  for ( ; i + n - 1 + 32 <= len; i += 32 ) {
+    __m256i f = _mm256_cmpeq_epi8(
+      _mm256_or_si256( _mm256_loadu_si256( (__m256i const *) ( data + i ) ),
+                       firstBit ), first );
+    __m256i l = _mm256_cmpeq_epi8(
+      _mm256_or_si256(
+        _mm256_loadu_si256( (__m256i const *) ( data + i + n - 1 ) ),
+        lastBit ), last );
+    unsigned int mask = _mm256_movemask_epi8( _mm256_and_si256( f, l ) );
+    while ( mask ) {
+      int bit = __builtin_ctz( mask );
+      if ( sameFolded( data + i + bit + 1, str + 1, n - 1 ) )
+        return data + i + bit;
+      mask &= mask - 1;
+    }
+  }
+  return findSubstringFoldScalar( data + i, len - i, str, n );
+}
+
+#endif
+
+/** Version of findByte() to use, or NULL until we've checked the CPU. */
+static ScanFunction findByteKernel;
+
+/** Version of findLastByte() to use, or NULL until we've checked the CPU. */
+static ScanFunction findLastByteKernel;
+
+/** Version of findSubstring() to use, or NULL until we've checked the CPU. */
+static SearchFunction findSubstringKernel;
+
+/** Version of findSubstringFold() to use, or NULL until we've checked
+    the CPU. */
+static SearchFunction findSubstringFoldKernel;
+
+/**
+  Pick the best kernels for the CPU we're running on.  Threads may
+  race to do this, but they all pick the same ones.
+*/
+static void chooseKernels( void )
+{
+  ScanFunction first = findByteScalar;
+  ScanFunction last = findLastByteScalar;
+  SearchFunction search = findSubstringScalar;
+  SearchFunction searchFold = findSubstringFoldScalar;
+
+#ifdef HAVE_X86
+  __builtin_cpu_init();
+  if ( __builtin_cpu_supports( "avx2" ) ) {
+    first = findByteAVX2;
+    last = findLastByteAVX2;
+    search = findSubstringAVX2;
+    searchFold = findSubstringFoldAVX2;
+  }
+  else if ( __builtin_cpu_supports( "sse2" ) ) {
+    first = findByteSSE2;
+    last = findLastByteSSE2;
+    search = findSubstringSSE2;
+    searchFold = findSubstringFoldSSE2;
+  }
+#endif
+
+  __atomic_store_n( &findSubstringFoldKernel, searchFold, __ATOMIC_RELAXED );
+  __atomic_store_n( &findSubstringKernel, search, __ATOMIC_RELAXED );
+  __atomic_store_n( &findLastByteKernel, last, __ATOMIC_RELAXED );
+  __atomic_store_n( &findByteKernel, first, __ATOMIC_RELAXED );
+}
+
+// Documented in the header.
+char const *findByte( char const *data, size_t len, char byte )
+{
+  ScanFunction f = __atomic_load_n( &findByteKernel, __ATOMIC_RELAXED );
+  if ( !f ) {
+    chooseKernels();
+    f = __atomic_load_n( &findByteKernel, __ATOMIC_RELAXED );
+  }
+  return f( data, len, byte );
+}
+
+// Documented in the header.
+char const *findLastByte( char const *data, size_t len, char byte )
+{
+  ScanFunction f = __atomic_load_n( &findLastByteKernel, __ATOMIC_RELAXED );
+  if ( !f ) {
+    chooseKernels();
+    f = __atomic_load_n( &findLastByteKernel, __ATOMIC_RELAXED );
+  }
+  return f( data, len, byte );
+}
+
+// Documented in the header.
+char const *findSubstring( char const *data, size_t len, char const *str,
+                           size_t n )
+{
+  // The kernels need a first and a last byte to check.
+  if ( n == 0 )
+    return data;
+  if ( n == 1 )
+    return findByte( data, len, str[ 0 ] );
+  if ( n > len )
+    return NULL;
+
+  SearchFunction f = __atomic_load_n( &findSubstringKernel, __ATOMIC_RELAXED );
+  if ( !f ) {
+    chooseKernels();
+    f = __atomic_load_n( &findSubstringKernel, __ATOMIC_RELAXED );
+  }
+  return f( data, len, str, n );
+}
+
+// Documented in the header.
+char const *findSubstringFold( char const *data, size_t len,
+                               char const *str, size_t n )
+{
+  // Unlike findSubstring(), the kernels can handle a single byte.
+  if ( n == 0 )
+    return data;
+  if ( n > len )
+    return NULL;
+
+  SearchFunction f =
+    __atomic_load_n( &findSubstringFoldKernel, __ATOMIC_RELAXED );
+  if ( !f ) {
+    chooseKernels();
+    f = __atomic_load_n( &findSubstringFoldKernel, __ATOMIC_RELAXED );
+  }
+  return f( data, len, str, n );
+}
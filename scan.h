@@ -0,0 +1,72 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+
+/**
+  Fold an ASCII letter to lower case, leaving every other byte alone.
+  Unlike tolower(), it doesn't depend on the locale, and it's fine to
+  pass a char that's negative.
+
+  @param c byte to fold.
+  @return c in lower case.
+*/
+static inline char foldByte( char c )
+{
+  return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+}
+
+/**
+  Find the first occurrence of a byte in a region of memory, like
+  memchr().  Lines are split with this, so on x86 it uses SSE2 or
+  AVX2 to compare a whole block of bytes at once, picking the best one
+  the CPU supports the first time it's called.
+
+  @param data region to search.
+  @param len number of bytes in data.
+  @param byte byte to look for.
+  @return pointer to the first occurrence, or NULL if there isn't one.
+*/
+char const *findByte( char const *data, size_t len, char byte );
+
+/**
+  Find the last occurrence of a byte in a region of memory, with the
+  same kinds of kernels as findByte().
+
+  @param data region to search.
+  @param len number of bytes in data.
+  @param byte byte to look for.
+  @return pointer to the last occurrence, or NULL if there isn't one.
+*/
+char const *findLastByte( char const *data, size_t len, char byte );
+
+/**
+  Find the first occurrence of a string of bytes in a region of memory.
+  On x86, the vector kernels compare the first and last bytes of the
+  string against a whole block of positions at once, and only check
+  the rest of it where both of those match.
+
+  @param data region to search.
+  @param len number of bytes in data.
+  @param str bytes to look for.
+  @param n number of bytes in str.
+  @return pointer to the first occurrence, or NULL if there isn't one.
+*/
+char const *findSubstring( char const *data, size_t len, char const *str,
+                           size_t n );
+
+/**
+  Find the first occurrence of a string of bytes in a region of memory,
+  ignoring the case of ASCII letters.  It works like findSubstring(),
+  but a letter in the string matches the region in either case.
+
+  @param data region to search.
+  @param len number of bytes in data.
+  @param str bytes to look for, with any letters in lower case.
+  @param n number of bytes in str.
+  @return pointer to the first occurrence, or NULL if there isn't one.
+*/
+char const *findSubstringFold( char const *data, size_t len,
+                               char const *str, size_t n );
+
+#endif
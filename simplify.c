@@ -0,0 +1,758 @@
+/**
+ * @file simplify.c
+ * @author sdcroche
+ *
+ * Simplify rewrites the pattern tree built by the parser before
+ * anything is compiled from it.  Chains of concatenations and
+ * alternations are taken apart into flat lists of operands, rewritten,
+ * then built back up nesting to the left, the same way the parser
+ * builds them.  Runs of symbols are only merged into literals at the
+ * very end, so the other rewrites just have to compare single nodes.
+ */
+#include "simplify.h"
+#include <stdlib.h>
+#include <string.h>
+
+/** Initial capacity for a list of operands. */
+#define INITIAL_CAP 8
+
+/** Most nodes of a pattern that go into its hash. */
+#define HASH_NODES 32
+
+/** Largest count a repetition can have, the same limit the parser
+    puts on the ones in a pattern. */
+#define MAX_REPEAT 1000
+
+/** List of operands for a concatenation or an alternation. */
+typedef struct {
+  /** The operands, in order. */
+  Pattern **items;
+
+  /** Number of operands. */
+  int count;
+
+  /** Capacity of items. */
+  int cap;
+} PatternList;
+
+/**
+  Initialize an empty list of operands.
+
+  @param list list to initialize.
+*/
+static void initList( PatternList *list )
+{
+  list->count = 0;
+  list->cap = INITIAL_CAP;
+  list->items = (Pattern **) checkedMalloc( list->cap * sizeof( Pattern * ) );
+}
+
+/**
+  Add an operand to the end of a list.
+
+  @param list list to add to.
+  @param pat operand to add.
+*/
+static void append( PatternList *list, Pattern *pat )
+{
+  if ( list->count >= list->cap ) {
+    list->cap *= 2;
+    list->items = (Pattern **)
+      checkedRealloc( list->items, list->cap * sizeof( Pattern * ) );
+  }
+  list->items[ list->count++ ] = pat;
+}
+
+/**
+  Remove a range of operands from a list, without freeing them.
+
+  @param list list to remove from.
+  @param from index of the first operand to remove.
+  @param n number of operands to remove.
+*/
+static void removeRange( PatternList *list, int from, int n )
+{
+  memmove( list->items + from, list->items + from + n,
+           ( list->count - from - n ) * sizeof( Pattern * ) );
+  list->count -= n;
+}
+
+/**
+  Build a chain of concatenations or alternations from a list of
+  operands, nesting to the left, and free the list.
+
+  @param list operands for the chain; there must be at least one.
+  @param kind CONCATENATION_PATTERN or ALTERNATION_PATTERN.
+  @param arena arena to allocate the chain from.
+  @return the chain, or the only operand if there's just one.
+*/
+static Pattern *build( PatternList *list, PatternKind kind, Arena *arena )
+{
+  Pattern *pat = list->items[ 0 ];
+  for ( int i = 1; i < list->count; i++ )
+    if ( kind == CONCATENATION_PATTERN )
+      pat = makeConcatenationPattern( arena, pat, list->items[ i ] );
+    else
+      pat = makeAlterationPattern( arena, pat, list->items[ i ] );
+
+  free( list->items );
+  return pat;
+}
+
+/**
+  Add the operands of a chain that was built by build() to a list.
+  Chains nest to the left, so this
+  walks down p1 and adds the p2 operands in reverse.
+
+  @param list list to add to.
+  @param pat chain to take apart, or just a single operand.
+  @param kind CONCATENATION_PATTERN or ALTERNATION_PATTERN.
+*/
+static void splice( PatternList *list, Pattern *pat, PatternKind kind )
+{
+  int first = list->count;
+  while ( pat->kind == kind ) {
+    BinaryPattern *this = (BinaryPattern *) pat;
+    append( list, this->p2 );
+    pat = this->p1;
+  }
+  append( list, pat );
+
+  for ( int i = first, j = list->count - 1; i < j; i++, j-- ) {
+    Pattern *tmp = list->items[ i ];
+    list->items[ i ] = list->items[ j ];
+    list->items[ j ] = tmp;
+  }
+}
+
+/**
+  Report whether two patterns have exactly the same structure, so one
+  of them can stand in for the other.
+
+  @param a first pattern.
+  @param b second pattern.
+  @return true if they're the same.
+*/
+static bool samePattern( Pattern const *a, Pattern const *b )
+{
+  // Chains nest to the left, so loop down p1 instead of recursing.
+  while ( a->kind == b->kind && ( a->kind == CONCATENATION_PATTERN ||
+                                  a->kind == ALTERNATION_PATTERN ) ) {
+    BinaryPattern const *x = (BinaryPattern const *) a;
+    BinaryPattern const *y = (BinaryPattern const *) b;
+    if ( !samePattern( x->p2, y->p2 ) )
+      return false;
+    a = x->p1;
+    b = y->p1;
+  }
+
+  if ( a->kind != b->kind )
+    return false;
+
+  switch ( a->kind ) {
+  case SYMBOL_PATTERN:
+    return ( (SymbolPattern const *) a )->sym ==
+      ( (SymbolPattern const *) b )->sym;
+  case LITERAL_PATTERN: {
+    LiteralPattern const *x = (LiteralPattern const *) a;
+    LiteralPattern const *y = (LiteralPattern const *) b;
+    return x->len == y->len && memcmp( x->str, y->str, x->len ) == 0;
+  }
+  case TAG_PATTERN:
+    return ( (TagPattern const *) a )->tag == ( (TagPattern const *) b )->tag;
+  case CHARACTER_CLASS_PATTERN:
+    return memcmp( &( (CharacterClassPattern const *) a )->set,
+                   &( (CharacterClassPattern const *) b )->set,
+                   sizeof( ByteSet ) ) == 0;
+  case OPTIONAL_PATTERN:
+  case ASTERISK_PATTERN:
+  case PLUS_PATTERN:
+    return samePattern( ( (RepetitionPattern const *) a )->sym,
+                        ( (RepetitionPattern const *) b )->sym );
+  case COUNTED_PATTERN: {
+    CountedPattern const *x = (CountedPattern const *) a;
+    CountedPattern const *y = (CountedPattern const *) b;
+    return x->min == y->min && x->max == y->max &&
+      samePattern( x->sym, y->sym );
+  }
+  default:
+    // The ., ^ and $ symbols don't have anything else to compare.
+    return true;
+  }
+}
+
+/**
+  Hash a pattern's structure, so patterns that samePattern() says are
+  the same always have the same hash.  Only the first few nodes are
+  looked at, so hashing a deeply nested pattern at every level of it
+  doesn't take quadratic time.
+
+  @param pat pattern to hash.
+  @param budget pointer to the number of nodes left to look at, which
+                is used up as the pattern is hashed.
+  @return its hash.
+*/
+static unsigned int hashPattern( Pattern const *pat, int *budget )
+{
+  unsigned int h = 0;
+
+  // Chains nest to the left, so loop down p1 instead of recursing.
+  while ( *budget > 0 && ( pat->kind == CONCATENATION_PATTERN ||
+                           pat->kind == ALTERNATION_PATTERN ) ) {
+    BinaryPattern const *this = (BinaryPattern const *) pat;
+    (*budget)--;
+    h = h * 31 + pat->kind;
+    h = h * 31 + hashPattern( this->p2, budget );
+    pat = this->p1;
+  }
+  h = h * 31 + pat->kind;
+  if ( (*budget)-- <= 0 )
+    return h;
+
+  switch ( pat->kind ) {
+  case SYMBOL_PATTERN:
+    return h * 31 + (unsigned char) ( (SymbolPattern const *) pat )->sym;
+  case LITERAL_PATTERN: {
+    LiteralPattern const *this = (LiteralPattern const *) pat;
+    for ( int i = 0; i < this->len; i++ )
+      h = h * 31 + (unsigned char) this->str[ i ];
+    return h;
+  }
+  case TAG_PATTERN:
+    return h * 31 + ( (TagPattern const *) pat )->tag;
+  case CHARACTER_CLASS_PATTERN: {
+    ByteSet const *set = &( (CharacterClassPattern const *) pat )->set;
+    for ( int w = 0; w < 4; w++ )
+      h = h * 31 + (unsigned int) ( set->words[ w ] ^ set->words[ w ] >> 32 );
+    return h;
+  }
+  case OPTIONAL_PATTERN:
+  case ASTERISK_PATTERN:
+  case PLUS_PATTERN:
+    return h * 31 + hashPattern( ( (RepetitionPattern const *) pat )->sym,
+                                 budget );
+  case COUNTED_PATTERN: {
+    CountedPattern const *this = (CountedPattern const *) pat;
+    h = h * 31 + this->min;
+    h = h * 31 + this->max;
+    return h * 31 + hashPattern( this->sym, budget );
+  }
+  default:
+    return h;
+  }
+}
+
+/** Hash table of positions in an array of patterns, for finding ones
+    that are the same without comparing every pair. */
+typedef struct {
+  /** The patterns that positions refer to. */
+  Pattern **items;
+
+  /** Position in items for each slot, or -1 if the slot is empty. */
+  int *slots;
+
+  /** Hash of the pattern in each slot. */
+  unsigned int *hashes;
+
+  /** Number of slots, a power of two. */
+  int cap;
+} PatternIndex;
+
+/**
+  Initialize an empty index with room for a given number of patterns.
+
+  @param index index to initialize.
+  @param items array the positions in the index refer to.
+  @param n most patterns that will be added.
+*/
+static void initIndex( PatternIndex *index, Pattern **items, int n )
+{
+  index->items = items;
+  index->cap = 1;
+  while ( index->cap < 2 * n )
+    index->cap *= 2;
+  index->slots = (int *) checkedMalloc( index->cap * sizeof( int ) );
+  index->hashes =
+    (unsigned int *) checkedMalloc( index->cap * sizeof( unsigned int ) );
+  memset( index->slots, -1, index->cap * sizeof( int ) );
+}
+
+/**
+  Free the memory an index uses.
+
+  @param index index to free.
+*/
+static void freeIndex( PatternIndex *index )
+{
+  free( index->slots );
+  free( index->hashes );
+}
+
+/**
+  Look for a pattern that's the same as pat in an index, and add pat
+  at the given position if there isn't one.
+
+  @param index index to look in.
+  @param pat pattern to look for.
+  @param pos position to record for pat if it's new.
+  @return position of the same pattern already in the index, or pos
+          if pat was added.
+*/
+static int findOrAdd( PatternIndex *index, Pattern const *pat, int pos )
+{
+  int budget = HASH_NODES;
+  unsigned int h = hashPattern( pat, &budget );
+  int i = h & ( index->cap - 1 );
+  while ( index->slots[ i ] >= 0 ) {
+    if ( index->hashes[ i ] == h &&
+         samePattern( index->items[ index->slots[ i ] ], pat ) )
+      return index->slots[ i ];
+    i = ( i + 1 ) & ( index->cap - 1 );
+  }
+
+  index->slots[ i ] = pos;
+  index->hashes[ i ] = h;
+  return pos;
+}
+
+static Pattern *simplify( Pattern *pat, Arena *arena );
+
+/**
+  Add all the operands of a chain of concatenations or alternations
+  from the parser to a list, simplifying each one.  The parser can
+  nest a chain either way, with parentheses, so this uses its own
+  stack instead of recursing.
+
+  @param list list to add to.
+  @param pat chain to take apart.
+  @param kind CONCATENATION_PATTERN or ALTERNATION_PATTERN.
+  @param arena arena to allocate new nodes from.
+*/
+static void gather( PatternList *list, Pattern *pat, PatternKind kind,
+                    Arena *arena )
+{
+  PatternList stack;
+  initList( &stack );
+  append( &stack, pat );
+
+  while ( stack.count ) {
+    Pattern *p = stack.items[ --stack.count ];
+    if ( p->kind == kind ) {
+      BinaryPattern *this = (BinaryPattern *) p;
+      append( &stack, this->p2 );
+      append( &stack, this->p1 );
+    }
+    else {
+      // Simplifying an operand can turn it into a chain of the same
+      // kind, like a(b|c) from ab|ac inside a concatenation.
+      splice( list, simplify( p, arena ), kind );
+    }
+  }
+
+  free( stack.items );
+}
+
+/**
+  Make a repetition of an already simplified pattern, collapsing a
+  repetition of a repetition into one.  p** is p*, and any other mix
+  of two of *, + and ? is also p*, except p++ and p?? which stay as
+  they are.
+
+  @param kind OPTIONAL_PATTERN, ASTERISK_PATTERN or PLUS_PATTERN.
+  @param sub simplified pattern to repeat.
+  @param arena arena to allocate new nodes from.
+  @return the repetition.
+*/
+static Pattern *repetition( PatternKind kind, Pattern *sub, Arena *arena )
+{
+  if ( sub->kind == kind || sub->kind == ASTERISK_PATTERN )
+    return sub;
+
+  if ( sub->kind == OPTIONAL_PATTERN || sub->kind == PLUS_PATTERN )
+    return makeAsteriskPattern( arena, ( (RepetitionPattern *) sub )->sym );
+
+  if ( kind == OPTIONAL_PATTERN )
+    return makeOptionalPattern( arena, sub );
+  if ( kind == ASTERISK_PATTERN )
+    return makeAsteriskPattern( arena, sub );
+  return makePlusPattern( arena, sub );
+}
+
+/**
+  Report whether a run of operands in a list is the same as a
+  sequence, given as a chain of concatenations.
+
+  @param list list holding the run.
+  @param from index of the start of the run.
+  @param seq sequence to compare against.
+  @param n number of operands in seq.
+  @return true if the run matches.
+*/
+static bool sameRun( PatternList const *list, int from, Pattern const *seq,
+                     int n )
+{
+  // Compare from the end, since that's how the chain is nested.
+  for ( int i = n - 1; i > 0; i-- ) {
+    BinaryPattern const *this = (BinaryPattern const *) seq;
+    if ( !samePattern( list->items[ from + i ], this->p2 ) )
+      return false;
+    seq = this->p1;
+  }
+  return samePattern( list->items[ from ], seq );
+}
+
+/**
+  Build a concatenation from a list of simplified operands, none of
+  which are concatenations themselves.  A sequence right next to a
+  star of the same sequence, like p p* or p* p, becomes p+.
+
+  @param list operands to concatenate; the list is freed.
+  @param arena arena to allocate new nodes from.
+  @return the concatenation.
+*/
+static Pattern *sequence( PatternList *list, Arena *arena )
+{
+  for ( int i = 0; i < list->count; i++ ) {
+    if ( list->items[ i ]->kind != ASTERISK_PATTERN )
+      continue;
+    RepetitionPattern *star = (RepetitionPattern *) list->items[ i ];
+
+    // The sub-pattern may be a sequence too, like the ab in ab(ab)*.
+    int n = 1;
+    for ( Pattern const *p = star->sym; p->kind == CONCATENATION_PATTERN;
+          p = ( (BinaryPattern const *) p )->p1 )
+      n++;
+
+    int from;
+    if ( i >= n && sameRun( list, i - n, star->sym, n ) )
+      from = i - n;
+    else if ( i + n < list->count && sameRun( list, i + 1, star->sym, n ) )
+      from = i + 1;
+    else
+      continue;
+
+    list->items[ i ] = makePlusPattern( arena, star->sym );
+    removeRange( list, from, n );
+    if ( from < i )
+      i -= n;
+  }
+
+  return build( list, CONCATENATION_PATTERN, arena );
+}
+
+/**
+  Return the first operand of a sequence.
+
+  @param pat a concatenation, or any other pattern.
+  @return the first operand of the concatenation, or pat itself.
+*/
+static Pattern *headOf( Pattern *pat )
+{
+  while ( pat->kind == CONCATENATION_PATTERN )
+    pat = ( (BinaryPattern *) pat )->p1;
+  return pat;
+}
+
+/**
+  Report whether a pattern always matches exactly one byte, so it can
+  go in a character class.
+
+  @param pat pattern to check.
+  @return true if it matches a single byte.
+*/
+static bool singleByte( Pattern const *pat )
+{
+  return pat->kind == SYMBOL_PATTERN || pat->kind == ANY_PATTERN ||
+    pat->kind == CHARACTER_CLASS_PATTERN;
+}
+
+/**
+  Add the bytes a single-byte pattern matches to a set.
+
+  @param set set to add to.
+  @param pat a pattern that singleByte() is true for.
+*/
+static void addBytes( ByteSet *set, Pattern const *pat )
+{
+  if ( pat->kind == SYMBOL_PATTERN )
+    addToByteSet( set, ( (SymbolPattern const *) pat )->sym );
+  else if ( pat->kind == ANY_PATTERN ) {
+    // Lines never have a newline in them, so . never has to match one.
+    for ( int c = 0; c < 256; c++ )
+      if ( c != '\n' )
+        addToByteSet( set, c );
+  }
+  else {
+    ByteSet const *other = &( (CharacterClassPattern const *) pat )->set;
+    for ( int w = 0; w < 4; w++ )
+      set->words[ w ] |= other->words[ w ];
+  }
+}
+
+/**
+  Build an alternation from a list of simplified operands, none of
+  which are alternations themselves.  Duplicates are dropped, common
+  first operands are factored out, so ab|ac becomes a(b|c), and
+  single characters and classes are merged into one class.
+
+  @param list alternatives; the list is freed.
+  @param arena arena to allocate new nodes from.
+  @return the alternation.
+*/
+static Pattern *alternatives( PatternList *list, Arena *arena )
+{
+  // Drop duplicates, keeping the first of each.  The index makes this
+  // linear, even for a huge list of alternatives.
+  PatternIndex index;
+  initIndex( &index, list->items, list->count );
+  int n = 0;
+  for ( int i = 0; i < list->count; i++ ) {
+    Pattern *p = list->items[ i ];
+    if ( findOrAdd( &index, p, n ) == n )
+      list->items[ n++ ] = p;
+  }
+  list->count = n;
+  freeIndex( &index );
+
+  // Put alternatives that start with the same operand in a group.
+  // Each one links to the next one in its group, and group[ i ] is
+  // the first one, which is where the whole group goes.
+  Pattern **heads = (Pattern **) checkedMalloc( n * sizeof( Pattern * ) );
+  int *group = (int *) checkedMalloc( n * sizeof( int ) );
+  int *next = (int *) checkedMalloc( n * sizeof( int ) );
+  int *last = (int *) checkedMalloc( n * sizeof( int ) );
+  initIndex( &index, heads, n );
+  for ( int i = 0; i < n; i++ ) {
+    heads[ i ] = headOf( list->items[ i ] );
+    int g = group[ i ] = findOrAdd( &index, heads[ i ], i );
+    next[ i ] = -1;
+    if ( g != i )
+      next[ last[ g ] ] = i;
+    last[ g ] = i;
+  }
+  freeIndex( &index );
+
+  PatternList out;
+  initList( &out );
+  for ( int i = 0; i < n; i++ ) {
+    if ( group[ i ] != i )
+      continue;
+    if ( next[ i ] < 0 ) {
+      append( &out, list->items[ i ] );
+      continue;
+    }
+
+    // Split every alternative in the group into the shared head and
+    // what's left after it.  There's only one that's just the head,
+    // since duplicates are gone.
+    PatternList rest;
+    initList( &rest );
+    bool empty = false;
+    for ( int j = i; j >= 0; j = next[ j ] ) {
+      PatternList parts;
+      initList( &parts );
+      splice( &parts, list->items[ j ], CONCATENATION_PATTERN );
+      if ( parts.count > 1 ) {
+        removeRange( &parts, 0, 1 );
+        splice( &rest, build( &parts, CONCATENATION_PATTERN, arena ),
+                ALTERNATION_PATTERN );
+      }
+      else {
+        free( parts.items );
+        empty = true;
+      }
+    }
+
+    Pattern *tail = alternatives( &rest, arena );
+    if ( empty )
+      tail = repetition( OPTIONAL_PATTERN, tail, arena );
+
+    PatternList seq;
+    initList( &seq );
+    append( &seq, heads[ i ] );
+    splice( &seq, tail, CONCATENATION_PATTERN );
+    append( &out, sequence( &seq, arena ) );
+  }
+  free( heads );
+  free( group );
+  free( next );
+  free( last );
+  free( list->items );
+
+  // Merge all the single bytes into one class, where the first of
+  // them was.
+  int first = -1, singles = 0;
+  ByteSet set = { { 0, 0, 0, 0 } };
+  n = 0;
+  for ( int i = 0; i < out.count; i++ ) {
+    Pattern *p = out.items[ i ];
+    if ( singleByte( p ) ) {
+      addBytes( &set, p );
+      if ( singles++ )
+        continue;
+      first = n;
+    }
+    out.items[ n++ ] = p;
+  }
+  out.count = n;
+  if ( singles > 1 )
+    out.items[ first ] = makeCharacterClassPattern( arena, &set );
+
+  return build( &out, ALTERNATION_PATTERN, arena );
+}
+
+/**
+  Fold a counted repetition of a counted repetition into one count, if
+  that means the same thing.  p{a,b}{c,d} repeats p anywhere from ka
+  to kb times for each k from c to d, and that's p{ac,bd} as long as
+  there aren't any gaps between those ranges and the counts don't get
+  too big.  Otherwise nested counts would need a counter for each one.
+
+  @param this the outer repetition, with its operand simplified.
+*/
+static void foldCounts( CountedPattern *this )
+{
+  if ( this->sym->kind != COUNTED_PATTERN )
+    return;
+  CountedPattern *inner = (CountedPattern *) this->sym;
+  long long a = inner->min, b = inner->max;
+  long long c = this->min, d = this->max;
+
+  // The range for k + 1 has to start right after the one for k, or
+  // overlap it, which is easiest for the smallest k.
+  bool joined = c == 0 ? a <= 1 :
+    d == c || b < 0 || c * ( b - a ) >= a - 1;
+  long long max = b == 0 || d == 0 ? 0 : b < 0 || d < 0 ? -1 : b * d;
+  if ( !joined || a * c > MAX_REPEAT || max > MAX_REPEAT )
+    return;
+
+  this->min = a * c;
+  this->max = max;
+  this->sym = inner->sym;
+}
+
+/**
+  Simplify a pattern, everything but merging runs of symbols.
+
+  @param pat pattern to simplify; it's used up to build the result.
+  @param arena arena to allocate new nodes from.
+  @return the simplified pattern.
+*/
+static Pattern *simplify( Pattern *pat, Arena *arena )
+{
+  switch ( pat->kind ) {
+  case CONCATENATION_PATTERN: {
+    PatternList list;
+    initList( &list );
+    gather( &list, pat, CONCATENATION_PATTERN, arena );
+    return sequence( &list, arena );
+  }
+  case ALTERNATION_PATTERN: {
+    PatternList list;
+    initList( &list );
+    gather( &list, pat, ALTERNATION_PATTERN, arena );
+    return alternatives( &list, arena );
+  }
+  case OPTIONAL_PATTERN:
+  case ASTERISK_PATTERN:
+  case PLUS_PATTERN: {
+    RepetitionPattern *this = (RepetitionPattern *) pat;
+    PatternKind kind = pat->kind;
+    Pattern *sub = simplify( this->sym, arena );
+    return repetition( kind, sub, arena );
+  }
+  case COUNTED_PATTERN: {
+    // Counts that mean the same as *, + or ? are cheaper that way.
+    CountedPattern *this = (CountedPattern *) pat;
+    this->sym = simplify( this->sym, arena );
+    foldCounts( this );
+    PatternKind kind;
+    if ( this->min == 1 && this->max == 1 ) {
+      Pattern *sub = this->sym;
+      return sub;
+    }
+    else if ( this->min == 0 && this->max < 0 )
+      kind = ASTERISK_PATTERN;
+    else if ( this->min == 1 && this->max < 0 )
+      kind = PLUS_PATTERN;
+    else if ( this->min == 0 && this->max == 1 )
+      kind = OPTIONAL_PATTERN;
+    else
+      return pat;
+    Pattern *sub = this->sym;
+    return repetition( kind, sub, arena );
+  }
+  default:
+    return pat;
+  }
+}
+
+/**
+  Replace every run of two or more symbols in a row with a literal.
+
+  @param pat simplified pattern; it's used up to build the result.
+  @param arena arena to allocate new nodes from.
+  @return the pattern with literals in it.
+*/
+static Pattern *mergeLiterals( Pattern *pat, Arena *arena )
+{
+  switch ( pat->kind ) {
+  case CONCATENATION_PATTERN: {
+    PatternList list, out;
+    initList( &list );
+    initList( &out );
+    splice( &list, pat, CONCATENATION_PATTERN );
+
+    for ( int i = 0; i < list.count; ) {
+      int j = i;
+      while ( j < list.count && list.items[ j ]->kind == SYMBOL_PATTERN )
+        j++;
+
+      if ( j - i >= 2 ) {
+        char *run = (char *) checkedMalloc( j - i );
+        for ( int k = i; k < j; k++ ) {
+          run[ k - i ] = ( (SymbolPattern *) list.items[ k ] )->sym;
+        }
+        append( &out, makeLiteralPattern( arena, run, j - i ) );
+        free( run );
+        i = j;
+      }
+      else {
+        append( &out, mergeLiterals( list.items[ i ], arena ) );
+        i++;
+      }
+    }
+
+    free( list.items );
+    return build( &out, CONCATENATION_PATTERN, arena );
+  }
+  case ALTERNATION_PATTERN: {
+    PatternList list;
+    initList( &list );
+    splice( &list, pat, ALTERNATION_PATTERN );
+    for ( int i = 0; i < list.count; i++ )
+      list.items[ i ] = mergeLiterals( list.items[ i ], arena );
+    return build( &list, ALTERNATION_PATTERN, arena );
+  }
+  case OPTIONAL_PATTERN:
+  case ASTERISK_PATTERN:
+  case PLUS_PATTERN: {
+    RepetitionPattern *this = (RepetitionPattern *) pat;
+    this->sym = mergeLiterals( this->sym, arena );
+    return pat;
+  }
+  case COUNTED_PATTERN: {
+    CountedPattern *this = (CountedPattern *) pat;
+    this->sym = mergeLiterals( this->sym, arena );
+    return pat;
+  }
+  default:
+    return pat;
+  }
+}
+
+// Documented in the header.
+Pattern *simplifyPattern( Pattern *pat, Arena *arena )
+{
+  return mergeLiterals( simplify( pat, arena ), arena );
+}
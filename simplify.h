@@ -0,0 +1,21 @@
+#ifndef SIMPLIFY_H
+#define SIMPLIFY_H
+
+#include "pattern.h"
+
+/**
+  Rewrite a pattern tree from the parser into an equivalent one with
+  fewer, cheaper nodes.  Nested concatenations and alternations are
+  flattened, repetitions of repetitions are collapsed, alternations of
+  single characters become character classes, common prefixes are
+  factored out of alternations and runs of ordinary symbols become
+  literals.  The result matches exactly the same strings.
+
+  @param pat pattern to simplify; it's used up to build the result, so
+             it mustn't be used afterward.
+  @param arena arena pat was allocated from, where new nodes go too.
+  @return the simplified pattern.
+*/
+Pattern *simplifyPattern( Pattern *pat, Arena *arena );
+
+#endif
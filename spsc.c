@@ -0,0 +1,54 @@
+/**
+ * @file spsc.c
+ * @author sdcroche
+ *
+ * Spsc is a bounded, lock-free queue with one producer and one
+ * consumer.  The producer publishes an item by storing the tail index
+ * with release ordering after writing the item, and the consumer
+ * frees a slot the same way with the head index.
+ */
+#include "spsc.h"
+#include <stdlib.h>
+
+// Documented in the header.
+void initSpsc( SpscQueue *q, unsigned long cap )
+{
+  q->head = 0;
+  q->tail = 0;
+  q->cap = 1;
+  while ( q->cap < cap )
+    q->cap *= 2;
+  q->items = (void **) malloc( q->cap * sizeof( void * ) );
+}
+
+// Documented in the header.
+void freeSpsc( SpscQueue *q )
+{
+  free( q->items );
+}
+
+// Documented in the header.
+bool pushSpsc( SpscQueue *q, void *item )
+{
+  unsigned long t = __atomic_load_n( &q->tail, __ATOMIC_RELAXED );
+  unsigned long h = __atomic_load_n( &q->head, __ATOMIC_ACQUIRE );
+  if ( t - h == q->cap )
+    return false;
+
+  q->items[ t & ( q->cap - 1 ) ] = item;
+  __atomic_store_n( &q->tail, t + 1, __ATOMIC_RELEASE );
+  return true;
+}
+
+// Documented in the header.
+bool popSpsc( SpscQueue *q, void **item )
+{
+  unsigned long h = __atomic_load_n( &q->head, __ATOMIC_RELAXED );
+  unsigned long t = __atomic_load_n( &q->tail, __ATOMIC_ACQUIRE );
+  if ( h == t )
+    return false;
+
+  *item = q->items[ h & ( q->cap - 1 ) ];
+  __atomic_store_n( &q->head, h + 1, __ATOMIC_RELEASE );
+  return true;
+}
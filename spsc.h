@@ -0,0 +1,64 @@
+#ifndef SPSC_H
+#define SPSC_H
+
+#include <stdbool.h>
+
+/** A short name to use for the single-producer, single-consumer queue. */
+typedef struct SpscQueueStruct SpscQueue;
+
+/**
+  Lock-free bounded queue for handing items from one thread to
+  another.  Only one thread may push and only one thread may pop.
+  Each side only writes its own index, so neither ever has to wait
+  for the other; the queue just reports when it's full or empty.
+*/
+struct SpscQueueStruct {
+  /** Index of the next item to pop; only the consumer writes it. */
+  unsigned long head;
+
+  /** Index of the next item to push; only the producer writes it. */
+  unsigned long tail;
+
+  /** Circular array of items. */
+  void **items;
+
+  /** Number of slots in items, a power of two. */
+  unsigned long cap;
+};
+
+/**
+  Initialize an empty queue.
+
+  @param q queue to initialize.
+  @param cap number of items the queue can hold, rounded up to a
+             power of two.
+*/
+void initSpsc( SpscQueue *q, unsigned long cap );
+
+/**
+  Free the memory held by a queue.
+
+  @param q queue to free the contents of.
+*/
+void freeSpsc( SpscQueue *q );
+
+/**
+  Add an item to the back of the queue.  Only the producer may call this.
+
+  @param q queue to add to.
+  @param item item to add.
+  @return false if the queue was full.
+*/
+bool pushSpsc( SpscQueue *q, void *item );
+
+/**
+  Remove the item at the front of the queue.  Only the consumer may
+  call this.
+
+  @param q queue to take an item from.
+  @param item where to store the item.
+  @return false if the queue was empty.
+*/
+bool popSpsc( SpscQueue *q, void **item );
+
+#endif
@@ -0,0 +1,306 @@
+/**
+ * @file stats.c
+ * @author sdcroche
+ *
+ * Stats keeps the counts for --stats, how long each phase took and
+ * how much work each step of the program did, and writes them out as
+ * a report.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "stats.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/** Most characters of a step's part of the pattern to show. */
+#define SHOW_WIDTH 40
+
+/** Room for the part of the pattern a step matches.  It holds one
+    character more than is shown, so we can tell when it was cut off. */
+#define TEXT_CAP ( SHOW_WIDTH + 2 )
+
+/** Bytes in a kilobyte, for the table memory column. */
+#define KILOBYTE 1024.0
+
+/** Nanoseconds in a second. */
+#define NANOS 1e9
+
+/** Part of the pattern a step matches, cut off past SHOW_WIDTH + 1
+    characters. */
+typedef struct {
+  /** The text, always null-terminated. */
+  char str[ TEXT_CAP ];
+
+  /** Number of characters in str. */
+  int len;
+} StepText;
+
+// Documented in the header.
+long long clockNanos( void )
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Documented in the header.
+Stats *makeStats( Program const *prog )
+{
+  Stats *stats = (Stats *) calloc( 1, sizeof( Stats ) );
+  stats->count = prog->count;
+  stats->steps = (StepStats *) calloc( prog->count ? prog->count : 1,
+                                       sizeof( StepStats ) );
+  return stats;
+}
+
+// Documented in the header.
+void freeStats( Stats *stats )
+{
+  free( stats->steps );
+  free( stats );
+}
+
+/**
+  Add characters to the end of a step's text, dropping any that don't
+  fit.
+
+  @param t text to add to.
+  @param str characters to add.
+  @param n number of characters.
+*/
+static void appendText( StepText *t, char const *str, int n )
+{
+  if ( n > TEXT_CAP - 1 - t->len )
+    n = TEXT_CAP - 1 - t->len;
+  memcpy( t->str + t->len, str, n );
+  t->len += n;
+  t->str[ t->len ] = '\0';
+}
+
+/**
+  Add one byte of the pattern to a step's text, with a backslash in
+  front if it's a metacharacter, or as a hex escape if it can't be
+  printed.
+
+  @param t text to add to.
+  @param c byte to add.
+  @param special metacharacters that need a backslash.
+*/
+static void appendByte( StepText *t, unsigned char c, char const *special )
+{
+  char buf[ 8 ];
+  int n;
+  if ( c < ' ' || c > '~' )
+    n = snprintf( buf, sizeof( buf ), "\\x%02x", c );
+  else if ( strchr( special, c ) )
+    n = snprintf( buf, sizeof( buf ), "\\%c", c );
+  else
+    n = snprintf( buf, sizeof( buf ), "%c", c );
+  appendText( t, buf, n );
+}
+
+/**
+  Write a byte set as a pattern: a single byte, a period for
+  everything but a newline, or a class listing ranges.  Sets with more
+  than half the bytes are written as a negated class.
+
+  @param t text to add to.
+  @param set byte set to write.
+*/
+static void appendByteSet( StepText *t, ByteSet const *set )
+{
+  int members = 0, only = 0;
+  for ( int c = 0; c < 256; c++ )
+    if ( inByteSet( set, c ) ) {
+      members++;
+      only = c;
+    }
+
+  if ( members == 1 ) {
+    appendByte( t, only, ".^$*?+|()[{\\" );
+    return;
+  }
+  if ( members == 255 && !inByteSet( set, '\n' ) ) {
+    appendText( t, ".", 1 );
+    return;
+  }
+
+  // List the bytes in the set, or the ones out of it besides newline.
+  bool negate = members > 128;
+  appendText( t, negate ? "[^" : "[", negate ? 2 : 1 );
+  for ( int c = 0; c < 256; c++ ) {
+    if ( inByteSet( set, c ) == negate || ( negate && c == '\n' ) )
+      continue;
+    int hi = c;
+    while ( hi < 255 && inByteSet( set, hi + 1 ) != negate &&
+            !( negate && hi + 1 == '\n' ) )
+      hi++;
+    appendByte( t, c, "]\\" );
+    if ( hi > c + 1 )
+      appendText( t, "-", 1 );
+    if ( hi > c )
+      appendByte( t, hi, "]\\" );
+    c = hi;
+  }
+  appendText( t, "]", 1 );
+}
+
+/**
+  Report how tightly a step's text binds, so we know when it needs
+  parentheses as an operand: 0 for an alternation, 1 for a
+  concatenation and 2 for anything that can be repeated as it is.
+
+  @param s step to check.
+  @return its precedence.
+*/
+static int precedence( Step const *s )
+{
+  if ( s->op == ALTERNATE_STEP )
+    return 0;
+  if ( s->op == CONCAT_STEP || ( s->op == LITERAL_STEP && s->len > 1 ) )
+    return 1;
+  return 2;
+}
+
+/**
+  Add an operand's text to a step's text, in parentheses if it binds
+  more loosely than the step needs.
+
+  @param t text to add to.
+  @param prog program holding the steps.
+  @param texts text for each step so far.
+  @param j index of the operand's last step.
+  @param need precedence the operand needs to have.
+*/
+static void appendOperand( StepText *t, Program const *prog,
+                           StepText const *texts, int j, int need )
+{
+  bool paren = precedence( prog->steps + j ) < need;
+  if ( paren )
+    appendText( t, "(", 1 );
+  appendText( t, texts[ j ].str, texts[ j ].len );
+  if ( paren )
+    appendText( t, ")", 1 );
+}
+
+/**
+  Work out the part of the pattern each step matches.  Steps are in
+  postfix order, so each one's text is built from its operands', and
+  since the text is cut off at a fixed width, this takes time in
+  proportion to the number of steps.
+
+  @param prog program to describe.
+  @return dynamically allocated text for each step.
+*/
+static StepText *describeSteps( Program const *prog )
+{
+  StepText *texts = (StepText *) calloc( prog->count ? prog->count : 1,
+                                         sizeof( StepText ) );
+  for ( int i = 0; i < prog->count; i++ ) {
+    Step const *s = prog->steps + i;
+    StepText *t = texts + i;
+    char buf[ 32 ];
+    switch ( s->op ) {
+    case BYTE_STEP:
+      appendByteSet( t, prog->sets + s->arg );
+      break;
+    case LITERAL_STEP:
+      for ( int k = 0; k < s->len; k++ )
+        appendByte( t, prog->text[ s->arg + k ], ".^$*?+|()[{\\" );
+      break;
+    case START_STEP:
+      appendText( t, "^", 1 );
+      break;
+    case END_STEP:
+      appendText( t, "$", 1 );
+      break;
+    case TAG_STEP:
+      break;
+    case CONCAT_STEP:
+      appendOperand( t, prog, texts, firstOperand( prog, i ), 1 );
+      appendOperand( t, prog, texts, i - 1, 1 );
+      break;
+    case ALTERNATE_STEP:
+      appendOperand( t, prog, texts, firstOperand( prog, i ), 0 );
+      appendText( t, "|", 1 );
+      appendOperand( t, prog, texts, i - 1, 0 );
+      break;
+    case OPTIONAL_STEP:
+    case STAR_STEP:
+    case PLUS_STEP:
+      appendOperand( t, prog, texts, i - 1, 2 );
+      appendText( t, s->op == OPTIONAL_STEP ? "?" :
+                  s->op == STAR_STEP ? "*" : "+", 1 );
+      break;
+    case COUNT_STEP: {
+      appendOperand( t, prog, texts, i - 1, 2 );
+      int n;
+      if ( s->max == s->min )
+        n = snprintf( buf, sizeof( buf ), "{%d}", s->min );
+      else if ( s->max < 0 )
+        n = snprintf( buf, sizeof( buf ), "{%d,}", s->min );
+      else
+        n = snprintf( buf, sizeof( buf ), "{%d,%d}", s->min, s->max );
+      appendText( t, buf, n );
+      break;
+    }
+    }
+  }
+
+  return texts;
+}
+
+/**
+  Return a short name for what a step does.
+
+  @param op operation of the step.
+  @return its name.
+*/
+static char const *stepName( StepOp op )
+{
+  switch ( op ) {
+  case BYTE_STEP:      return "byte";
+  case LITERAL_STEP:   return "literal";
+  case START_STEP:     return "start";
+  case END_STEP:       return "end";
+  case TAG_STEP:       return "tag";
+  case CONCAT_STEP:    return "concat";
+  case ALTERNATE_STEP: return "alternate";
+  case OPTIONAL_STEP:  return "optional";
+  case STAR_STEP:      return "star";
+  case PLUS_STEP:      return "plus";
+  case COUNT_STEP:     return "count";
+  }
+  return "?";
+}
+
+// Documented in the header.
+void reportStats( FILE *fp, Stats const *stats, Program const *prog )
+{
+  fprintf( fp, "phase        seconds\n" );
+  fprintf( fp, "parse     %10.6f\n", stats->parse / NANOS );
+  fprintf( fp, "compile   %10.6f\n", stats->compile / NANOS );
+  fprintf( fp, "match     %10.6f\n", stats->match / NANOS );
+  fprintf( fp, "output    %10.6f\n", stats->output / NANOS );
+  fprintf( fp, "\nmatch tables: %ld lines, %ld over budget\n",
+           stats->tableLines, stats->overBudget );
+
+  // Steps that never ran are left out, since there's nothing to see
+  // for them, and a big program can have a lot of them.
+  if ( !stats->tableLines && !stats->overBudget )
+    return;
+  StepText *texts = describeSteps( prog );
+  fprintf( fp, "\n%6s  %-9s %10s %14s %12s %10s  %s\n", "step", "node",
+           "calls", "cells", "table KB", "seconds", "pattern" );
+  for ( int i = 0; i < stats->count; i++ ) {
+    StepStats const *st = stats->steps + i;
+    if ( !st->calls )
+      continue;
+    fprintf( fp, "%6d  %-9s %10ld %14zu %12.1f %10.6f  %.*s%s\n", i,
+             stepName( prog->steps[ i ].op ), st->calls, st->cells,
+             st->bytes / KILOBYTE, st->nanos / NANOS, SHOW_WIDTH,
+             texts[ i ].str, texts[ i ].len > SHOW_WIDTH ? "..." : "" );
+  }
+  free( texts );
+}
@@ -0,0 +1,92 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include "program.h"
+
+/**
+  Work done by one step of a program, added up over every line the
+  match tables were built for.  Each step is one node of the simplified
+  pattern, so this shows which part of a pattern the time goes to.
+  Worker threads all add to the same counts, so they're only updated
+  with atomic operations.
+*/
+struct StepStatsStruct {
+  /** Number of times the step was run, once per call to
+      locateMatches() that got as far as it. */
+  long calls;
+
+  /** Table cells the step cleared, filled in or checked. */
+  size_t cells;
+
+  /** Bytes of match tables the step borrowed from the pool. */
+  size_t bytes;
+
+  /** Time spent running the step, in nanoseconds. */
+  long long nanos;
+};
+
+/** Counts for --stats, for the whole run. */
+typedef struct {
+  /** Time spent parsing the pattern, in nanoseconds. */
+  long long parse;
+
+  /** Time spent simplifying and compiling it, or loading it. */
+  long long compile;
+
+  /** Time spent reading and matching the input, including output. */
+  long long match;
+
+  /** Time spent formatting and writing matching lines, added up over
+      every thread. */
+  long long output;
+
+  /** Lines whose matches were found with the match tables. */
+  long tableLines;
+
+  /** Lines the match tables gave up on when the budget ran out. */
+  long overBudget;
+
+  /** Counts for each step of the program. */
+  StepStats *steps;
+
+  /** Number of steps. */
+  int count;
+} Stats;
+
+/**
+  Return the time from a clock that only moves forward, for measuring
+  how long things take.
+
+  @return the current time, in nanoseconds.
+*/
+long long clockNanos( void );
+
+/**
+  Make an empty set of counts for a program.
+
+  @param prog program whose steps will be counted.
+  @return dynamically allocated counts, all zero.
+*/
+Stats *makeStats( Program const *prog );
+
+/**
+  Free a set of counts.
+
+  @param stats counts to free.
+*/
+void freeStats( Stats *stats );
+
+/**
+  Write a report of the counts, with the time for each phase and then
+  a line for each step of the program, showing the part of the pattern
+  it matches.
+
+  @param fp stream to write the report to.
+  @param stats counts to report.
+  @param prog program the counts are for.
+*/
+void reportStats( FILE *fp, Stats const *stats, Program const *prog );
+
+#endif
@@ -0,0 +1,168 @@
+#!/bin/bash
+# Runs regular on the files in input/ and checks what it prints against
+# the files in expected-output/.  Test NN has to write expected-NN.txt
+# to standard output and stderr-NN.txt to standard error, or nothing
+# where there's no such file, and exit with the status given for it.
+# Timings from --stats change from run to run, so every digit in the
+# error output of a test with --stats is compared as a 0.
+FAIL=0
+
+# Run one test: its number, the exit status it should have, and then
+# the arguments to run regular with.
+testRegular() {
+  TESTNO=$1
+  ESTATUS=$2
+  shift 2
+
+  rm -f output.txt stderr.txt
+
+  echo "Test $TESTNO: ./regular $*"
+  ./regular "$@" > output.txt 2> stderr.txt
+  STATUS=$?
+
+  for ARG in "$@"; do
+    if [ "$ARG" == "--stats" ]; then
+      sed -i 's/[0-9]/0/g' stderr.txt
+    fi
+  done
+
+  EXPECTED=expected-output/expected-$TESTNO.txt
+  ESTDERR=expected-output/stderr-$TESTNO.txt
+  [ -f "$EXPECTED" ] || EXPECTED=/dev/null
+  [ -f "$ESTDERR" ] || ESTDERR=/dev/null
+
+  if [ $STATUS -ne $ESTATUS ]; then
+    echo "**** Test $TESTNO FAILED - incorrect exit status. Expected: $ESTATUS Got: $STATUS"
+    FAIL=1
+    return 1
+  fi
+
+  if ! diff -q "$EXPECTED" output.txt >/dev/null 2>&1; then
+    echo "**** Test $TESTNO FAILED - output didn't match the expected output"
+    FAIL=1
+    return 1
+  fi
+
+  if ! diff -q "$ESTDERR" stderr.txt >/dev/null 2>&1; then
+    echo "**** Test $TESTNO FAILED - error output didn't match the expected error output"
+    FAIL=1
+    return 1
+  fi
+
+  echo "Test $TESTNO PASS"
+  return 0
+}
+
+# make a fresh copy of the target program
+make clean
+make
+if [ $? -ne 0 ]; then
+  echo "**** Make (compile) FAILED"
+  exit 1
+fi
+
+testRegular 01 0 'x' input/input-01.txt
+testRegular 02 0 'h' input/input-02.txt
+testRegular 03 0 'c' input/input-03.txt
+testRegular 04 0 'abc' input/input-04.txt
+testRegular 05 0 'a.c' input/input-05.txt
+testRegular 06 0 'a..c' input/input-06.txt
+testRegular 07 0 '^123' input/input-07.txt
+testRegular 08 0 'wxyz$' input/input-08.txt
+testRegular 09 0 'a[bcdef]g' input/input-09.txt
+testRegular 10 0 'abc|def|ghi' input/input-10.txt
+testRegular 11 0 'ab*c' input/input-11.txt
+testRegular 12 0 'ab+c' input/input-12.txt
+testRegular 13 0 'ab?c' input/input-13.txt
+testRegular 14 0 'a(bc)*d' input/input-14.txt
+testRegular 15 0 '^Your (license|application|program) has been (revoked|accepted|tested)!$' input/input-15.txt
+testRegular 16 0 '[0123456789]+\.[0123456789]+' input/input-16.txt
+testRegular 17 1 'a(b' input/input-17.txt
+testRegular 18 1 'ab|*c' input/input-18.txt
+testRegular 19 1 'abc' not-a-file.txt
+testRegular 20 1
+testRegular 21 1 'this|that' input/input-21.txt
+
+# -l lists the inputs with a match, and -q just sets the exit status.
+# Neither reads past the first match, so a long line after it is fine.
+testRegular 22 0 -l 'cat' input/input-22.txt input/input-23.txt input/input-24.txt
+testRegular 23 1 -l 'cow' input/input-22.txt input/input-23.txt
+testRegular 24 0 -l 'this' input/input-21.txt
+testRegular 25 0 -q 'og$' input/input-23.txt
+testRegular 26 1 -q 'cat' input/input-23.txt
+
+# -c counts the matching lines, labeled with the file name when there's
+# more than one file, with or without worker threads.
+testRegular 27 0 -c 'cat' input/input-22.txt input/input-23.txt input/input-24.txt
+testRegular 28 0 -c 'a.c' input/input-05.txt
+testRegular 29 0 -j 3 -c 'c' input/input-03.txt
+
+# -o prints each match on its own line, including matches right next
+# to each other, highlighted unless color is turned off.
+testRegular 30 0 -o --color=never 'ab' input/input-30.txt
+testRegular 31 0 -o --color=never 'cat|dog' input/input-30.txt
+testRegular 32 0 -o '[0123456789]+|[abcdef]+' input/input-30.txt
+testRegular 31 0 -o -j 2 --color=never 'cat|dog' input/input-30.txt
+
+# A pattern saved with --save-compiled matches the same lines once it's
+# loaded back with --load-compiled, and a file that isn't one is refused.
+testRegular 33 0 --save-compiled compiled.bin 'a..c'
+testRegular 34 0 --load-compiled compiled.bin input/input-06.txt
+testRegular 35 1 --load-compiled input/input-01.txt input/input-06.txt
+rm -f compiled.bin
+
+# -f matches the patterns in a file, and each matching line starts with
+# the numbers of the ones that matched it, even if there's only one.
+# That's still true once the patterns are saved and loaded back.
+testRegular 36 0 -f input/input-36.txt --color=never input/input-38.txt
+testRegular 37 0 -f input/input-37.txt input/input-38.txt
+testRegular 38 0 -f input/input-36.txt --save-compiled compiled.bin
+testRegular 39 0 --load-compiled compiled.bin --color=never input/input-38.txt
+testRegular 40 0 -f input/input-37.txt --save-compiled compiled.bin
+testRegular 41 0 --load-compiled compiled.bin input/input-38.txt
+rm -f compiled.bin
+
+# -i matches letters in either case, in literals, in classes and ranges
+# (so a negated class leaves out both cases) and in a saved pattern.
+testRegular 42 0 -i 'hello' input/input-42.txt
+testRegular 43 0 -i -o --color=never '[a-c]+' input/input-42.txt
+testRegular 44 0 -i -o --color=never '[^a-z ]+' input/input-42.txt
+testRegular 45 0 -i '[M-Z]i[W-Z]' input/input-42.txt
+testRegular 46 0 -i --save-compiled compiled.bin 'WORLD'
+testRegular 47 0 --load-compiled compiled.bin input/input-42.txt
+rm -f compiled.bin
+
+# Lines over the --line-budget are highlighted with the automaton, and
+# come out the same as with the match tables; 0 means no limit.
+testRegular 48 0 --line-budget=1 'a(bc)*d' input/input-14.txt
+testRegular 49 0 --line-budget=1 '^Your (license|application|program) has been (revoked|accepted|tested)!$' input/input-15.txt
+testRegular 50 0 --line-budget=0 '^Your (license|application|program) has been (revoked|accepted|tested)!$' input/input-15.txt
+testRegular 51 1 --line-budget=x 'a' input/input-01.txt
+
+# --stats is reported however matching ends: after a match with -q,
+# after a line that's too long, and after saving a compiled pattern.
+testRegular 52 0 --stats -q 'this' input/input-21.txt
+testRegular 53 1 --stats 'this' input/input-21.txt
+testRegular 54 0 --stats -c 'a.c' input/input-05.txt
+testRegular 55 0 --stats --save-compiled compiled.bin 'ab*c'
+rm -f compiled.bin
+
+# input-56.bin is input-57.bin with the start of one operand changed,
+# which would send --stats looking before the first step.
+testRegular 56 1 --load-compiled input/input-56.bin --stats input/input-04.txt
+testRegular 57 0 --load-compiled input/input-57.bin input/input-04.txt
+
+# A thousand patterns with a small count each, like cbdfa[a-g ]{1,3}xz,
+# take about as much memory as the same patterns written out with ?.
+# The limit is low enough that giving each count its own counter runs
+# out of room.
+( ulimit -v 65536; testRegular 58 0 -j 1 -c -f input/input-58.txt input/input-59.txt ) || FAIL=1
+( ulimit -v 65536; testRegular 59 0 -j 1 --color=never -f input/input-58.txt input/input-59.txt ) || FAIL=1
+
+if [ $FAIL -ne 0 ]; then
+  echo "**** There were failing tests"
+  exit 1
+else
+  echo "Tests successful"
+  exit 0
+fi